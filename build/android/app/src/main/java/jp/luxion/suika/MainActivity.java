@@ -383,11 +383,18 @@ public class MainActivity extends Activity {
 	}
 
 	/** セーブファイルの書き込みストリームをクローズします。 */
-	private void closeSaveFile(OutputStream os) {
+	private boolean closeSaveFile(OutputStream os) {
 		try {
 			os.close();
+			return true;
 		} catch(IOException e) {
 			Log.e("Suika", "Failed to write file.");
 		}
+		return false;
+	}
+
+	/** 書き込みを終えたセーブファイルで既存のファイルを置き換えます。 */
+	private boolean renameSaveFile(String src, String dst) {
+		return getFileStreamPath(src).renameTo(getFileStreamPath(dst));
 	}
 }
@@ -29,46 +29,80 @@
 
 /*
  * 再生バッファ
+ *  - すべてのストリームを1つのデバイスに合成して出力するので、
+ *    再生開始と停止の遅延がバッファの長さで決まる
+ *  - ピリオドとバッファの長さはコンフィグで変更できる(ミリ秒)
  */
-#define BUF_FRAMES		(SAMPLING_RATE)
-#define BUF_SIZE		(BUF_FRAMES * FRAME_SIZE)
-#define PERIODS			(4)
-#define PERIOD_FRAMES		(BUF_FRAMES / PERIODS)
-#define PERIOD_SIZE		(BUF_SIZE / PERIODS)
-#define PERIOD_FRAMES_PAD	((PERIOD_SIZE + 63) / 64 * 64 - PERIOD_SIZE)
-
-/*
- * ストリームごとのデータ
- */
+#define DEFAULT_PERIOD_MS	(20)
+#define DEFAULT_BUFFER_MS	(80)
+#define PERIOD_FRAMES_MIN	(256)
+#define PERIOD_FRAMES_MAX	(4096)
+#define PERIOD_SIZE_MAX		(PERIOD_FRAMES_MAX * FRAME_SIZE)
+#define PERIOD_FRAMES_PAD \
+	((PERIOD_SIZE_MAX + 63) / 64 * 64 - PERIOD_SIZE_MAX)
 
 /* ALSAデバイス */
-static snd_pcm_t *pcm[MIXER_STREAMS];
-
-/* 入力ストリーム */
-static struct wave *wave[MIXER_STREAMS];
+static snd_pcm_t *pcm;
 
 /* サウンドスレッド */
-static pthread_t thread[MIXER_STREAMS];
+static pthread_t thread;
 
 /* メインスレッドとサウンドスレッドの排他制御用ミューテックス */
-static pthread_mutex_t mutex[MIXER_STREAMS];
+static pthread_mutex_t mutex;
 
 /* メインスレッドからサウンドスレッドへの要求用条件変数 */
-static pthread_cond_t req[MIXER_STREAMS];
+static pthread_cond_t req;
 
 /* サウンドスレッドからメインスレッドへの応答用条件変数 */
-static pthread_cond_t ack[MIXER_STREAMS];
+static pthread_cond_t ack;
+
+/* 使用終了の要求に使うフラグ */
+static bool quit;
+
+/* 1回に合成するフレーム数(デバイスのピリオドの長さ) */
+static int period_frames;
+
+/*
+ * サウンドスレッドの統計情報(終了時にログに出力する)
+ */
+
+/* 合成したピリオドの数 */
+static int stat_periods;
+
+/* 再生中のストリームがなく、要求を待った回数 */
+static int stat_idle_waits;
 
-/* バッファ */
+/* デバイスのアンダーランから復帰した回数 */
+static int stat_xruns;
+
+/* スレッドが消費したCPU時間(ミリ秒) */
+static int stat_cpu_ms;
+
+/* 再生中のストリームがない間に消費したCPU時間(ミリ秒) */
+static int stat_idle_cpu_ms;
+
+/* 合成結果のバッファ */
 #ifndef SSE_VERSIONING
-static uint32_t period_buf[MIXER_STREAMS][PERIOD_FRAMES + PERIOD_FRAMES_PAD];
+static uint32_t mix_buf[PERIOD_FRAMES_MAX + PERIOD_FRAMES_PAD];
 #else
-ALIGN_DECL(SSE_ALIGN, static uint32_t period_buf[MIXER_STREAMS][PERIOD_FRAMES +
-							PERIOD_FRAMES_PAD]);
+ALIGN_DECL(SSE_ALIGN, static uint32_t mix_buf[PERIOD_FRAMES_MAX +
+					      PERIOD_FRAMES_PAD]);
 #endif
 
-/* 使用終了の要求に使うフラグ */
-static bool quit[MIXER_STREAMS];
+/* ストリームから取得したサンプルのバッファ */
+#ifndef SSE_VERSIONING
+static uint32_t period_buf[PERIOD_FRAMES_MAX + PERIOD_FRAMES_PAD];
+#else
+ALIGN_DECL(SSE_ALIGN, static uint32_t period_buf[PERIOD_FRAMES_MAX +
+						 PERIOD_FRAMES_PAD]);
+#endif
+
+/*
+ * ストリームごとのデータ
+ */
+
+/* 入力ストリーム */
+static struct wave *wave[MIXER_STREAMS];
 
 /* ボリューム */
 static float volume[MIXER_STREAMS];
@@ -76,53 +110,57 @@ static float volume[MIXER_STREAMS];
 /* 再生終了フラグ */
 static bool finish[MIXER_STREAMS];
 
+/* サウンドスレッドがロックの外でデコード中の入力ストリーム */
+static struct wave *busy[MIXER_STREAMS];
+
 /*
  * 前方参照
  */
-static bool init_pcm(int n);
+static bool init_pcm(void);
 static void *sound_thread(void *p);
-static bool playback_period(int n);
+static bool is_playing(void);
+static bool wait_pcm(void);
+static int get_thread_cpu_ms(void);
+static void mix_period(struct wave **cur, float *vol, bool *eos);
+static void finish_period(struct wave **cur, bool *eos);
 
 /*
  * ALSAの初期化処理を行う
  */
 bool init_asound(void)
 {
-	int n, ret;
+	int n;
 
 	for (n = 0; n < MIXER_STREAMS; n++) {
 		/* ストリームごとのデータを初期化する */
-		pcm[n] = NULL;
 		wave[n] = NULL;
-		quit[n] = false;
 		volume[n] = 1.0f;
 		finish[n] = false;
+		busy[n] = NULL;
+	}
+	pcm = NULL;
+	quit = false;
+	stat_periods = 0;
+	stat_idle_waits = 0;
+	stat_xruns = 0;
+	stat_cpu_ms = 0;
+	stat_idle_cpu_ms = 0;
+
+	/* デバイスを初期化する */
+	if (!init_pcm())
+		return false;
 
-		/* デバイスを初期化する */
-		if (!init_pcm(n))
-			return false;
-
-		/* ミューテックスを作成する */
-		pthread_mutex_init(&mutex[n], NULL);
-
-		/* 条件変数を作成する */
-		pthread_cond_init(&req[n], NULL);
-		pthread_cond_init(&ack[n], NULL);
+	/* ミューテックスを作成する */
+	pthread_mutex_init(&mutex, NULL);
 
-		pthread_mutex_lock(&mutex[n]);
-		{
-			/* スレッドを開始する */
-			ret = pthread_create(&thread[n], NULL, sound_thread,
-					     (void *)(intptr_t)n);
-			if (ret != 0) {
-				pthread_mutex_unlock(&mutex[n]);
-				return false;
-			}
+	/* 条件変数を作成する */
+	pthread_cond_init(&req, NULL);
+	pthread_cond_init(&ack, NULL);
 
-			/* 待ち状態に入ったことの応答を受信する */
-			pthread_cond_wait(&ack[n], &mutex[n]);
-		}
-		pthread_mutex_unlock(&mutex[n]);
+	/* スレッドを開始する */
+	if (pthread_create(&thread, NULL, sound_thread, NULL) != 0) {
+		log_api_error("pthread_create");
+		return false;
 	}
 
 	return true;
@@ -134,32 +172,37 @@ bool init_asound(void)
 void cleanup_asound(void)
 {
 	void *p1;
-	int n;
 
-	for (n = 0; n < MIXER_STREAMS; n++) {
-		/* 再生を終了する */
-		stop_sound(n);
+	pthread_mutex_lock(&mutex);
+	{
+		/* 使用終了の通知を行う */
+		quit = true;
+		pthread_cond_signal(&req);
+	}
+	pthread_mutex_unlock(&mutex);
 
-		pthread_mutex_lock(&mutex[n]);
-		{
-			/* 使用終了の通知を行う */
-			quit[n] = true;
-			pthread_cond_signal(&req[n]);
-		}
-		pthread_mutex_unlock(&mutex[n]);
+	/* スレッドの終了を待つ */
+	pthread_join(thread, &p1);
 
-		/* スレッドの終了を待つ */
-		pthread_join(thread[n], &p1);
+	/* デバイスをクローズする */
+	if (pcm != NULL) {
+		snd_pcm_drop(pcm);
+		snd_pcm_close(pcm);
+	}
 
-		/* デバイスをクローズする */
-		if (pcm[n] != NULL)
-			snd_pcm_close(pcm[n]);
+	/* 条件変数を破棄する */
+	pthread_cond_destroy(&req);
+	pthread_cond_destroy(&ack);
 
-		/* 条件変数を破棄する */
-		pthread_cond_destroy(&req[n]);
+	/* ミューテックスを破棄する */
+	pthread_mutex_destroy(&mutex);
 
-		/* ミューテックスを破棄する */
-		pthread_mutex_destroy(&mutex[n]);
+	/* サウンドスレッドの統計情報を出力する */
+	if (conf_sound_stat_on) {
+		log_info("Sound: %d periods, %d idle waits, %d xruns, "
+			 "CPU %d ms (idle %d ms)\n", stat_periods,
+			 stat_idle_waits, stat_xruns, stat_cpu_ms,
+			 stat_idle_cpu_ms);
 	}
 }
 
@@ -171,45 +214,40 @@ bool play_sound(int n, struct wave *w)
 	assert(n < MIXER_STREAMS);
 	assert(w != NULL);
 
-	/* 再生中であれば停止する */
-	stop_sound(n);
-
-	pthread_mutex_lock(&mutex[n]);
+	pthread_mutex_lock(&mutex);
 	{
-		/* PCMストリームを設定する */
+		/* PCMストリームを設定する(再生中であれば差し替える) */
 		wave[n] = w;
 
 		/* 再生終了状態をリセットする */
 		finish[n] = false;
 
 		/* 再生開始の要求を行う */
-		pthread_cond_signal(&req[n]);
+		pthread_cond_signal(&req);
 	}
-	pthread_mutex_unlock(&mutex[n]);
+	pthread_mutex_unlock(&mutex);
 	return true;
 }
 
 /*
  * サウンドの再生を停止する
+ *  - 戻った後はサウンドスレッドがストリームを参照しない
+ *  - デコード中の場合のみ、そのストリームの1ピリオド分のデコードを待つ
  */
 bool stop_sound(int n)
 {
 	assert(n < MIXER_STREAMS);
 
-	pthread_mutex_lock(&mutex[n]);
+	pthread_mutex_lock(&mutex);
 	{
-		if (wave[n] != NULL) {
-			/* 再生状態を取り消す */
-			wave[n] = NULL;
-
-			/* バッファの再生を途中でやめる */
-			snd_pcm_drop(pcm[n]);
+		/* 再生状態を取り消す */
+		wave[n] = NULL;
 
-			/* 待ち状態に入ったことの応答を受信する */
-			pthread_cond_wait(&ack[n], &mutex[n]);
-		}
+		/* ロックの外でデコード中であれば終わるのを待つ */
+		while (busy[n] != NULL)
+			pthread_cond_wait(&ack, &mutex);
 	}
-	pthread_mutex_unlock(&mutex[n]);
+	pthread_mutex_unlock(&mutex);
 	return true;
 }
 
@@ -221,20 +259,12 @@ bool set_sound_volume(int n, float vol)
 	assert(n < MIXER_STREAMS);
 	assert(vol >= 0 && vol <= 1.0f);
 
-	/*
-	 * FIXME: POSIXのセマンティクスに厳密であるためにはロックが必要だが、
-	 *        現実のコンシステンシモデルでは不要である。ロックを取ると、
-	 *        だいたい1/4秒待つことになるため、取らないことにした。
-	 */
-/*
- *	pthread_mutex_lock(&mutex[n]);
- *	{
- */
+	/* デコードと書き込みの間はロックしていないので、すぐに取得できる */
+	pthread_mutex_lock(&mutex);
+	{
 		volume[n] = vol;
-/* 
- *	}
- *	pthread_mutex_unlock(&mutex[n]);
- */
+	}
+	pthread_mutex_unlock(&mutex);
 	return true;
 }
 
@@ -243,21 +273,42 @@ bool set_sound_volume(int n, float vol)
  */
 bool is_sound_finished(int n)
 {
-	if (finish[n])
-		return true;
+	bool ret;
 
-	return false;
+	pthread_mutex_lock(&mutex);
+	{
+		ret = finish[n];
+	}
+	pthread_mutex_unlock(&mutex);
+
+	return ret;
 }
 
 /* デバイスを初期化する */
-static bool init_pcm(int n)
+static bool init_pcm(void)
 {
 	snd_pcm_hw_params_t *params;
-	snd_pcm_uframes_t frames;
+	snd_pcm_uframes_t period, buffer;
 	int ret;
 
+	/* コンフィグからピリオドとバッファのフレーム数を求める */
+	period = (snd_pcm_uframes_t)SAMPLING_RATE *
+		(snd_pcm_uframes_t)(conf_sound_period_ms > 0 ?
+				    conf_sound_period_ms :
+				    DEFAULT_PERIOD_MS) / 1000;
+	buffer = (snd_pcm_uframes_t)SAMPLING_RATE *
+		(snd_pcm_uframes_t)(conf_sound_buffer_ms > 0 ?
+				    conf_sound_buffer_ms :
+				    DEFAULT_BUFFER_MS) / 1000;
+	if (period < PERIOD_FRAMES_MIN)
+		period = PERIOD_FRAMES_MIN;
+	if (period > PERIOD_FRAMES_MAX)
+		period = PERIOD_FRAMES_MAX;
+	if (buffer < period * 2)
+		buffer = period * 2;
+
 	/* デバイスをオープンする */
-	ret = snd_pcm_open(&pcm[n], "default", SND_PCM_STREAM_PLAYBACK, 0);
+	ret = snd_pcm_open(&pcm, "default", SND_PCM_STREAM_PLAYBACK, 0);
 	if (ret < 0) {
 		log_api_error("snd_pcm_open");
 		return false;
@@ -268,145 +319,236 @@ static bool init_pcm(int n)
 	 */
 
 	snd_pcm_hw_params_alloca(&params);
-	ret = snd_pcm_hw_params_any(pcm[n], params);
+	ret = snd_pcm_hw_params_any(pcm, params);
 	if (ret < 0) {
 		log_api_error("snd_pcm_hw_params_any");
 		return false;
 	}
 	
-	if (snd_pcm_hw_params_set_access(pcm[n], params,
+	if (snd_pcm_hw_params_set_access(pcm, params,
 					 SND_PCM_ACCESS_RW_INTERLEAVED) < 0) {
 		log_api_error("snd_pcm_hw_params_set_access");
 		return false;
 	}
-	if (snd_pcm_hw_params_set_format(pcm[n], params,
+	if (snd_pcm_hw_params_set_format(pcm, params,
 					 SND_PCM_FORMAT_S16_LE) < 0) {
 		log_api_error("snd_pcm_hw_params_set_format");
 		return false;
 	}
-	if (snd_pcm_hw_params_set_rate(pcm[n], params, SAMPLING_RATE, 0) < 0) {
+	if (snd_pcm_hw_params_set_rate(pcm, params, SAMPLING_RATE, 0) < 0) {
 		log_api_error("snd_pcm_hw_params_set_rate");
 		return false;
 	}
-	if (snd_pcm_hw_params_set_channels(pcm[n], params, 2) < 0) {
+	if (snd_pcm_hw_params_set_channels(pcm, params, 2) < 0) {
 		log_api_error("snd_pcm_hw_params_set_channels");
 		return false;
 	}
-	if (snd_pcm_hw_params_set_periods(pcm[n], params, PERIODS, 0) < 0) {
-		log_api_error("snd_pcm_hw_params_set_periods");
+	if (snd_pcm_hw_params_set_period_size_near(pcm, params, &period,
+						   NULL) < 0) {
+		log_api_error("snd_pcm_hw_params_set_period_size_near");
 		return false;
 	}
-#if defined(LINUX)
-	if (snd_pcm_hw_params_set_buffer_size(pcm[n], params, BUF_FRAMES) <
-	    0) {
-		frames = BUF_FRAMES;
-		if (snd_pcm_hw_params_set_buffer_size_near(pcm[n], params,
-							   &frames) < 0) {
-			log_api_error(
-				"snd_pcm_hw_params_set_buffer_size_near");
-			return false;
-		}
+	if (snd_pcm_hw_params_set_buffer_size_near(pcm, params, &buffer) < 0) {
+		log_api_error("snd_pcm_hw_params_set_buffer_size_near");
+		return false;
 	}
-#endif
-	if (snd_pcm_hw_params(pcm[n], params) < 0) {
+	if (snd_pcm_hw_params(pcm, params) < 0) {
 		log_api_error("snd_pcm_hw_params");
 		return false;
 	}
 
+	/* デバイスが決めたピリオドの長さで合成する */
+	if (period < PERIOD_FRAMES_MIN)
+		period = PERIOD_FRAMES_MIN;
+	if (period > PERIOD_FRAMES_MAX)
+		period = PERIOD_FRAMES_MAX;
+	period_frames = (int)period;
+
 	return true;
 }
 
 /*
  * サウンドスレッド
+ *  - すべてのストリームからサンプルを取得して合成し、1つのデバイスに書き込む
  */
 
 /* サウンドスレッドのエントリポイント */
 static void *sound_thread(void *p)
 {
-	int n = (int)(intptr_t)p;
+	struct wave *cur[MIXER_STREAMS];
+	float vol[MIXER_STREAMS];
+	bool eos[MIXER_STREAMS];
+	int n, idle_start;
+	bool resumed;
+
+	UNUSED_PARAMETER(p);
 
 	while (1) {
-		pthread_mutex_lock(&mutex[n]);
+		resumed = false;
+		pthread_mutex_lock(&mutex);
 		{
-			/* 待ち状態に入ったことの応答を送る */
-			pthread_cond_signal(&ack[n]);
-
-			/* 再生開始か使用終了の要求を待つ */
-			pthread_cond_wait(&req[n], &mutex[n]);
-			if (quit[n]) {
-				pthread_mutex_unlock(&mutex[n]);
+			/* 再生中のストリームがなければ再生開始の要求を待つ */
+			if (!quit && !is_playing()) {
+				resumed = true;
+				stat_idle_waits++;
+				idle_start = get_thread_cpu_ms();
+				while (!quit && !is_playing())
+					pthread_cond_wait(&req, &mutex);
+				stat_idle_cpu_ms += get_thread_cpu_ms() -
+					idle_start;
+			}
+			if (quit) {
+				pthread_mutex_unlock(&mutex);
 				break;
 			}
 		}
-		pthread_mutex_unlock(&mutex[n]);
-
-		/* 再生ループを実行する */
-		while (playback_period(n)) {
-#if defined(LINUX)
-			/*
-			 * [重要]
-			 *  - コンテキストスイッチを明示的に行う
-			 *  - これがないとメインスレッドが止まる
-			 *  - linux 4.4.0で確認
-			 *  - sched_yield()ではだめ
-			 */
-			sleep(0);
-#elif defined(NETBSD)
-			/*
-			 * [重要]
-			 *  - コンテキストスイッチを明示的に行う
-			 *  - これがないとメインスレッドでmutexを取得できない
-			 *  - NetBSD 9.1で確認
-			 *  - sleep(0)ではだめ
-			 */
-			sched_yield();
-#endif
+		pthread_mutex_unlock(&mutex);
+
+		/*
+		 * 待っている間に書き込まなかったのでアンダーランしている
+		 *  - 再生中の異常ではないので、xrunとして数えずに復帰する
+		 */
+		if (resumed && snd_pcm_state(pcm) == SND_PCM_STATE_XRUN)
+			snd_pcm_prepare(pcm);
+
+		/*
+		 * デバイスのバッファに1ピリオド分の空きができるまで眠る
+		 *  - 空きができてから合成するので、停止と音量の変更が早く届く
+		 */
+		if (!wait_pcm())
+			continue;
+
+		pthread_mutex_lock(&mutex);
+		{
+			/* 再生中のストリームをデコード中にする */
+			for (n = 0; n < MIXER_STREAMS; n++) {
+				cur[n] = wave[n];
+				vol[n] = volume[n];
+				busy[n] = wave[n];
+			}
+		}
+		pthread_mutex_unlock(&mutex);
+
+		/* ロックの外で各ストリームをデコードして合成する */
+		mix_period(cur, vol, eos);
+		stat_periods++;
+
+		pthread_mutex_lock(&mutex);
+		{
+			/* デコード中の状態を解除し、再生終了を反映する */
+			finish_period(cur, eos);
+
+			/* 停止の要求を待っているメインスレッドを起こす */
+			pthread_cond_broadcast(&ack);
+		}
+		pthread_mutex_unlock(&mutex);
+
+		/*
+		 * デバイスに書き込む(アンダーランしている間繰り返す)
+		 *  - 空きを待った後なのでブロックしない
+		 *  - ロックの外で書き込むので、メインスレッドを止めない
+		 */
+		while (snd_pcm_writei(pcm, mix_buf,
+				      (snd_pcm_uframes_t)period_frames) < 0) {
+			stat_xruns++;
+			snd_pcm_prepare(pcm);
 		}
 	}
 
+	stat_cpu_ms = get_thread_cpu_ms();
+
 	return (void *)0;
 }
 
-/* 再生を実行する */
-static bool playback_period(int n)
+/* 再生中のストリームがあるか調べる(ロックした状態で呼び出す) */
+static bool is_playing(void)
 {
-	int size;
+	int n;
 
-	pthread_mutex_lock(&mutex[n]);
-	{
-		/* メインスレッドで再生が停止された場合 */
-		if (wave[n] == NULL) {
-			pthread_mutex_unlock(&mutex[n]);
-			return false;
-		}
+	for (n = 0; n < MIXER_STREAMS; n++)
+		if (wave[n] != NULL)
+			return true;
+
+	return false;
+}
+
+/*
+ * デバイスに書き込めるようになるまで待つ
+ *  - poll()で眠るので、待っている間はCPUを使わない
+ *  - アンダーランしていた場合は復帰してfalseを返す
+ */
+static bool wait_pcm(void)
+{
+	int ret;
+
+	/* 1秒でタイムアウトした場合はもう一度待つ */
+	ret = snd_pcm_wait(pcm, 1000);
+	if (ret > 0)
+		return true;
+	if (ret < 0) {
+		stat_xruns++;
+		snd_pcm_prepare(pcm);
+	}
+	return false;
+}
+
+/* スレッドが消費したCPU時間を取得する(ミリ秒) */
+static int get_thread_cpu_ms(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0)
+		return 0;
+
+	return (int)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+/* 1ピリオド分のサンプルを合成する(ロックせずに呼び出す) */
+static void mix_period(struct wave **cur, float *vol, bool *eos)
+{
+	int n, size;
+
+	memset(mix_buf, 0, (size_t)period_frames * FRAME_SIZE);
+
+	for (n = 0; n < MIXER_STREAMS; n++) {
+		eos[n] = false;
+		if (cur[n] == NULL)
+			continue;
 
 		/* PCMサンプルを取得する */
-		size = get_wave_samples(wave[n], period_buf[n], PERIOD_FRAMES);
+		size = get_wave_samples(cur[n], period_buf, period_frames);
 
 		/* 終端でサンプル数が足りない場合、ゼロで埋める */
-		if (size < PERIOD_FRAMES)
-			memset(period_buf[n] + size, 0,
-			       (size_t)(PERIOD_FRAMES - size) * FRAME_SIZE);
+		if (size < period_frames)
+			memset(period_buf + size, 0,
+			       (size_t)(period_frames - size) * FRAME_SIZE);
+
+		/* ボリュームの値でスケールして合成する */
+		mul_add_pcm(mix_buf, period_buf, vol[n], period_frames);
+
+		/* 終端まで再生したか */
+		eos[n] = is_wave_eos(cur[n]);
+	}
+}
 
-		/* ボリュームの値でサンプルをスケールする */
-		scale_samples(period_buf[n], PERIOD_FRAMES, volume[n]);
+/* デコード中の状態を解除する(ロックした状態で呼び出す) */
+static void finish_period(struct wave **cur, bool *eos)
+{
+	int n;
 
-		/* デバイスに書き込む(アンダーランしている間繰り返す) */
-		while (snd_pcm_writei(pcm[n], period_buf[n],
-				      PERIOD_FRAMES) < 0)
-			snd_pcm_prepare(pcm[n]);
+	for (n = 0; n < MIXER_STREAMS; n++) {
+		busy[n] = NULL;
+
+		/* デコード中に停止または差し替えられた場合 */
+		if (cur[n] == NULL || wave[n] != cur[n])
+			continue;
 
 		/* 終端まで再生した場合 */
-		if (is_wave_eos(wave[n])) {
+		if (eos[n]) {
 			wave[n] = NULL;
 			finish[n] = true;
-			pthread_mutex_unlock(&mutex[n]);
-			return false;
 		}
 	}
-	pthread_mutex_unlock(&mutex[n]);
-
-	return true;
 }
 
 /*
@@ -414,81 +556,81 @@ static bool playback_period(int n)
  */
 #ifndef SSE_VERSIONING
 
-/* scale_samples()を定義する */
-#define SCALE_SAMPLES scale_samples
-#include "scalesamples.h"
+/* mul_add_pcm()を定義する */
+#define MUL_ADD_PCM mul_add_pcm
+#include "muladdpcm.h"
 
 /*
  * SSEバージョニングを行う場合
  */
 #else
 
-/* AVX-512版scale_samples()を定義する */
+/* AVX-512版mul_add_pcm()を宣言する */
 #define PROTOTYPE_ONLY
-#define SCALE_SAMPLES scale_samples_avx512
-#include "scalesamples.h"
+#define MUL_ADD_PCM mul_add_pcm_avx512
+#include "muladdpcm.h"
 
-/* AVX2版scale_samples()を定義する */
+/* AVX2版mul_add_pcm()を宣言する */
 #define PROTOTYPE_ONLY
-#define SCALE_SAMPLES scale_samples_avx2
-#include "scalesamples.h"
+#define MUL_ADD_PCM mul_add_pcm_avx2
+#include "muladdpcm.h"
 
-/* AVX版scale_samples()を定義する */
+/* AVX版mul_add_pcm()を宣言する */
 #define PROTOTYPE_ONLY
-#define SCALE_SAMPLES scale_samples_avx
-#include "scalesamples.h"
+#define MUL_ADD_PCM mul_add_pcm_avx
+#include "muladdpcm.h"
 
-/* SSE4.2版scale_samples()を定義する */
+/* SSE4.2版mul_add_pcm()を宣言する */
 #define PROTOTYPE_ONLY
-#define SCALE_SAMPLES scale_samples_sse42
-#include "scalesamples.h"
+#define MUL_ADD_PCM mul_add_pcm_sse42
+#include "muladdpcm.h"
 
-/* SSE4.1版scale_samples()を定義する */
+/* SSE4.1版mul_add_pcm()を宣言する */
 #define PROTOTYPE_ONLY
-#define SCALE_SAMPLES scale_samples_sse41
-#include "scalesamples.h"
+#define MUL_ADD_PCM mul_add_pcm_sse41
+#include "muladdpcm.h"
 
-/* SSE3版scale_samples()を定義する */
+/* SSE3版mul_add_pcm()を宣言する */
 #define PROTOTYPE_ONLY
-#define SCALE_SAMPLES scale_samples_sse3
-#include "scalesamples.h"
+#define MUL_ADD_PCM mul_add_pcm_sse3
+#include "muladdpcm.h"
 
-/* SSE2版scale_samples()を定義する */
+/* SSE2版mul_add_pcm()を宣言する */
 #define PROTOTYPE_ONLY
-#define SCALE_SAMPLES scale_samples_sse2
-#include "scalesamples.h"
+#define MUL_ADD_PCM mul_add_pcm_sse2
+#include "muladdpcm.h"
 
-/* SSE版scale_samples()を定義する */
+/* SSE版mul_add_pcm()を宣言する */
 #define PROTOTYPE_ONLY
-#define SCALE_SAMPLES scale_samples_sse
-#include "scalesamples.h"
+#define MUL_ADD_PCM mul_add_pcm_sse
+#include "muladdpcm.h"
 
-/* 非ベクトル版scale_samples()を定義する */
+/* 非ベクトル版mul_add_pcm()を宣言する */
 #define PROTOTYPE_ONLY
-#define SCALE_SAMPLES scale_samples_novec
-#include "scalesamples.h"
+#define MUL_ADD_PCM mul_add_pcm_novec
+#include "muladdpcm.h"
 
-/* scale_samples()をディスパッチする */
-void scale_samples(uint32_t *buf, int n, float vol)
+/* mul_add_pcm()をディスパッチする */
+void mul_add_pcm(uint32_t *dst, uint32_t *src, float vol, int samples)
 {
 	if (has_avx512)
-		scale_samples_avx512(buf, n, vol);
+		mul_add_pcm_avx512(dst, src, vol, samples);
 	else if (has_avx2)
-		scale_samples_avx2(buf, n, vol);
+		mul_add_pcm_avx2(dst, src, vol, samples);
 	else if (has_avx)
-		scale_samples_avx(buf, n, vol);
+		mul_add_pcm_avx(dst, src, vol, samples);
 	else if (has_sse42)
-		scale_samples_sse42(buf, n, vol);
+		mul_add_pcm_sse42(dst, src, vol, samples);
 	else if (has_sse41)
-		scale_samples_sse41(buf, n, vol);
+		mul_add_pcm_sse41(dst, src, vol, samples);
 	else if (has_sse3)
-		scale_samples_sse3(buf, n, vol);
+		mul_add_pcm_sse3(dst, src, vol, samples);
 	else if (has_sse2)
-		scale_samples_sse2(buf, n, vol);
+		mul_add_pcm_sse2(dst, src, vol, samples);
 	else if (has_sse)
-		scale_samples_sse(buf, n, vol);
+		mul_add_pcm_sse(dst, src, vol, samples);
 	else
-		scale_samples_novec(buf, n, vol);
+		mul_add_pcm_novec(dst, src, vol, samples);
 }
 
 #endif
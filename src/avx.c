@@ -14,17 +14,24 @@
 
 #ifdef SSE_VERSIONING
 
-/* AVX版の描画関数を定義する */
+#ifndef USE_FLOAT_BLEND
+/* AVX版の描画関数を定義する(SSE2の組み込み関数を使う) */
+#define DRAW_BLEND_NONE			draw_blend_none_avx
+#define DRAW_BLEND_FAST			draw_blend_fast_avx
+#define DRAW_BLEND_NORMAL		draw_blend_normal_avx
+#define DRAW_BLEND_ADD			draw_blend_add_avx
+#define DRAW_BLEND_SUB			draw_blend_sub_avx
+#define DRAW_BLEND_FAST_PM		draw_blend_fast_pm_avx
+#include "drawimagesse2.h"
+#else
+/* AVX版の描画関数を定義する(浮動小数点版) */
 #define DRAW_BLEND_NONE			draw_blend_none_avx
 #define DRAW_BLEND_FAST			draw_blend_fast_avx
 #define DRAW_BLEND_NORMAL		draw_blend_normal_avx
 #define DRAW_BLEND_ADD			draw_blend_add_avx
 #define DRAW_BLEND_SUB			draw_blend_sub_avx
 #include "drawimage.h"
-
-/* AVX版scale_samples()を定義する */
-#define SCALE_SAMPLES scale_samples_avx
-#include "scalesamples.h"
+#endif
 
 /* AVX版draw_glyph_func()を定義する */
 #define DRAW_GLYPH_FUNC draw_glyph_func_avx
@@ -14,17 +14,25 @@
 
 #ifdef SSE_VERSIONING
 
-/* AVX2版の描画関数を定義する */
+#ifndef USE_FLOAT_BLEND
+/* AVX2版の描画関数を定義する(AVX2の組み込み関数を使う) */
+#define DRAW_BLEND_NONE			draw_blend_none_avx2
+#define DRAW_BLEND_FAST			draw_blend_fast_avx2
+#define DRAW_BLEND_NORMAL		draw_blend_normal_avx2
+#define DRAW_BLEND_ADD			draw_blend_add_avx2
+#define DRAW_BLEND_SUB			draw_blend_sub_avx2
+#define DRAW_BLEND_FAST_PM		draw_blend_fast_pm_avx2
+#define DRAW_IMAGE_MASK			draw_image_mask_avx2
+#include "drawimageavx2.h"
+#else
+/* AVX2版の描画関数を定義する(浮動小数点版) */
 #define DRAW_BLEND_NONE			draw_blend_none_avx2
 #define DRAW_BLEND_FAST			draw_blend_fast_avx2
 #define DRAW_BLEND_NORMAL		draw_blend_normal_avx2
 #define DRAW_BLEND_ADD			draw_blend_add_avx2
 #define DRAW_BLEND_SUB			draw_blend_sub_avx2
 #include "drawimage.h"
-
-/* AVX2版scale_samples()を定義する */
-#define SCALE_SAMPLES scale_samples_avx2
-#include "scalesamples.h"
+#endif
 
 /* AVX2版draw_glyph_func()を定義する */
 #define DRAW_GLYPH_FUNC draw_glyph_func_avx2
@@ -28,10 +28,15 @@ static int fade_method;
 /* フェードイン中のイメージ */
 static struct image *img;
 
+/* イメージの読み込みを待っているか */
+static bool is_loading;
+
 /*
  * 前方参照
  */
 static bool init(void);
+static bool wait_image(void);
+static bool start(void);
 static void draw(void);
 static bool cleanup(void);
 
@@ -44,6 +49,17 @@ bool bg_command(int *x, int *y, int *w, int *h)
 		if (!init())
 			return false;
 
+	/* イメージの読み込みを待っている場合 */
+	if (is_loading) {
+		if (!wait_image())
+			return false;
+		if (is_loading) {
+			/* 画面は変化しない */
+			draw_stage_dirty(x, y, w, h);
+			return true;
+		}
+	}
+
 	draw();
 
 	if (!is_in_command_repetition())
@@ -68,8 +84,8 @@ static bool init(void)
 	span = get_float_param(BG_PARAM_SPAN);
 	method = get_string_param(BG_PARAM_METHOD);
 
- 	/* 描画メソッドを識別する */
-	fade_method = get_fade_method(method);
+ 	/* 描画メソッドを識別する(ロード時に変換済み) */
+	fade_method = get_fade_method_param(BG_PARAM_METHOD);
 	if (fade_method == FADE_METHOD_INVALID) {
 		log_script_fade_method(method);
 		log_script_exec_footer();
@@ -82,15 +98,53 @@ static bool init(void)
 		img = create_image_from_color_string(conf_window_width,
 						     conf_window_height,
 						     &fname[1]);
+	} else if (is_image_loading(BG_DIR, fname, false)) {
+		/* デコードが完了するまで繰り返し動作で待つ */
+		is_loading = true;
+		start_command_repetition();
+		return true;
 	} else {
-		/* イメージを読み込む */
-		img = create_image_from_file(BG_DIR, fname);
+		/* 読み込まれたイメージを受け取る */
+		img = take_loaded_image(BG_DIR, fname, false);
 	}
 	if (img == NULL) {
 		log_script_exec_footer();
 		return false;
 	}
 
+	return start();
+}
+
+/* イメージの読み込みの完了を待つ */
+static bool wait_image(void)
+{
+	const char *fname;
+
+	fname = get_string_param(BG_PARAM_FILE);
+	if (is_image_loading(BG_DIR, fname, false))
+		return true;
+
+	/* 読み込みが完了したので待機を終了する */
+	is_loading = false;
+	stop_command_repetition();
+
+	/* 読み込まれたイメージを受け取る */
+	img = take_loaded_image(BG_DIR, fname, false);
+	if (img == NULL) {
+		log_script_exec_footer();
+		return false;
+	}
+
+	return start();
+}
+
+/* 背景の切り替えを開始する */
+static bool start(void)
+{
+	const char *fname;
+
+	fname = get_string_param(BG_PARAM_FILE);
+
 	/* 背景・キャラクタファイル名を設定する */
 	if (!set_bg_file_name(fname))
 		return false;
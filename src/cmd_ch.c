@@ -17,11 +17,16 @@ static stop_watch_t sw;
 static float span;
 static int fade_method;
 
+/* イメージの読み込みを待っているか */
+static bool is_loading;
+
 static bool init(void);
+static bool wait_image(void);
+static bool start(struct image *img);
 static bool get_position(int *xpos, int *ypos, int *chpos, const char *pos,
 			 struct image *img);
 static int get_alpha(const char *alpha);
-static void draw(void);
+static void draw(int *x, int *y, int *w, int *h);
 static bool cleanup(void);
 
 /*
@@ -33,17 +38,23 @@ bool ch_command(int *x, int *y, int *w, int *h)
 		if (!init())
 			return false;
 
-	draw();
+	/* イメージの読み込みを待っている場合 */
+	if (is_loading) {
+		if (!wait_image())
+			return false;
+		if (is_loading) {
+			/* 画面は変化しない */
+			draw_stage_dirty(x, y, w, h);
+			return true;
+		}
+	}
+
+	draw(x, y, w, h);
 
 	if (!is_in_command_repetition())
 		if (!cleanup())
 			return false;
 
-	*x = 0;
-	*y = 0;
-	*w = conf_window_width;
-	*h = conf_window_height;
-
 	return true;
 }
 
@@ -54,24 +65,22 @@ static bool init(void)
 {
 	struct image *img;
 	const char *fname;
-	const char *pos;
-	const char *method;
-	const char *alpha_s;
-	int xpos, ypos, chpos, ofs_x, ofs_y, alpha;
 
 	/* パラメータを取得する */
-	pos = get_string_param(CH_PARAM_POS);
 	fname = get_string_param(CH_PARAM_FILE);
 	span = get_float_param(CH_PARAM_SPAN);
-	method = get_string_param(CH_PARAM_METHOD);
-	ofs_x = get_int_param(CH_PARAM_OFFSET_X);
-	ofs_y = get_int_param(CH_PARAM_OFFSET_Y);
-	alpha_s = get_string_param(CH_PARAM_ALPHA);
 
 	/* イメージが指定された場合 */
 	if (strcmp(fname, "none") != 0) {
-		/* イメージを読み込む */
-		img = create_image_from_file(CH_DIR, fname);
+		/* デコードが完了するまで繰り返し動作で待つ */
+		if (is_image_loading(CH_DIR, fname, true)) {
+			is_loading = true;
+			start_command_repetition();
+			return true;
+		}
+
+		/* 読み込まれたイメージを受け取る */
+		img = take_loaded_image(CH_DIR, fname, true);
 		if (img == NULL) {
 			log_script_exec_footer();
 			return false;
@@ -81,6 +90,50 @@ static bool init(void)
 		img = NULL;
 	}
 
+	return start(img);
+}
+
+/* イメージの読み込みの完了を待つ */
+static bool wait_image(void)
+{
+	struct image *img;
+	const char *fname;
+
+	fname = get_string_param(CH_PARAM_FILE);
+	if (is_image_loading(CH_DIR, fname, true))
+		return true;
+
+	/* 読み込みが完了したので待機を終了する */
+	is_loading = false;
+	stop_command_repetition();
+
+	/* 読み込まれたイメージを受け取る */
+	img = take_loaded_image(CH_DIR, fname, true);
+	if (img == NULL) {
+		log_script_exec_footer();
+		return false;
+	}
+
+	return start(img);
+}
+
+/* キャラの切り替えを開始する */
+static bool start(struct image *img)
+{
+	const char *fname;
+	const char *pos;
+	const char *method;
+	const char *alpha_s;
+	int xpos, ypos, chpos, ofs_x, ofs_y, alpha;
+
+	/* パラメータを取得する */
+	pos = get_string_param(CH_PARAM_POS);
+	fname = get_string_param(CH_PARAM_FILE);
+	method = get_string_param(CH_PARAM_METHOD);
+	ofs_x = get_int_param(CH_PARAM_OFFSET_X);
+	ofs_y = get_int_param(CH_PARAM_OFFSET_Y);
+	alpha_s = get_string_param(CH_PARAM_ALPHA);
+
 	/* 位置を取得する */
 	if (!get_position(&xpos, &ypos, &chpos, pos, img))
 		return false;
@@ -88,8 +141,8 @@ static bool init(void)
 	xpos += ofs_x;
 	ypos += ofs_y;
 
-	/* フェードの種類を求める */
-	fade_method = get_fade_method(method);
+	/* フェードの種類を求める(ロード時に変換済み) */
+	fade_method = get_fade_method_param(CH_PARAM_METHOD);
 	if (fade_method == FADE_METHOD_INVALID) {
 		/* スクリプト実行エラー */
 		log_script_fade_method(method);
@@ -180,15 +233,17 @@ static int get_alpha(const char *alpha)
 }
 
 /* 描画を行う */
-static void draw(void)
+static void draw(int *x, int *y, int *w, int *h)
 {
 	float lap;
+	bool is_fading;
 
 	/* 経過時間を取得する */
 	lap = (float)get_stop_watch_lap(&sw) / 1000.0f;
 	if (lap >= span)
 		lap = span;
 
+	is_fading = is_in_command_repetition();
 	if (is_in_command_repetition()) {
 		/*
 		 * 経過時間が一定値を超えた場合と、
@@ -210,10 +265,21 @@ static void draw(void)
 	}
 
 	/* ステージを描画する */
-	if (is_in_command_repetition())
+	if (is_in_command_repetition()) {
 		draw_stage_ch_fade(fade_method);
-	else
+	} else if (is_fading) {
+		/* フェードの最後のフレームは画面全体が変化している */
 		draw_stage();
+	} else {
+		/* フェードしない場合は変化した矩形だけを描画する */
+		draw_stage_dirty(x, y, w, h);
+		return;
+	}
+
+	*x = 0;
+	*y = 0;
+	*w = conf_window_width;
+	*h = conf_window_height;
 }
 
 /* 終了処理を行う */
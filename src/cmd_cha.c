@@ -28,7 +28,7 @@ static bool init(void);
 static bool get_position(int *chpos, const char *pos);
 static bool get_accel(const char *accel_s);
 static int get_alpha(const char *alpha);
-static void draw(void);
+static void draw(int *x, int *y, int *w, int *h);
 static bool cleanup(void);
 
 /*
@@ -40,17 +40,12 @@ bool cha_command(int *x, int *y, int *w, int *h)
 		if (!init())
 			return false;
 
-	draw();
+	draw(x, y, w, h);
 
 	if (!is_in_command_repetition())
 		if (!cleanup())
 			return false;
 
-	*x = 0;
-	*y = 0;
-	*w = conf_window_width;
-	*h = conf_window_height;
-
 	return true;
 }
 
@@ -171,7 +166,7 @@ static int get_alpha(const char *alpha)
 }
 
 /* 描画を行う */
-static void draw(void)
+static void draw(int *x, int *y, int *w, int *h)
 {
 	float lap, progress;
 
@@ -217,11 +212,8 @@ static void draw(void)
 		}
 	}
 
-	/* ステージを描画する */
-	if (is_in_command_repetition())
-		draw_stage();	/* TODO: なんらかの最適化 */
-	else
-		draw_stage();
+	/* キャラの移動前と移動後の矩形だけステージを描画する */
+	draw_stage_dirty(x, y, w, h);
 }
 
 /* 終了処理を行う */
@@ -20,7 +20,15 @@ static stop_watch_t sw;
 static float span;
 static int fade_method;
 
+/* イメージの読み込みを待っているか */
+static bool is_loading;
+
 static bool init(void);
+static void get_file_names(const char **fname);
+static bool is_image_file_name(const char *fname);
+static bool is_any_image_loading(const char **fname);
+static bool wait_images(void);
+static bool start(void);
 static void get_position(int *xpos, int *ypos, int chpos, struct image *img);
 static void draw(void);
 static bool cleanup(void);
@@ -34,6 +42,17 @@ bool chs_command(int *x, int *y, int *w, int *h)
 		if (!init())
 			return false;
 
+	/* イメージの読み込みを待っている場合 */
+	if (is_loading) {
+		if (!wait_images())
+			return false;
+		if (is_loading) {
+			/* 画面は変化しない */
+			draw_stage_dirty(x, y, w, h);
+			return true;
+		}
+	}
+
 	draw();
 
 	if (!is_in_command_repetition())
@@ -53,31 +72,112 @@ bool chs_command(int *x, int *y, int *w, int *h)
  */
 static bool init(void)
 {
-	struct image *img[PARAM_SIZE];
 	const char *fname[PARAM_SIZE];
-	bool stay[PARAM_SIZE];
-	int x[PARAM_SIZE];
-	int y[PARAM_SIZE];
 	const char *method;
 	int i;
 
 	/* パラメータを取得する */
-	fname[CH_CENTER] = get_string_param(CHS_PARAM_CENTER);
-	fname[CH_RIGHT] = get_string_param(CHS_PARAM_RIGHT);
-	fname[CH_LEFT] = get_string_param(CHS_PARAM_LEFT);
-	fname[CH_BACK] = get_string_param(CHS_PARAM_BACK);
-	fname[BG_INDEX] = get_string_param(CHS_PARAM_BG);
+	get_file_names(fname);
 	span = get_float_param(CHS_PARAM_SPAN);
 	method = get_string_param(CHS_PARAM_METHOD);
 
-	/* 描画メソッドを識別する */
-	fade_method = get_fade_method(method);
+	/* 描画メソッドを識別する(ロード時に変換済み) */
+	fade_method = get_fade_method_param(CHS_PARAM_METHOD);
 	if (fade_method == FADE_METHOD_INVALID) {
 		log_script_fade_method(method);
 		log_script_exec_footer();
 		return false;
 	}
 
+	/* すべてのイメージの読み込みをまとめて要求する */
+	for (i = 0; i < PARAM_SIZE; i++) {
+		if (!is_image_file_name(fname[i]))
+			continue;
+		if (i != BG_INDEX)
+			request_image_load(CH_DIR, fname[i], true);
+		else
+			request_image_load(BG_DIR, fname[i], false);
+	}
+
+	/* デコードが完了するまで繰り返し動作で待つ */
+	if (is_any_image_loading(fname)) {
+		is_loading = true;
+		start_command_repetition();
+		return true;
+	}
+
+	return start();
+}
+
+/* ファイル名のパラメータを取得する */
+static void get_file_names(const char **fname)
+{
+	fname[CH_CENTER] = get_string_param(CHS_PARAM_CENTER);
+	fname[CH_RIGHT] = get_string_param(CHS_PARAM_RIGHT);
+	fname[CH_LEFT] = get_string_param(CHS_PARAM_LEFT);
+	fname[CH_BACK] = get_string_param(CHS_PARAM_BACK);
+	fname[BG_INDEX] = get_string_param(CHS_PARAM_BG);
+}
+
+/* 読み込むイメージのファイル名であるか(変更なしと消去以外)を調べる */
+static bool is_image_file_name(const char *fname)
+{
+	if (strcmp(fname, "stay") == 0 || strcmp(fname, "") == 0)
+		return false;
+	if (strcmp(fname, "none") == 0)
+		return false;
+	return true;
+}
+
+/* 読み込みが完了していないイメージがあるかを調べる */
+static bool is_any_image_loading(const char **fname)
+{
+	bool loading;
+	int i;
+
+	loading = false;
+	for (i = 0; i < PARAM_SIZE; i++) {
+		if (!is_image_file_name(fname[i]))
+			continue;
+		if (i != BG_INDEX) {
+			if (is_image_loading(CH_DIR, fname[i], true))
+				loading = true;
+		} else {
+			if (is_image_loading(BG_DIR, fname[i], false))
+				loading = true;
+		}
+	}
+	return loading;
+}
+
+/* イメージの読み込みの完了を待つ */
+static bool wait_images(void)
+{
+	const char *fname[PARAM_SIZE];
+
+	get_file_names(fname);
+	if (is_any_image_loading(fname))
+		return true;
+
+	/* 読み込みが完了したので待機を終了する */
+	is_loading = false;
+	stop_command_repetition();
+
+	return start();
+}
+
+/* キャラと背景の切り替えを開始する */
+static bool start(void)
+{
+	struct image *img[PARAM_SIZE];
+	const char *fname[PARAM_SIZE];
+	bool stay[PARAM_SIZE];
+	int x[PARAM_SIZE];
+	int y[PARAM_SIZE];
+	int i;
+
+	get_file_names(fname);
+
 	/* 各キャラと背景について */
 	for (i = 0; i < PARAM_SIZE; i++) {
 		stay[i] = false;
@@ -109,9 +209,11 @@ static bool init(void)
 			continue;
 		}
 
-		/* イメージを読み込む */
-		img[i] = create_image_from_file(i != BG_INDEX ? CH_DIR :
-						BG_DIR, fname[i]);
+		/* 読み込まれたイメージを受け取る(キャラは乗算済みアルファ) */
+		if (i != BG_INDEX)
+			img[i] = take_loaded_image(CH_DIR, fname[i], true);
+		else
+			img[i] = take_loaded_image(BG_DIR, fname[i], false);
 		if (img[i] == NULL) {
 			log_script_exec_footer();
 			return false;
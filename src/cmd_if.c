@@ -17,27 +17,39 @@
  */
 bool if_command(void)
 {
-	const char *lhs, *op, *rhs, *label;
-	int lval, rval, cmp;
+	const char *lhs, *op, *label;
+	int lval_index, rval_index, lval, rval, cmp;
 
 	lhs = get_string_param(IF_PARAM_LHS);
 	op = get_string_param(IF_PARAM_OP);
-	rhs = get_string_param(IF_PARAM_RHS);
 	label = get_string_param(IF_PARAM_LABEL);
 
-	/* 左辺の値を求める */
-	if (lhs[0] != '$' || strlen(lhs) == 1) {
+	/* 左辺の値を求める(変数番号はロード時に変換済み) */
+	if (!is_var_param(IF_PARAM_LHS)) {
 		log_script_lhs_not_variable(lhs);
 		log_script_exec_footer();
 		return false;
 	}
-	lval = get_variable(atoi(&lhs[1]));
+	lval_index = get_var_index_param(IF_PARAM_LHS);
+	if (lval_index < 0 || lval_index >= VAR_SIZE) {
+		log_script_var_index(lval_index);
+		log_script_exec_footer();
+		return false;
+	}
+	lval = get_variable(lval_index);
 
 	/* 右辺の値を求める */
-	if (rhs[0] == '$' && strlen(rhs) > 1)
-		rval = get_variable(atoi(&rhs[1]));
-	else
-		rval = atoi(rhs);
+	if (is_var_param(IF_PARAM_RHS)) {
+		rval_index = get_var_index_param(IF_PARAM_RHS);
+		if (rval_index < 0 || rval_index >= VAR_SIZE) {
+			log_script_var_index(rval_index);
+			log_script_exec_footer();
+			return false;
+		}
+		rval = get_variable(rval_index);
+	} else {
+		rval = get_int_param(IF_PARAM_RHS);
+	}
 
 	/* 計算する */
 	if (strcmp(op, ">") == 0) {
@@ -27,13 +27,13 @@ bool set_command(void)
 	op = get_string_param(SET_PARAM_OP);
 	rhs = get_string_param(SET_PARAM_RHS);
 
-	/* 左辺の値を求める */
-	if (lhs[0] != '$' || strlen(lhs) == 1) {
+	/* 左辺の値を求める(変数番号はロード時に変換済み) */
+	if (!is_var_param(SET_PARAM_LHS)) {
 		log_script_lhs_not_variable(lhs);
 		log_script_exec_footer();
 		return false;
 	}
-	lval_index = atoi(&lhs[1]);
+	lval_index = get_var_index_param(SET_PARAM_LHS);
 	if (lval_index < 0 || lval_index >= VAR_SIZE) {
 		log_script_var_index(lval_index);
 		log_script_exec_footer();
@@ -45,8 +45,8 @@ bool set_command(void)
 	if (strcmp(rhs, RANDOM_VARIABLE) == 0) {
 		srand((unsigned int)time(NULL));
 		rval = rand();
-	} else if (rhs[0] == '$' && strlen(rhs) > 1) {
-		rval_index = atoi(&rhs[1]);
+	} else if (is_var_param(SET_PARAM_RHS)) {
+		rval_index = get_var_index_param(SET_PARAM_RHS);
 		if (rval_index < 0 || rval_index >= VAR_SIZE) {
 			log_script_var_index(rval_index);
 			log_script_exec_footer();
@@ -54,7 +54,7 @@ bool set_command(void)
 		}
 		rval = get_variable(rval_index);
 	} else {
-		rval = atoi(rhs);
+		rval = get_int_param(SET_PARAM_RHS);
 	}
 
 	/* 計算する */
@@ -241,6 +241,42 @@ int conf_serif_outline_color_b[SERIF_COLOR_COUNT];
 /* クリックでボイスを止めない */
 int conf_voice_stop_off;
 
+/* 描画に使うスレッドの数(1以下なら並列化しない) */
+int conf_draw_thread_count;
+
+/* 並列に描画する最小のサイズ(ピクセル数, 0なら既定値) */
+int conf_draw_thread_min_size;
+
+/* 次のスクリプトとアセットを先読みする */
+int conf_prefetch_on;
+
+/* 1回に先読みする最大のサイズ(MB, 0なら既定値) */
+int conf_prefetch_max_size;
+
+/* イメージキャッシュのサイズ(MB, 0なら既定値) */
+int conf_image_cache_size;
+
+/* この先のコマンドで使うイメージを先読みしない */
+int conf_preload_off;
+
+/* 1回に先読みするイメージの最大のサイズ(MB, 0なら既定値) */
+int conf_preload_max_size;
+
+/* サウンドデバイスのピリオドの長さ(ミリ秒, 0なら既定値) */
+int conf_sound_period_ms;
+
+/* サウンドデバイスのバッファの長さ(ミリ秒, 0なら既定値) */
+int conf_sound_buffer_ms;
+
+/* 終了時にサウンドスレッドの統計情報をログに出力する */
+int conf_sound_stat_on;
+
+/* デコード済みの効果音とボイスのキャッシュのサイズ(MB, 0なら既定値) */
+int conf_sound_cache_size;
+
+/* キャッシュする1ファイルのデコード後の最大のサイズ(KB, 0なら既定値) */
+int conf_sound_cache_clip_size;
+
 /*
  * 1行のサイズ
  */
@@ -859,6 +895,18 @@ struct rule {
 	{"serif.color64.outline.b", 'i', &conf_serif_outline_color_b[63], true, false},
 	/* end codegen */
 	{"voice.stop.off", 'i', &conf_voice_stop_off, true, false},
+	{"draw.thread.count", 'i', &conf_draw_thread_count, true, false},
+	{"draw.thread.min.size", 'i', &conf_draw_thread_min_size, true, false},
+	{"prefetch.on", 'i', &conf_prefetch_on, true, false},
+	{"prefetch.max.size", 'i', &conf_prefetch_max_size, true, false},
+	{"image.cache.size", 'i', &conf_image_cache_size, true, false},
+	{"preload.off", 'i', &conf_preload_off, true, false},
+	{"preload.max.size", 'i', &conf_preload_max_size, true, false},
+	{"sound.period.ms", 'i', &conf_sound_period_ms, true, false},
+	{"sound.buffer.ms", 'i', &conf_sound_buffer_ms, true, false},
+	{"sound.stat.on", 'i', &conf_sound_stat_on, true, false},
+	{"sound.cache.size", 'i', &conf_sound_cache_size, true, false},
+	{"sound.cache.clip.size", 'i', &conf_sound_cache_clip_size, true, false},
 };
 
 #define RULE_TBL_SIZE	(sizeof(rule_tbl) / sizeof(struct rule))
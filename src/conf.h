@@ -240,6 +240,18 @@ extern int conf_serif_outline_color_b[SERIF_COLOR_COUNT];
  * その他の設定
  */
 extern int conf_voice_stop_off;
+extern int conf_draw_thread_count;
+extern int conf_draw_thread_min_size;
+extern int conf_prefetch_on;
+extern int conf_prefetch_max_size;
+extern int conf_image_cache_size;
+extern int conf_preload_off;
+extern int conf_preload_max_size;
+extern int conf_sound_period_ms;
+extern int conf_sound_buffer_ms;
+extern int conf_sound_stat_on;
+extern int conf_sound_cache_size;
+extern int conf_sound_cache_clip_size;
 
 
 /* コンフィグの初期化処理を行う */
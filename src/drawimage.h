@@ -17,6 +17,9 @@
  *  - DRAW_BLEND_NORMAL
  *  - DRAW_BLEND_ADD
  *  - DRAW_BLEND_SUB
+ *  - DRAW_BLEND_FAST_PM (省略可, USE_FLOAT_BLENDでは無視される)
+ *
+ * USE_FLOAT_BLENDが定義されていない場合、image.hの整数版の合成を使う
  */
 
 /*
@@ -70,6 +73,28 @@ void DRAW_BLEND_FAST(
 ;
 #else
 {
+#ifndef USE_FLOAT_BLEND
+	pixel_t * RESTRICT src_ptr, * RESTRICT dst_ptr;
+	uint32_t a;
+	int src_line_inc, dst_line_inc, x, y, sw, dw;
+
+	sw = get_image_width(src_image);
+	dw = get_image_width(dst_image);
+	src_ptr = get_image_pixels(src_image) + sw * src_top + src_left;
+	dst_ptr = get_image_pixels(dst_image) + dw * dst_top + dst_left;
+	src_line_inc = sw - width;
+	dst_line_inc = dw - width;
+	a = (uint32_t)alpha;
+
+	for(y = 0; y < height; y++) {
+		for(x = 0; x < width; x++, dst_ptr++) {
+			/* アルファ値で合成して転送先に格納する */
+			*dst_ptr = blend_pixel_fast(*src_ptr++, *dst_ptr, a);
+		}
+		src_ptr += src_line_inc;
+		dst_ptr += dst_line_inc;
+	}
+#else
 	pixel_t * RESTRICT src_ptr, * RESTRICT dst_ptr;
 	float a, src_r, src_g, src_b, src_a, dst_r, dst_g, dst_b, dst_a;
 	uint32_t src_pix, dst_pix;
@@ -112,8 +137,63 @@ void DRAW_BLEND_FAST(
 		src_ptr += src_line_inc;
 		dst_ptr += dst_line_inc;
 	}
+#endif
+}
+#endif
+
+#if defined(DRAW_BLEND_FAST_PM) && !defined(USE_FLOAT_BLEND)
+/*
+ * 乗算済みアルファの転送元を高速なアルファ合成で描画する関数
+ *  - 描画先のアルファ値は計算されずに255で一定となる
+ *  - 描画のアルファ値が255の場合は転送元に乗算しない
+ */
+void DRAW_BLEND_FAST_PM(
+	struct image * RESTRICT dst_image,
+	int dst_left,
+	int dst_top,
+	struct image * RESTRICT src_image,
+	int width,
+	int height,
+	int src_left,
+	int src_top,
+	int alpha)
+#ifdef PROTOTYPE_ONLY
+;
+#else
+{
+	pixel_t * RESTRICT src_ptr, * RESTRICT dst_ptr;
+	uint32_t fs;
+	int src_line_inc, dst_line_inc, x, y, sw, dw;
+
+	sw = get_image_width(src_image);
+	dw = get_image_width(dst_image);
+	src_ptr = get_image_pixels(src_image) + sw * src_top + src_left;
+	dst_ptr = get_image_pixels(dst_image) + dw * dst_top + dst_left;
+	src_line_inc = sw - width;
+	dst_line_inc = dw - width;
+	fs = alpha_to_fixed((uint32_t)alpha);
+
+	for(y = 0; y < height; y++) {
+		if (alpha == 255) {
+			for(x = 0; x < width; x++, dst_ptr++) {
+				/* そのまま合成して転送先に格納する */
+				*dst_ptr = blend_pixel_fast_pm(*src_ptr++,
+							       *dst_ptr);
+			}
+		} else {
+			for(x = 0; x < width; x++, dst_ptr++) {
+				/* アルファ値を乗算して合成する */
+				*dst_ptr = blend_pixel_fast_pm(
+					scale_pixel_pm(*src_ptr++, fs),
+					*dst_ptr);
+			}
+		}
+		src_ptr += src_line_inc;
+		dst_ptr += dst_line_inc;
+	}
 }
 #endif
+#endif
 
 /*
  * 標準的なアルファ合成による描画関数
@@ -132,6 +212,28 @@ void DRAW_BLEND_NORMAL(
 ;
 #else
 {
+#ifndef USE_FLOAT_BLEND
+	pixel_t * RESTRICT src_ptr, * RESTRICT dst_ptr;
+	uint32_t a;
+	int src_line_inc, dst_line_inc, x, y, sw, dw;
+
+	sw = get_image_width(src_image);
+	dw = get_image_width(dst_image);
+	src_ptr = get_image_pixels(src_image) + sw * src_top + src_left;
+	dst_ptr = get_image_pixels(dst_image) + dw * dst_top + dst_left;
+	src_line_inc = sw - width;
+	dst_line_inc = dw - width;
+	a = (uint32_t)alpha;
+
+	for(y = 0; y < height; y++) {
+		for(x = 0; x < width; x++, dst_ptr++) {
+			/* アルファ値で合成して転送先に格納する */
+			*dst_ptr = blend_pixel_normal(*src_ptr++, *dst_ptr, a);
+		}
+		src_ptr += src_line_inc;
+		dst_ptr += dst_line_inc;
+	}
+#else
 	pixel_t * RESTRICT src_ptr, * RESTRICT dst_ptr;
 	float a, pix_a, src_r, src_g, src_b, dst_r, dst_g, dst_b;
 	uint32_t src_pix, dst_pix, src_a, dst_a, add_a;
@@ -177,6 +279,7 @@ void DRAW_BLEND_NORMAL(
 		src_ptr += src_line_inc;
 		dst_ptr += dst_line_inc;
 	}
+#endif
 }
 #endif
 
@@ -197,6 +300,28 @@ void DRAW_BLEND_ADD(
 ;
 #else
 {
+#ifndef USE_FLOAT_BLEND
+	pixel_t * RESTRICT src_ptr, * RESTRICT dst_ptr;
+	uint32_t a;
+	int src_line_inc, dst_line_inc, x, y, sw, dw;
+
+	sw = get_image_width(src_image);
+	dw = get_image_width(dst_image);
+	src_ptr = get_image_pixels(src_image) + sw * src_top + src_left;
+	dst_ptr = get_image_pixels(dst_image) + dw * dst_top + dst_left;
+	src_line_inc = sw - width;
+	dst_line_inc = dw - width;
+	a = (uint32_t)alpha;
+
+	for(y = 0; y < height; y++) {
+		for(x = 0; x < width; x++, dst_ptr++) {
+			/* 飽和加算して転送先に格納する */
+			*dst_ptr = blend_pixel_add(*src_ptr++, *dst_ptr, a);
+		}
+		src_ptr += src_line_inc;
+		dst_ptr += dst_line_inc;
+	}
+#else
 	pixel_t * RESTRICT src_ptr, * RESTRICT dst_ptr;
 	float a, pix_a;
 	uint32_t src_pix, dst_pix;
@@ -251,6 +376,7 @@ void DRAW_BLEND_ADD(
 		src_ptr += src_line_inc;
 		dst_ptr += dst_line_inc;
 	}
+#endif
 }
 #endif
 
@@ -271,6 +397,28 @@ void DRAW_BLEND_SUB(
 ;
 #else
 {
+#ifndef USE_FLOAT_BLEND
+	pixel_t * RESTRICT src_ptr, * RESTRICT dst_ptr;
+	uint32_t a;
+	int src_line_inc, dst_line_inc, x, y, sw, dw;
+
+	sw = get_image_width(src_image);
+	dw = get_image_width(dst_image);
+	src_ptr = get_image_pixels(src_image) + sw * src_top + src_left;
+	dst_ptr = get_image_pixels(dst_image) + dw * dst_top + dst_left;
+	src_line_inc = sw - width;
+	dst_line_inc = dw - width;
+	a = (uint32_t)alpha;
+
+	for(y = 0; y < height; y++) {
+		for(x = 0; x < width; x++, dst_ptr++) {
+			/* 飽和減算して転送先に格納する */
+			*dst_ptr = blend_pixel_sub(*src_ptr++, *dst_ptr, a);
+		}
+		src_ptr += src_line_inc;
+		dst_ptr += dst_line_inc;
+	}
+#else
 	pixel_t * RESTRICT src_ptr, * RESTRICT dst_ptr;
 	float a, pix_a;
 	uint32_t src_pix, dst_pix;
@@ -325,6 +473,7 @@ void DRAW_BLEND_SUB(
 		src_ptr += src_line_inc;
 		dst_ptr += dst_line_inc;
 	}
+#endif
 }
 #endif
 
@@ -333,4 +482,5 @@ void DRAW_BLEND_SUB(
 #undef DRAW_BLEND_NORMAL
 #undef DRAW_BLEND_ADD
 #undef DRAW_BLEND_SUB
+#undef DRAW_BLEND_FAST_PM
 #undef PROTOTYPE_ONLY
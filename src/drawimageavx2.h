@@ -0,0 +1,511 @@
+﻿/* -*- coding: utf-8-with-signature; tab-width: 8; indent-tabs-mode: t; -*- */
+
+/*
+ * Suika 2
+ * Copyright (c) 2001-2021, TABATA Keiichi. All rights reserved.
+ */
+
+/*
+ * AVX2の組み込み関数による描画関数
+ *  - 1回のループで8ピクセルを処理する
+ *  - 転送先が32バイト境界に揃うまでの先頭と、8ピクセルに満たない末尾は
+ *    image.hの整数版の合成で1ピクセルずつ処理する
+ *  - 結果はdrawimage.hの整数版と完全に一致する
+ *
+ * 下記のマクロを定義してインクルードする
+ *  - DRAW_BLEND_NONE
+ *  - DRAW_BLEND_FAST
+ *  - DRAW_BLEND_NORMAL
+ *  - DRAW_BLEND_ADD
+ *  - DRAW_BLEND_SUB
+ *  - DRAW_BLEND_FAST_PM
+ *  - DRAW_IMAGE_MASK (省略可)
+ */
+
+#include <immintrin.h>
+
+#ifndef DRAWIMAGEAVX2_HELPERS
+#define DRAWIMAGEAVX2_HELPERS
+
+/* 転送先のポインタが32バイト境界に揃っているか */
+#define IS_ALIGNED_32(p)	((((uintptr_t)(p)) & 31) == 0)
+
+/* 8ピクセル分の係数(0から256)を求める */
+static INLINE __m256i get_blend_factor_avx2(__m256i src, __m256i alpha)
+{
+	__m256i x;
+
+	/* 転送元のA値に描画のアルファ値を乗算する(255*255以下) */
+	x = _mm256_mullo_epi16(_mm256_srli_epi32(src, 24), alpha);
+
+	/* 255で割って四捨五入する */
+	x = _mm256_add_epi32(x, _mm256_set1_epi32(128));
+	x = _mm256_srli_epi32(_mm256_add_epi32(x, _mm256_srli_epi32(x, 8)), 8);
+
+	/* 0から256の係数にする */
+	return _mm256_add_epi32(x, _mm256_srli_epi32(x, 7));
+}
+
+/*
+ * 係数を各ピクセルの4チャンネル分に広げる
+ *  - 128ビットごとの下位2ピクセル, 上位2ピクセルに分ける
+ */
+static INLINE void expand_factor_avx2(__m256i fa, __m256i *lo, __m256i *hi)
+{
+	fa = _mm256_or_si256(fa, _mm256_slli_epi32(fa, 16));
+	*lo = _mm256_unpacklo_epi32(fa, fa);
+	*hi = _mm256_unpackhi_epi32(fa, fa);
+}
+
+/* 8ピクセル分の全チャンネルを係数で合成する */
+static INLINE __m256i blend_rgb_avx2(__m256i src, __m256i dst, __m256i fa)
+{
+	__m256i zero, fa_lo, fa_hi, ia_lo, ia_hi, lo, hi;
+
+	zero = _mm256_setzero_si256();
+	expand_factor_avx2(fa, &fa_lo, &fa_hi);
+	ia_lo = _mm256_sub_epi16(_mm256_set1_epi16(256), fa_lo);
+	ia_hi = _mm256_sub_epi16(_mm256_set1_epi16(256), fa_hi);
+
+	/* 16ビットに広げて src * fa + dst * (256 - fa) を計算する */
+	lo = _mm256_add_epi16(
+		_mm256_mullo_epi16(_mm256_unpacklo_epi8(src, zero), fa_lo),
+		_mm256_mullo_epi16(_mm256_unpacklo_epi8(dst, zero), ia_lo));
+	hi = _mm256_add_epi16(
+		_mm256_mullo_epi16(_mm256_unpackhi_epi8(src, zero), fa_hi),
+		_mm256_mullo_epi16(_mm256_unpackhi_epi8(dst, zero), ia_hi));
+
+	/* 256で割って8ビットに戻す */
+	return _mm256_packus_epi16(_mm256_srli_epi16(lo, 8),
+				   _mm256_srli_epi16(hi, 8));
+}
+
+/* 8ピクセル分の全チャンネルに係数を乗算する */
+static INLINE __m256i scale_rgb_avx2(__m256i src, __m256i fa)
+{
+	__m256i zero, fa_lo, fa_hi, lo, hi;
+
+	zero = _mm256_setzero_si256();
+	expand_factor_avx2(fa, &fa_lo, &fa_hi);
+	lo = _mm256_mullo_epi16(_mm256_unpacklo_epi8(src, zero), fa_lo);
+	hi = _mm256_mullo_epi16(_mm256_unpackhi_epi8(src, zero), fa_hi);
+	return _mm256_packus_epi16(_mm256_srli_epi16(lo, 8),
+				   _mm256_srli_epi16(hi, 8));
+}
+
+/* 8ピクセル分の乗算済みアルファの転送元を転送先に合成する */
+static INLINE __m256i blend_pm_avx2(__m256i src, __m256i dst)
+{
+	__m256i zero, a, ia, ia_lo, ia_hi, lo, hi;
+
+	/* 転送元のA値から転送先の係数(256 - A)を求める */
+	a = _mm256_srli_epi32(src, 24);
+	ia = _mm256_sub_epi32(_mm256_set1_epi32(256),
+			      _mm256_add_epi32(a, _mm256_srli_epi32(a, 7)));
+
+	/* 転送先にだけ係数を乗算する */
+	zero = _mm256_setzero_si256();
+	expand_factor_avx2(ia, &ia_lo, &ia_hi);
+	lo = _mm256_mullo_epi16(_mm256_unpacklo_epi8(dst, zero), ia_lo);
+	hi = _mm256_mullo_epi16(_mm256_unpackhi_epi8(dst, zero), ia_hi);
+	dst = _mm256_packus_epi16(_mm256_srli_epi16(lo, 8),
+				  _mm256_srli_epi16(hi, 8));
+
+	/* 転送元を加算する(RGBは桁上りしない) */
+	return _mm256_add_epi8(src, dst);
+}
+
+#endif /* DRAWIMAGEAVX2_HELPERS */
+
+/*
+ * そのままコピーする描画関数
+ */
+void DRAW_BLEND_NONE(
+	struct image * RESTRICT dst_image,
+	int dst_left,
+	int dst_top,
+	struct image * RESTRICT src_image,
+	int width,
+	int height,
+	int src_left,
+	int src_top)
+{
+	pixel_t * RESTRICT src_ptr, * RESTRICT dst_ptr;
+	int x, y, sw, dw;
+
+	sw = get_image_width(src_image);
+	dw = get_image_width(dst_image);
+	src_ptr = get_image_pixels(src_image) + sw * src_top + src_left;
+	dst_ptr = get_image_pixels(dst_image) + dw * dst_top + dst_left;
+
+	for (y = 0; y < height; y++) {
+		/* 先頭 */
+		for (x = 0; x < width && !IS_ALIGNED_32(dst_ptr + x); x++)
+			dst_ptr[x] = src_ptr[x];
+
+		/* 8ピクセルずつ */
+		for (; x + 8 <= width; x += 8) {
+			_mm256_store_si256(
+				(__m256i *)(dst_ptr + x),
+				_mm256_loadu_si256((__m256i *)(src_ptr + x)));
+		}
+
+		/* 末尾 */
+		for (; x < width; x++)
+			dst_ptr[x] = src_ptr[x];
+
+		src_ptr += sw;
+		dst_ptr += dw;
+	}
+}
+
+/*
+ * 高速なアルファ合成による描画関数
+ *  - 描画先のアルファ値は計算されずに255で一定となる
+ */
+void DRAW_BLEND_FAST(
+	struct image * RESTRICT dst_image,
+	int dst_left,
+	int dst_top,
+	struct image * RESTRICT src_image,
+	int width,
+	int height,
+	int src_left,
+	int src_top,
+	int alpha)
+{
+	pixel_t * RESTRICT src_ptr, * RESTRICT dst_ptr;
+	__m256i a, s, d, amask;
+	int x, y, sw, dw;
+
+	sw = get_image_width(src_image);
+	dw = get_image_width(dst_image);
+	src_ptr = get_image_pixels(src_image) + sw * src_top + src_left;
+	dst_ptr = get_image_pixels(dst_image) + dw * dst_top + dst_left;
+	a = _mm256_set1_epi32(alpha);
+	amask = _mm256_set1_epi32((int)0xff000000);
+
+	for (y = 0; y < height; y++) {
+		/* 先頭 */
+		for (x = 0; x < width && !IS_ALIGNED_32(dst_ptr + x); x++) {
+			dst_ptr[x] = blend_pixel_fast(src_ptr[x], dst_ptr[x],
+						      (uint32_t)alpha);
+		}
+
+		/* 8ピクセルずつ */
+		for (; x + 8 <= width; x += 8) {
+			s = _mm256_loadu_si256((__m256i *)(src_ptr + x));
+			d = _mm256_load_si256((__m256i *)(dst_ptr + x));
+			d = blend_rgb_avx2(s, d, get_blend_factor_avx2(s, a));
+			_mm256_store_si256((__m256i *)(dst_ptr + x),
+					_mm256_or_si256(d, amask));
+		}
+
+		/* 末尾 */
+		for (; x < width; x++) {
+			dst_ptr[x] = blend_pixel_fast(src_ptr[x], dst_ptr[x],
+						      (uint32_t)alpha);
+		}
+
+		src_ptr += sw;
+		dst_ptr += dw;
+	}
+}
+
+/*
+ * 乗算済みアルファの転送元を高速なアルファ合成で描画する関数
+ *  - 描画先のアルファ値は計算されずに255で一定となる
+ *  - 描画のアルファ値が255の場合は転送元に乗算しない
+ */
+void DRAW_BLEND_FAST_PM(
+	struct image * RESTRICT dst_image,
+	int dst_left,
+	int dst_top,
+	struct image * RESTRICT src_image,
+	int width,
+	int height,
+	int src_left,
+	int src_top,
+	int alpha)
+{
+	pixel_t * RESTRICT src_ptr, * RESTRICT dst_ptr;
+	__m256i fs, s, d, amask;
+	uint32_t f;
+	int x, y, sw, dw;
+
+	sw = get_image_width(src_image);
+	dw = get_image_width(dst_image);
+	src_ptr = get_image_pixels(src_image) + sw * src_top + src_left;
+	dst_ptr = get_image_pixels(dst_image) + dw * dst_top + dst_left;
+	f = alpha_to_fixed((uint32_t)alpha);
+	fs = _mm256_set1_epi32((int)f);
+	amask = _mm256_set1_epi32((int)0xff000000);
+
+	for (y = 0; y < height; y++) {
+		/* 先頭 */
+		for (x = 0; x < width && !IS_ALIGNED_32(dst_ptr + x); x++) {
+			dst_ptr[x] = blend_pixel_fast_pm(
+				alpha == 255 ? src_ptr[x] :
+				scale_pixel_pm(src_ptr[x], f), dst_ptr[x]);
+		}
+
+		/* 8ピクセルずつ */
+		for (; x + 8 <= width; x += 8) {
+			s = _mm256_loadu_si256((__m256i *)(src_ptr + x));
+			d = _mm256_load_si256((__m256i *)(dst_ptr + x));
+			if (alpha != 255)
+				s = scale_rgb_avx2(s, fs);
+			d = blend_pm_avx2(s, d);
+			_mm256_store_si256((__m256i *)(dst_ptr + x),
+					   _mm256_or_si256(d, amask));
+		}
+
+		/* 末尾 */
+		for (; x < width; x++) {
+			dst_ptr[x] = blend_pixel_fast_pm(
+				alpha == 255 ? src_ptr[x] :
+				scale_pixel_pm(src_ptr[x], f), dst_ptr[x]);
+		}
+
+		src_ptr += sw;
+		dst_ptr += dw;
+	}
+}
+
+/*
+ * 標準的なアルファ合成による描画関数
+ */
+void DRAW_BLEND_NORMAL(
+	struct image * RESTRICT dst_image,
+	int dst_left,
+	int dst_top,
+	struct image * RESTRICT src_image,
+	int width,
+	int height,
+	int src_left,
+	int src_top,
+	int alpha)
+{
+	pixel_t * RESTRICT src_ptr, * RESTRICT dst_ptr;
+	__m256i a, s, d, rgb, add_a, amask;
+	int x, y, sw, dw;
+
+	sw = get_image_width(src_image);
+	dw = get_image_width(dst_image);
+	src_ptr = get_image_pixels(src_image) + sw * src_top + src_left;
+	dst_ptr = get_image_pixels(dst_image) + dw * dst_top + dst_left;
+	a = _mm256_set1_epi32(alpha);
+	amask = _mm256_set1_epi32((int)0xff000000);
+
+	for (y = 0; y < height; y++) {
+		/* 先頭 */
+		for (x = 0; x < width && !IS_ALIGNED_32(dst_ptr + x); x++) {
+			dst_ptr[x] = blend_pixel_normal(src_ptr[x], dst_ptr[x],
+							(uint32_t)alpha);
+		}
+
+		/* 8ピクセルずつ */
+		for (; x + 8 <= width; x += 8) {
+			s = _mm256_loadu_si256((__m256i *)(src_ptr + x));
+			d = _mm256_load_si256((__m256i *)(dst_ptr + x));
+
+			/* RGBを合成する */
+			rgb = blend_rgb_avx2(s, d, get_blend_factor_avx2(s, a));
+
+			/* A値の飽和加算を行う */
+			add_a = _mm256_adds_epu8(_mm256_and_si256(s, amask),
+					      _mm256_and_si256(d, amask));
+
+			rgb = _mm256_andnot_si256(amask, rgb);
+			_mm256_store_si256((__m256i *)(dst_ptr + x),
+					   _mm256_or_si256(rgb, add_a));
+		}
+
+		/* 末尾 */
+		for (; x < width; x++) {
+			dst_ptr[x] = blend_pixel_normal(src_ptr[x], dst_ptr[x],
+							(uint32_t)alpha);
+		}
+
+		src_ptr += sw;
+		dst_ptr += dw;
+	}
+}
+
+/*
+ * 加算ブレンドによる描画関数
+ */
+void DRAW_BLEND_ADD(
+	struct image * RESTRICT dst_image,
+	int dst_left,
+	int dst_top,
+	struct image * RESTRICT src_image,
+	int width,
+	int height,
+	int src_left,
+	int src_top,
+	int alpha)
+{
+	pixel_t * RESTRICT src_ptr, * RESTRICT dst_ptr;
+	__m256i a, s, d, rgb, amask;
+	int x, y, sw, dw;
+
+	sw = get_image_width(src_image);
+	dw = get_image_width(dst_image);
+	src_ptr = get_image_pixels(src_image) + sw * src_top + src_left;
+	dst_ptr = get_image_pixels(dst_image) + dw * dst_top + dst_left;
+	a = _mm256_set1_epi32(alpha);
+	amask = _mm256_set1_epi32((int)0xff000000);
+
+	for (y = 0; y < height; y++) {
+		/* 先頭 */
+		for (x = 0; x < width && !IS_ALIGNED_32(dst_ptr + x); x++) {
+			dst_ptr[x] = blend_pixel_add(src_ptr[x], dst_ptr[x],
+						     (uint32_t)alpha);
+		}
+
+		/* 8ピクセルずつ */
+		for (; x + 8 <= width; x += 8) {
+			s = _mm256_loadu_si256((__m256i *)(src_ptr + x));
+			d = _mm256_load_si256((__m256i *)(dst_ptr + x));
+
+			/* RGBにアルファ値を乗算し、A値は元の値にする */
+			rgb = scale_rgb_avx2(s, get_blend_factor_avx2(s, a));
+			rgb = _mm256_or_si256(_mm256_andnot_si256(amask, rgb),
+					   _mm256_and_si256(s, amask));
+
+			/* RGBA各値の飽和加算を行う */
+			_mm256_store_si256((__m256i *)(dst_ptr + x),
+					_mm256_adds_epu8(d, rgb));
+		}
+
+		/* 末尾 */
+		for (; x < width; x++) {
+			dst_ptr[x] = blend_pixel_add(src_ptr[x], dst_ptr[x],
+						     (uint32_t)alpha);
+		}
+
+		src_ptr += sw;
+		dst_ptr += dw;
+	}
+}
+
+/*
+ * 減算ブレンドによる描画関数
+ */
+void DRAW_BLEND_SUB(
+	struct image * RESTRICT dst_image,
+	int dst_left,
+	int dst_top,
+	struct image * RESTRICT src_image,
+	int width,
+	int height,
+	int src_left,
+	int src_top,
+	int alpha)
+{
+	pixel_t * RESTRICT src_ptr, * RESTRICT dst_ptr;
+	__m256i a, s, d, rgb, amask;
+	int x, y, sw, dw;
+
+	sw = get_image_width(src_image);
+	dw = get_image_width(dst_image);
+	src_ptr = get_image_pixels(src_image) + sw * src_top + src_left;
+	dst_ptr = get_image_pixels(dst_image) + dw * dst_top + dst_left;
+	a = _mm256_set1_epi32(alpha);
+	amask = _mm256_set1_epi32((int)0xff000000);
+
+	for (y = 0; y < height; y++) {
+		/* 先頭 */
+		for (x = 0; x < width && !IS_ALIGNED_32(dst_ptr + x); x++) {
+			dst_ptr[x] = blend_pixel_sub(src_ptr[x], dst_ptr[x],
+						     (uint32_t)alpha);
+		}
+
+		/* 8ピクセルずつ */
+		for (; x + 8 <= width; x += 8) {
+			s = _mm256_loadu_si256((__m256i *)(src_ptr + x));
+			d = _mm256_load_si256((__m256i *)(dst_ptr + x));
+
+			/* RGBにアルファ値を乗算する */
+			rgb = scale_rgb_avx2(s, get_blend_factor_avx2(s, a));
+
+			/* RGB各値の飽和減算と、A値の飽和加算を行う */
+			rgb = _mm256_andnot_si256(amask, rgb);
+			d = _mm256_subs_epu8(d, rgb);
+			d = _mm256_adds_epu8(d, _mm256_and_si256(s, amask));
+			_mm256_store_si256((__m256i *)(dst_ptr + x), d);
+		}
+
+		/* 末尾 */
+		for (; x < width; x++) {
+			dst_ptr[x] = blend_pixel_sub(src_ptr[x], dst_ptr[x],
+						     (uint32_t)alpha);
+		}
+
+		src_ptr += sw;
+		dst_ptr += dw;
+	}
+}
+
+/*
+ * マスクつきで描画する関数
+ *  - mask_rowsは8ライン分のマスクのビットマップ
+ *  - マスクの位相がずれないように、境界は揃えずに8ピクセルずつ処理する
+ */
+#ifdef DRAW_IMAGE_MASK
+void DRAW_IMAGE_MASK(
+	struct image * RESTRICT dst_image,
+	int dst_left,
+	int dst_top,
+	struct image * RESTRICT src_image,
+	int width,
+	int height,
+	int src_left,
+	int src_top,
+	const unsigned char *mask_rows)
+{
+	pixel_t * RESTRICT src_ptr, * RESTRICT dst_ptr;
+	__m256i bits, m, s, d;
+	unsigned char mask_cache;
+	int x, y, sw, dw;
+
+	sw = get_image_width(src_image);
+	dw = get_image_width(dst_image);
+	src_ptr = get_image_pixels(src_image) + sw * src_top + src_left;
+	dst_ptr = get_image_pixels(dst_image) + dw * dst_top + dst_left;
+	bits = _mm256_set_epi32(0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01);
+
+	for (y = 0; y < height; y++) {
+		/* このラインのマスクをピクセルごとのマスクに展開する */
+		mask_cache = mask_rows[y % 8];
+		m = _mm256_set1_epi32(mask_cache);
+		m = _mm256_cmpeq_epi32(_mm256_and_si256(m, bits), bits);
+
+		/* 8ピクセルずつ */
+		for (x = 0; x + 8 <= width; x += 8) {
+			s = _mm256_loadu_si256((__m256i *)(src_ptr + x));
+			d = _mm256_loadu_si256((__m256i *)(dst_ptr + x));
+			_mm256_storeu_si256((__m256i *)(dst_ptr + x),
+					    _mm256_blendv_epi8(d, s, m));
+		}
+
+		/* 末尾 */
+		for (; x < width; x++) {
+			if (mask_cache & (1 << (x % 8)))
+				dst_ptr[x] = src_ptr[x];
+		}
+
+		src_ptr += sw;
+		dst_ptr += dw;
+	}
+}
+#endif
+
+#undef DRAW_BLEND_NONE
+#undef DRAW_BLEND_FAST
+#undef DRAW_BLEND_NORMAL
+#undef DRAW_BLEND_ADD
+#undef DRAW_BLEND_SUB
+#undef DRAW_BLEND_FAST_PM
+#undef DRAW_IMAGE_MASK
@@ -0,0 +1,214 @@
+﻿/* -*- coding: utf-8-with-signature; tab-width: 8; indent-tabs-mode: t; -*- */
+
+/*
+ * Suika 2
+ * Copyright (C) 2001-2021, TABATA Keiichi. All rights reserved.
+ */
+
+/*
+ * 描画スレッド
+ *  - 大きな描画を行単位の帯に分け、固定数のワーカースレッドで並列に処理する
+ *  - メインスレッドも1つの帯を処理し、全ての帯が終わるまで待つ
+ *  - 各行は1つのスレッドだけが処理し、行の処理内容は単一スレッドの場合と
+ *    同じなので、結果は並列化しない場合と完全に一致する
+ *  - conf_draw_thread_countが1以下の場合はスレッドを作成しない
+ */
+
+#include "suika.h"
+#include "drawthread.h"
+
+#include <pthread.h>
+
+/* ワーカースレッドの最大数 */
+#define WORKER_MAX		(15)
+
+/* 並列化する最小の描画サイズ(ピクセル数)の既定値 */
+#define DEFAULT_MIN_SIZE	(256 * 256)
+
+/* ワーカースレッド */
+static pthread_t worker[WORKER_MAX];
+
+/* ワーカースレッドの数 */
+static int worker_count;
+
+/* 排他制御用ミューテックス */
+static pthread_mutex_t mutex;
+
+/* メインスレッドからワーカースレッドへの要求用条件変数 */
+static pthread_cond_t req;
+
+/* ワーカースレッドからメインスレッドへの応答用条件変数 */
+static pthread_cond_t ack;
+
+/* 要求の世代(要求ごとに増やす) */
+static unsigned int job_seq;
+
+/* 処理中のワーカースレッドの数 */
+static int job_remain;
+
+/* 要求された処理 */
+static draw_band_func job_func;
+static void *job_arg;
+static int job_height;
+
+/* 並列化する最小の描画サイズ */
+static int min_size;
+
+/* 使用終了の要求に使うフラグ */
+static bool quit;
+
+/*
+ * 前方参照
+ */
+static void *worker_thread(void *p);
+static void run_band(int index, int height);
+
+/*
+ * 描画スレッドの初期化処理を行う
+ */
+bool init_draw_thread(void)
+{
+	int i, count;
+
+	worker_count = 0;
+	job_seq = 0;
+	quit = false;
+	min_size = conf_draw_thread_min_size > 0 ? conf_draw_thread_min_size :
+		DEFAULT_MIN_SIZE;
+
+	/* メインスレッドの分を除いたワーカースレッドの数を求める */
+	count = conf_draw_thread_count - 1;
+	if (count <= 0)
+		return true;
+	if (count > WORKER_MAX)
+		count = WORKER_MAX;
+
+	pthread_mutex_init(&mutex, NULL);
+	pthread_cond_init(&req, NULL);
+	pthread_cond_init(&ack, NULL);
+
+	/* ワーカースレッドを作成する */
+	for (i = 0; i < count; i++) {
+		if (pthread_create(&worker[i], NULL, worker_thread,
+				   (void *)(intptr_t)i) != 0) {
+			log_api_error("pthread_create");
+			break;
+		}
+		worker_count++;
+	}
+
+	/* 1つも作成できなかった場合は並列化しない */
+	if (worker_count == 0) {
+		pthread_cond_destroy(&ack);
+		pthread_cond_destroy(&req);
+		pthread_mutex_destroy(&mutex);
+	}
+
+	return true;
+}
+
+/*
+ * 描画スレッドの終了処理を行う
+ */
+void cleanup_draw_thread(void)
+{
+	void *p;
+	int i;
+
+	if (worker_count == 0)
+		return;
+
+	/* ワーカースレッドに終了を要求する */
+	pthread_mutex_lock(&mutex);
+	quit = true;
+	pthread_cond_broadcast(&req);
+	pthread_mutex_unlock(&mutex);
+
+	/* ワーカースレッドの終了を待つ */
+	for (i = 0; i < worker_count; i++)
+		pthread_join(worker[i], &p);
+	worker_count = 0;
+
+	pthread_cond_destroy(&ack);
+	pthread_cond_destroy(&req);
+	pthread_mutex_destroy(&mutex);
+}
+
+/*
+ * 行を帯に分けて並列に描画する
+ *  - 並列化しない場合は何もせずに偽を返すので、呼び出し元で描画する
+ */
+bool run_draw_thread(draw_band_func func, void *arg, int width, int height)
+{
+	/* 並列化するか判定する */
+	if (worker_count == 0)
+		return false;
+	if (width * height < min_size || height < worker_count + 1)
+		return false;
+
+	/* ワーカースレッドに要求する */
+	pthread_mutex_lock(&mutex);
+	job_func = func;
+	job_arg = arg;
+	job_height = height;
+	job_remain = worker_count;
+	job_seq++;
+	pthread_cond_broadcast(&req);
+	pthread_mutex_unlock(&mutex);
+
+	/* メインスレッドは先頭の帯を処理する */
+	run_band(0, height);
+
+	/* 全てのワーカースレッドが終わるまで待つ */
+	pthread_mutex_lock(&mutex);
+	while (job_remain > 0)
+		pthread_cond_wait(&ack, &mutex);
+	pthread_mutex_unlock(&mutex);
+
+	return true;
+}
+
+/* ワーカースレッド */
+static void *worker_thread(void *p)
+{
+	unsigned int seq;
+	int index, height;
+
+	index = (int)(intptr_t)p + 1;
+	seq = 0;
+
+	pthread_mutex_lock(&mutex);
+	while (1) {
+		/* 新しい要求か終了要求を待つ */
+		while (seq == job_seq && !quit)
+			pthread_cond_wait(&req, &mutex);
+		if (quit)
+			break;
+		seq = job_seq;
+		height = job_height;
+		pthread_mutex_unlock(&mutex);
+
+		/* 帯を処理する */
+		run_band(index, height);
+
+		/* 終了を通知する */
+		pthread_mutex_lock(&mutex);
+		if (--job_remain == 0)
+			pthread_cond_signal(&ack);
+	}
+	pthread_mutex_unlock(&mutex);
+
+	return NULL;
+}
+
+/* index番目の帯を処理する */
+static void run_band(int index, int height)
+{
+	int bands, top, bottom;
+
+	bands = worker_count + 1;
+	top = height * index / bands;
+	bottom = height * (index + 1) / bands;
+	if (bottom > top)
+		job_func(job_arg, top, bottom - top);
+}
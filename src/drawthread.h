@@ -0,0 +1,25 @@
+﻿/* -*- coding: utf-8-with-signature; tab-width: 8; indent-tabs-mode: t; -*- */
+
+/*
+ * Suika 2
+ * Copyright (C) 2001-2021, TABATA Keiichi. All rights reserved.
+ */
+
+#ifndef SUIKA_DRAWTHREAD_H
+#define SUIKA_DRAWTHREAD_H
+
+#include "types.h"
+
+/* 描画する帯(行の範囲)を処理する関数 */
+typedef void (*draw_band_func)(void *arg, int top, int height);
+
+/* 描画スレッドの初期化処理を行う */
+bool init_draw_thread(void);
+
+/* 描画スレッドの終了処理を行う */
+void cleanup_draw_thread(void);
+
+/* 行を帯に分けて並列に描画する(並列化しない場合は偽を返す) */
+bool run_draw_thread(draw_band_func func, void *arg, int width, int height);
+
+#endif
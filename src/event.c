@@ -89,9 +89,15 @@ void on_event_cleanup(void)
 	/* ステージの終了処理を行う */
 	cleanup_stage();
 
+	/* イメージキャッシュを破棄する */
+	cleanup_image_cache();
+
 	/* ミキサの終了処理を行う */
 	cleanup_mixer();
 
+	/* PCMキャッシュを破棄する */
+	cleanup_wave_cache();
+
 	/* 文字レンダリングエンジンの終了処理を行う */
 	cleanup_glyph();
 
@@ -16,12 +16,29 @@
 
 #include "suika.h"
 
+/* POSIX環境ではパッケージをメモリマップして読み込む */
+#if defined(LINUX) || defined(FREEBSD) || defined(NETBSD) || defined(OSX)
+#define USE_MMAP
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#endif
+
 /* パッケージ内のファイルエントリの最大数 */
 #define ENTRY_SIZE		(65536)
 
 /* パッケージ内のファイル名のサイズ */
 #define FILE_NAME_SIZE		(256)
 
+/* ファイルエントリのハッシュテーブルのサイズ(2の累乗) */
+#define HASH_SIZE		(ENTRY_SIZE * 2)
+
+/* ハッシュテーブルの空きスロット */
+#define HASH_EMPTY		(-1)
+
+/* 行単位の読み込みに用いるバッファのサイズ */
+#define RFILE_BUF_SIZE		(8192)
+
 /* ファイル読み込みストリーム */
 struct rfile {
 	/* パッケージ内のファイルであるか */
@@ -34,6 +51,26 @@ struct rfile {
 	uint64_t size;
 	uint64_t offset;
 	uint64_t pos;
+
+	/*
+	 * メモリマップされたデータ
+	 *  - パッケージ内のファイルの場合はパッケージのマップ内を指す
+	 *  - 個別のファイルの場合はget_rfile_data()でマップされる
+	 */
+	const uint8_t *data;
+
+	/* 個別のファイルをマップした場合のサイズ */
+	size_t map_size;
+
+	/*
+	 * 読み込みバッファ
+	 *  - gets_rfile()が初めて呼ばれたときに確保する
+	 *  - read_rfile()はバッファに残ったデータから先に読む
+	 *  - マップされたパッケージ内のファイルでは用いない
+	 */
+	char *buf;
+	size_t buf_len;
+	size_t buf_pos;
 };
 
 /* ファイル書き込みストリーム (TODO: 難読化をサポートする) */
@@ -51,14 +88,38 @@ static struct file_entry {
 /* パッケージのファイルエントリ数 */
 static uint64_t entry_count;
 
+/*
+ * ファイルエントリのハッシュテーブル
+ *  - ファイル名からエントリのインデックスを引く(オープンアドレス法)
+ */
+static int entry_hash[HASH_SIZE];
+
 /* パッケージファイルのパス */
 static char *package_path;
 
+#ifdef USE_MMAP
+/* メモリマップされたパッケージファイル */
+static const uint8_t *package_map;
+
+/* メモリマップされたパッケージファイルのサイズ */
+static size_t package_map_size;
+#endif
+
 /*
  * 前方参照
  */
+static void build_entry_hash(void);
+static int find_entry(const char *name);
+static uint32_t hash_name(const char *name);
 static bool check_file_name(const char *file);
-static void ungetc_rfile(struct rfile *rf, char c);
+#ifdef USE_MMAP
+static void map_package(FILE *fp);
+static const uint8_t *map_file(FILE *fp, size_t *size);
+#endif
+static size_t read_rfile_direct(struct rfile *rf, void *buf, size_t size);
+static const char *peek_rfile(struct rfile *rf, size_t *avail);
+static void skip_rfile(struct rfile *rf, size_t len);
+static size_t find_line_end(const char *p, size_t len);
 
 /*
  * 初期化
@@ -118,15 +179,128 @@ bool init_file(void)
 		return false;
 	}
 
+	/* ファイル名で検索するためのハッシュテーブルを作成する */
+	build_entry_hash();
+
+#ifdef USE_MMAP
+	/* パッケージファイルをメモリマップする */
+	map_package(fp);
+#endif
+
 	fclose(fp);
 	return true;
 }
 
+#ifdef USE_MMAP
+/*
+ * パッケージファイルをメモリマップする
+ *  - 失敗した場合はファイルポインタで読み込む
+ */
+static void map_package(FILE *fp)
+{
+	uint64_t i;
+
+	package_map = map_file(fp, &package_map_size);
+	if (package_map == NULL)
+		return;
+
+	/* すべてのエントリがマップ内に収まっているか確認する */
+	for (i = 0; i < entry_count; i++) {
+		if (entry[i].offset > package_map_size ||
+		    entry[i].size > package_map_size - entry[i].offset) {
+			munmap((void *)package_map, package_map_size);
+			package_map = NULL;
+			package_map_size = 0;
+			return;
+		}
+	}
+}
+
+/* ファイル全体を読み込み専用でメモリマップする */
+static const uint8_t *map_file(FILE *fp, size_t *size)
+{
+	struct stat st;
+	void *p;
+
+	if (fstat(fileno(fp), &st) != 0)
+		return NULL;
+	if (st.st_size <= 0 || (uint64_t)st.st_size > (size_t)-1)
+		return NULL;
+
+	p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE,
+		 fileno(fp), 0);
+	if (p == MAP_FAILED)
+		return NULL;
+
+	*size = (size_t)st.st_size;
+	return p;
+}
+#endif
+
+/* ファイルエントリのハッシュテーブルを作成する */
+static void build_entry_hash(void)
+{
+	uint32_t h;
+	int i;
+
+	for (i = 0; i < HASH_SIZE; i++)
+		entry_hash[i] = HASH_EMPTY;
+
+	for (i = 0; i < (int)entry_count; i++) {
+		/* 末尾がNULでないファイル名に備える */
+		entry[i].name[FILE_NAME_SIZE - 1] = '\0';
+
+		/* 空きスロットを探して登録する */
+		h = hash_name(entry[i].name) & (HASH_SIZE - 1);
+		while (entry_hash[h] != HASH_EMPTY)
+			h = (h + 1) & (HASH_SIZE - 1);
+		entry_hash[h] = i;
+	}
+}
+
+/* ファイルエントリを検索する */
+static int find_entry(const char *name)
+{
+	uint32_t h;
+	int i;
+
+	h = hash_name(name) & (HASH_SIZE - 1);
+	while ((i = entry_hash[h]) != HASH_EMPTY) {
+		if (strcmp(entry[i].name, name) == 0)
+			return i;
+		h = (h + 1) & (HASH_SIZE - 1);
+	}
+
+	/* みつからなかった */
+	return -1;
+}
+
+/* ファイル名のハッシュ値を求める(FNV-1a) */
+static uint32_t hash_name(const char *name)
+{
+	uint32_t h;
+
+	h = 2166136261U;
+	while (*name) {
+		h ^= (uint8_t)*name++;
+		h *= 16777619U;
+	}
+
+	return h;
+}
+
 /*
  * ファイル読み込みの終了処理を行う
  */
 void cleanup_file(void)
 {
+#ifdef USE_MMAP
+	if (package_map != NULL) {
+		munmap((void *)package_map, package_map_size);
+		package_map = NULL;
+		package_map_size = 0;
+	}
+#endif
 	free(package_path);
 }
 
@@ -142,7 +316,7 @@ struct rfile *open_rfile(const char *dir, const char *file, bool save_data)
 	char entry_name[FILE_NAME_SIZE];
 	char *real_path;
 	struct rfile *rf;
-	uint64_t i;
+	int i;
 
 	/* ファイル名に半角英数字以外が含まれるかチェックする */
 	if (!check_file_name(file)) {
@@ -166,6 +340,11 @@ struct rfile *open_rfile(const char *dir, const char *file, bool save_data)
 	}
 
 	/* まずファイルシステム上のファイルを開いてみる */
+	rf->data = NULL;
+	rf->map_size = 0;
+	rf->buf = NULL;
+	rf->buf_len = 0;
+	rf->buf_pos = 0;
 	rf->fp = fopen(real_path, "rb");
 	if (rf->fp != NULL) {
 		/* 開けた場合、ファイルシステム上のファイルを用いる */
@@ -188,19 +367,28 @@ struct rfile *open_rfile(const char *dir, const char *file, bool save_data)
 		return NULL;
 	}
 
-	/* 次にパッケージ上のファイルエントリを探す(TODO: sort and search) */
+	/* 次にパッケージ上のファイルエントリを探す */
 	snprintf(entry_name, FILE_NAME_SIZE, "%s/%s", dir, file);
-	for (i = 0; i < entry_count; i++) {
-		if (strcmp(entry[i].name, entry_name) == 0)
-			break;
-	}
-	if (i == entry_count) {
+	i = find_entry(entry_name);
+	if (i == -1) {
 		/* みつからなかった場合 */
 		log_dir_file_open(dir, file);
 		free(rf);
 		return NULL;
 	}
 
+#ifdef USE_MMAP
+	/* パッケージがマップされていればマップ内を直接参照する */
+	if (package_map != NULL) {
+		rf->is_packaged = true;
+		rf->data = package_map + entry[i].offset;
+		rf->size = entry[i].size;
+		rf->offset = entry[i].offset;
+		rf->pos = 0;
+		return rf;
+	}
+#endif
+
 	/* みつかった場合、パッケージファイルを別なファイルポインタで開く */
 	rf->fp = fopen(package_path, "rb");
 	if (rf->fp == NULL) {
@@ -212,6 +400,7 @@ struct rfile *open_rfile(const char *dir, const char *file, bool save_data)
 	/* 読み込み位置にシークする */
 	if (fseek(rf->fp, (long)entry[i].offset, SEEK_SET) != 0) {
 		log_package_file_error();
+		fclose(rf->fp);
 		free(rf);
 		return 0;
 	}
@@ -224,6 +413,74 @@ struct rfile *open_rfile(const char *dir, const char *file, bool save_data)
 	return rf;
 }
 
+/*
+ * ファイルがパッケージから読み込まれるかを調べる
+ *  - ファイルシステム上に同名のファイルがある場合はfalseを返す
+ *  - ファイルが存在しなくてもエラーログは出力しない
+ */
+bool is_packaged_file(const char *dir, const char *file)
+{
+	char entry_name[FILE_NAME_SIZE];
+	char *real_path;
+	FILE *fp;
+
+	/* パッケージがなければパッケージから読み込まれることはない */
+	if (package_path == NULL)
+		return false;
+
+	/* ファイルシステム上のファイルが優先される */
+	real_path = make_valid_path(dir, file);
+	if (real_path == NULL) {
+		log_memory();
+		return false;
+	}
+	fp = fopen(real_path, "rb");
+	free(real_path);
+	if (fp != NULL) {
+		fclose(fp);
+		return false;
+	}
+
+	/* パッケージ上のファイルエントリを探す */
+	snprintf(entry_name, FILE_NAME_SIZE, "%s/%s", dir, file);
+	return find_entry(entry_name) != -1;
+}
+
+/*
+ * ファイルが存在するかを調べる
+ *  - ファイルシステム上とパッケージ内の両方を探す
+ *  - ファイルが存在しなくてもエラーログは出力しない
+ */
+bool check_file_exist(const char *dir, const char *file)
+{
+	char entry_name[FILE_NAME_SIZE];
+	char *real_path;
+	FILE *fp;
+
+	/* open_rfile()で開けないファイル名 */
+	if (!check_file_name(file))
+		return false;
+
+	/* ファイルシステム上のファイルを探す */
+	real_path = make_valid_path(dir, file);
+	if (real_path == NULL) {
+		log_memory();
+		return false;
+	}
+	fp = fopen(real_path, "rb");
+	free(real_path);
+	if (fp != NULL) {
+		fclose(fp);
+		return true;
+	}
+
+	/* パッケージ上のファイルエントリを探す */
+	if (package_path == NULL)
+		return false;
+	snprintf(entry_name, FILE_NAME_SIZE, "%s/%s", dir, file);
+	return find_entry(entry_name) != -1;
+}
+
 /* ファイル名に半角英数字以外が含まれるかチェックする */
 static bool check_file_name(const char *file)
 {
@@ -260,6 +517,31 @@ size_t get_rfile_size(struct rfile *rf)
 	return (size_t)rf->size;
 }
 
+/*
+ * ファイルの内容をコピーせずに参照する
+ *  - メモリマップできない場合はNULLを返すので、read_rfile()で読み込むこと
+ *  - 返されたポインタはclose_rfile()まで有効
+ */
+const void *get_rfile_data(struct rfile *rf, size_t *size)
+{
+	assert(rf != NULL);
+
+#ifdef USE_MMAP
+	/* 個別のファイルは初めて参照されたときにマップする */
+	if (!rf->is_packaged && rf->data == NULL)
+		rf->data = map_file(rf->fp, &rf->map_size);
+
+	if (rf->data == NULL)
+		return NULL;
+
+	*size = rf->is_packaged ? (size_t)rf->size : rf->map_size;
+	return rf->data;
+#else
+	UNUSED_PARAMETER(size);
+	return NULL;
+#endif
+}
+
 /*
  * ファイル読み込みストリームから読み込む
  */
@@ -268,7 +550,27 @@ size_t read_rfile(struct rfile *rf, void *buf, size_t size)
 	size_t len;
 
 	assert(rf != NULL);
-	assert(rf->fp != NULL);
+	assert(rf->fp != NULL || rf->data != NULL);
+
+	/* gets_rfile()でバッファに読み込んだデータが残っていれば先に返す */
+	len = 0;
+	if (rf->buf_pos < rf->buf_len) {
+		len = rf->buf_len - rf->buf_pos;
+		if (len > size)
+			len = size;
+		memcpy(buf, rf->buf + rf->buf_pos, len);
+		rf->buf_pos += len;
+		if (len == size)
+			return len;
+	}
+
+	return len + read_rfile_direct(rf, (char *)buf + len, size - len);
+}
+
+/* バッファを介さずにファイル読み込みストリームから読み込む */
+static size_t read_rfile_direct(struct rfile *rf, void *buf, size_t size)
+{
+	size_t len;
 
 	/* ファイルシステム上のファイルの場合 */
 	if (!rf->is_packaged) {
@@ -281,80 +583,187 @@ size_t read_rfile(struct rfile *rf, void *buf, size_t size)
 		size = (size_t)(rf->size - rf->pos);
 	if (size == 0)
 		return 0;
+	if (rf->data != NULL) {
+		/* マップされている場合はコピーするだけ */
+		memcpy(buf, rf->data + rf->pos, size);
+		rf->pos += size;
+		return size;
+	}
 	len = fread(buf, 1, size, rf->fp);
 	rf->pos += len;
 	return len;
 }
 
-/* ファイル読み込みストリームに1文字戻す */
-static void ungetc_rfile(struct rfile *rf, char c)
-{
-	assert(rf != NULL);
-	assert(rf->fp != NULL);
-
-	if (rf->fp != NULL) {
-		/* ファイルシステム上のファイルの場合 */
-		ungetc(c, rf->fp);
-	} else {
-		/* パッケージ内のファイルの場合 */
-		assert(rf->pos != 0);
-		ungetc(c, rf->fp);
-		rf->pos--;
-	}
-}
-
 /*
  * ファイル読み込みストリームから1行読み込む
+ *  - 改行はLF、CRLF、CR、NULのいずれか
+ *  - 行がバッファに収まらない場合は、残りを次の行として返す
  */
 const char *gets_rfile(struct rfile *rf, char *buf, size_t size)
 {
-	char *ptr;
-	size_t len;
+	const char *p;
+	size_t len, avail, n;
 	char c;
 
 	assert(rf != NULL);
-	assert(rf->fp != NULL);
-
-	ptr = buf;
-
-	for (len = 0; len < size - 1; len++) {
-		if (read_rfile(rf, &c, 1) != 1) {
-			*ptr = '\0';
+	assert(rf->fp != NULL || rf->data != NULL);
+	assert(size > 0);
+
+	len = 0;
+	while (len < size - 1) {
+		/* 読み込み済みのデータを参照する */
+		p = peek_rfile(rf, &avail);
+		if (p == NULL) {
+			/* ファイルの終端に達した */
+			buf[len] = '\0';
 			return len == 0 ? NULL : buf;
 		}
-		if (c == '\n' || c == '\0') {
-			*ptr = '\0';
-			return buf;
-		}
+
+		/* 改行の手前までをコピーする */
+		if (avail > size - 1 - len)
+			avail = size - 1 - len;
+		n = find_line_end(p, avail);
+		memcpy(buf + len, p, n);
+		len += n;
+		skip_rfile(rf, n);
+		if (n == avail)
+			continue;
+
+		/* 改行を読み飛ばす(CRLFは1つの改行とする) */
+		c = p[n];
+		skip_rfile(rf, 1);
 		if (c == '\r') {
-			if (read_rfile(rf, &c, 1) != 1) {
-				ungetc_rfile(rf, c);
-				*ptr = '\0';
-				return buf;
-			}
-			if (c == '\n') {
-				*ptr = '\0';
-				return buf;
-			}
-			ungetc_rfile(rf, c);
-			*ptr = '\0';
-			return buf;
+			p = peek_rfile(rf, &avail);
+			if (p != NULL && p[0] == '\n')
+				skip_rfile(rf, 1);
 		}
-		*ptr++ = c;
+		break;
 	}
-	*ptr = '\0';
+	buf[len] = '\0';
 	return buf;
 }
 
+/* 読み込み済みのデータを参照する(なければ補充し、終端ならNULLを返す) */
+static const char *peek_rfile(struct rfile *rf, size_t *avail)
+{
+	/* マップされたパッケージ内のファイルはマップを直接参照する */
+	if (rf->is_packaged && rf->data != NULL) {
+		if (rf->pos == rf->size)
+			return NULL;
+		*avail = (size_t)(rf->size - rf->pos);
+		return (const char *)rf->data + rf->pos;
+	}
+
+	/* バッファが空であればブロック単位で補充する */
+	if (rf->buf_pos == rf->buf_len) {
+		if (rf->buf == NULL) {
+			rf->buf = malloc(RFILE_BUF_SIZE);
+			if (rf->buf == NULL) {
+				log_memory();
+				return NULL;
+			}
+		}
+		rf->buf_len = read_rfile_direct(rf, rf->buf, RFILE_BUF_SIZE);
+		rf->buf_pos = 0;
+		if (rf->buf_len == 0)
+			return NULL;
+	}
+
+	*avail = rf->buf_len - rf->buf_pos;
+	return rf->buf + rf->buf_pos;
+}
+
+/* 参照したデータを読み込み済みにする */
+static void skip_rfile(struct rfile *rf, size_t len)
+{
+	if (rf->is_packaged && rf->data != NULL)
+		rf->pos += len;
+	else
+		rf->buf_pos += len;
+}
+
+/* 最初の改行(LF、CR、NUL)の位置を求める(なければlenを返す) */
+static size_t find_line_end(const char *p, size_t len)
+{
+	const char *q;
+
+	q = memchr(p, '\n', len);
+	if (q != NULL)
+		len = (size_t)(q - p);
+	q = memchr(p, '\r', len);
+	if (q != NULL)
+		len = (size_t)(q - p);
+	q = memchr(p, '\0', len);
+	if (q != NULL)
+		len = (size_t)(q - p);
+	return len;
+}
+
+/*
+ * ファイル読み込みストリームの読み込み位置を設定する
+ *  - gets_rfile()で読み込んだバッファの残りは破棄される
+ */
+bool seek_rfile(struct rfile *rf, size_t pos)
+{
+	assert(rf != NULL);
+	assert(rf->fp != NULL || rf->data != NULL);
+
+	rf->buf_len = 0;
+	rf->buf_pos = 0;
+
+	/* ファイルシステム上のファイルの場合 */
+	if (!rf->is_packaged)
+		return fseek(rf->fp, (long)pos, SEEK_SET) == 0;
+
+	/* パッケージ内のファイルの場合 */
+	if (pos > rf->size)
+		return false;
+	if (rf->data == NULL &&
+	    fseek(rf->fp, (long)(rf->offset + pos), SEEK_SET) != 0)
+		return false;
+	rf->pos = pos;
+	return true;
+}
+
+/*
+ * ファイル読み込みストリームの読み込み位置を取得する
+ *  - gets_rfile()で読み込んだバッファの残りはまだ読まれていないものとする
+ */
+size_t tell_rfile(struct rfile *rf)
+{
+	size_t rest;
+
+	assert(rf != NULL);
+	assert(rf->fp != NULL || rf->data != NULL);
+
+	rest = rf->buf_len - rf->buf_pos;
+
+	/* ファイルシステム上のファイルの場合 */
+	if (!rf->is_packaged)
+		return (size_t)ftell(rf->fp) - rest;
+
+	/* パッケージ内のファイルの場合 */
+	return (size_t)rf->pos - rest;
+}
+
 /*
  * ファイル読み込みストリームを閉じる
  */
 void close_rfile(struct rfile *rf)
 {
 	assert(rf != NULL);
-	assert(rf->fp != NULL);
+	assert(rf->fp != NULL || rf->data != NULL);
 
-	fclose(rf->fp);
+#ifdef USE_MMAP
+	/* 個別にマップしたファイルをアンマップする */
+	if (!rf->is_packaged && rf->data != NULL)
+		munmap((void *)rf->data, rf->map_size);
+#endif
+
+	if (rf->fp != NULL)
+		fclose(rf->fp);
+	if (rf->buf != NULL)
+		free(rf->buf);
 	free(rf);
 }
 
@@ -416,12 +825,57 @@ size_t write_wfile(struct wfile *wf, const void *buf, size_t size)
 /*
  * ファイル読み込みストリームを閉じる
  */
-void close_wfile(struct wfile *wf)
+bool close_wfile(struct wfile *wf)
 {
+	bool success;
+
 	assert(wf != NULL);
 	assert(wf->fp != NULL);
 
-	fflush(wf->fp);
-	fclose(wf->fp);
+	success = true;
+	if (fflush(wf->fp) != 0 || ferror(wf->fp))
+		success = false;
+	if (fclose(wf->fp) != 0)
+		success = false;
 	free(wf);
+
+	return success;
+}
+
+/*
+ * 書き込みを終えたファイルの名前を変えて、既存のファイルを置き換える
+ *  - 書き込み中に異常終了しても、既存のファイルは壊れない
+ */
+bool replace_file(const char *dir, const char *src, const char *dst)
+{
+	char *src_path, *dst_path;
+	bool success;
+
+	/* パスを生成する */
+	src_path = make_valid_path(dir, src);
+	if (src_path == NULL) {
+		log_memory();
+		return false;
+	}
+	dst_path = make_valid_path(dir, dst);
+	if (dst_path == NULL) {
+		log_memory();
+		free(src_path);
+		return false;
+	}
+
+#ifdef WIN
+	/* Windowsのrename()は既存のファイルを置き換えない */
+	remove(dst_path);
+#endif
+
+	/* 名前を変える */
+	success = rename(src_path, dst_path) == 0;
+	if (!success)
+		log_file_open(dst_path);
+
+	free(src_path);
+	free(dst_path);
+
+	return success;
 }
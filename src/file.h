@@ -40,11 +40,26 @@ void cleanup_file(void);
  */
 struct rfile *open_rfile(const char *dir, const char *file, bool save_data);
 
+/*
+ * ファイルが存在するかを調べる(エラーログを出力しない)
+ */
+bool check_file_exist(const char *dir, const char *file);
+
+/*
+ * ファイルがパッケージから読み込まれるかを調べる
+ */
+bool is_packaged_file(const char *dir, const char *file);
+
 /*
  * ファイルのサイズを取得する
  */
 size_t get_rfile_size(struct rfile *rf);
 
+/*
+ * ファイルの内容をコピーせずに参照する(できない場合はNULLを返す)
+ */
+const void *get_rfile_data(struct rfile *rf, size_t *size);
+
 /*
  * ファイル読み込みストリームから読み込む
  */
@@ -55,6 +70,16 @@ size_t read_rfile(struct rfile *rf, void *buf, size_t size);
  */
 const char *gets_rfile(struct rfile *rf, char *buf, size_t size);
 
+/*
+ * ファイル読み込みストリームの読み込み位置を設定する
+ */
+bool seek_rfile(struct rfile *rf, size_t pos);
+
+/*
+ * ファイル読み込みストリームの読み込み位置を取得する
+ */
+size_t tell_rfile(struct rfile *rf);
+
 /*
  * ファイル読み込みストリームを閉じる
  */
@@ -71,8 +96,13 @@ struct wfile *open_wfile(const char *dir, const char *file);
 size_t write_wfile(struct wfile *wf, const void *buf, size_t size);
 
 /*
- * ファイル読み込みストリームを閉じる
+ * ファイル読み込みストリームを閉じる(書き込みに失敗していれば偽を返す)
+ */
+bool close_wfile(struct wfile *wf);
+
+/*
+ * 書き込みを終えたファイルの名前を変えて、既存のファイルを置き換える
  */
-void close_wfile(struct wfile *wf);
+bool replace_file(const char *dir, const char *src, const char *dst);
 
 #endif
@@ -34,6 +34,12 @@ static FT_Face face;
 static FT_Byte *font_file_content;
 static FT_Long font_file_size;
 
+/*
+ * フォントファイルの内容をコピーせずに参照している場合のストリーム
+ *  - font_file_contentはこのストリームのマップ内を指す
+ */
+static struct rfile *font_rfile;
+
 /*
  * 前方参照
  */
@@ -85,6 +91,8 @@ bool init_glyph(void)
 static bool read_font_file_content(void)
 {
 	struct rfile *rf;
+	const void *data;
+	size_t size;
 	FT_Long remain, block;
 
 	/* フォントファイルを開く */
@@ -100,6 +108,14 @@ static bool read_font_file_content(void)
 		return false;
 	}
 
+	/* メモリマップされている場合は、ストリームを開いたまま直接参照する */
+	data = get_rfile_data(rf, &size);
+	if (data != NULL && size == (size_t)font_file_size) {
+		font_rfile = rf;
+		font_file_content = (FT_Byte *)data;
+		return true;
+	}
+
 	/* メモリを確保する */
 	font_file_content = malloc((size_t)font_file_size);
 	if (font_file_content == NULL) {
@@ -111,7 +127,8 @@ static bool read_font_file_content(void)
 	/* ファイルの内容を読み込む */
 	remain = font_file_size;
 	while (remain > 0) {
-		block = (FT_Long)read_rfile(rf, font_file_content,
+		block = (FT_Long)read_rfile(rf, font_file_content +
+					    (font_file_size - remain),
 					    (size_t)remain);
 		if (block == 0)
 			break;
@@ -139,7 +156,12 @@ void cleanup_glyph(void)
 	FT_Done_FreeType(library);
 	library = NULL;
 
-	if (font_file_content != NULL) {
+	if (font_rfile != NULL) {
+		/* マップを参照していた場合はストリームを閉じる */
+		close_rfile(font_rfile);
+		font_rfile = NULL;
+		font_file_content = NULL;
+	} else if (font_file_content != NULL) {
 		free(font_file_content);
 		font_file_content = NULL;
 	}
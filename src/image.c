@@ -34,6 +34,10 @@
 #include <malloc.h>
 #endif
 
+#ifdef USE_DRAW_THREAD
+#include "drawthread.h"
+#endif
+
 /*
  * image構造体
  */
@@ -48,13 +52,67 @@ struct image {
 	bool need_free;			/* pixelsを解放する必要があるか */
 	pixel_t *locked_pixels;		/* ロック済みのピクセル列 */
 	void *texture;			/* テクスチャへのポインタ */
+	bool premultiplied;		/* 乗算済みアルファであるか */
+	uint32_t *spans;		/* 行ごとのスパン列(ない場合はNULL) */
+	int *span_index;		/* 各行のスパン列の開始位置(height+1個) */
+	int ref_count;			/* 参照カウント(キャッシュの参照を含む) */
+};
+
+#ifdef USE_DRAW_THREAD
+/*
+ * 並列描画の引数
+ */
+struct draw_band_args {
+	struct image *dst_image;
+	int dst_left;
+	int dst_top;
+	struct image *src_image;
+	int width;
+	int src_left;
+	int src_top;
+	int alpha;
+	int bt;
 };
+#endif
+
+/*
+ * スパン
+ *  - ファイルから読み込んだイメージについて、各行を完全に透明な区間、
+ *    完全に不透明な区間、合成が必要な区間に分けたもの
+ *  - 1つのスパンは(終端X座標 << 2) | 種類で表す(終端は含まない)
+ *  - 透明な区間は合成を省略し、不透明な区間はコピーで済ませる
+ */
+#define SPAN_TRANSPARENT	(0)
+#define SPAN_OPAQUE		(1)
+#define SPAN_BLEND		(2)
+#define SPAN_TYPE(s)		((int)((s) & 3))
+#define SPAN_END(s)		((int)((s) >> 2))
+#define MAKE_SPAN(end, type)	((((uint32_t)(end)) << 2) | (uint32_t)(type))
+
+/* これより短い透明/不透明の区間は合成の区間に含める */
+#define SPAN_MIN_RUN		(16)
+
+/* 1行あたりのスパン数の平均がこれを超える場合はスパンを使わない */
+#define SPAN_MAX_AVERAGE	(8)
 
 /*
  * 前方参照
  */
 
 static struct image *create_image_helper(int w, int h);
+static int get_span_type(pixel_t p);
+static void destroy_image_spans(struct image *img);
+static void draw_clipped(struct image * RESTRICT dst_image, int dst_left,
+			 int dst_top, struct image * RESTRICT src_image,
+			 int width, int height, int src_left, int src_top,
+			 int alpha, int bt);
+#ifdef USE_DRAW_THREAD
+static void draw_band(void *p, int top, int height);
+#endif
+static void draw_spans(struct image * RESTRICT dst_image, int dst_left,
+		       int dst_top, struct image * RESTRICT src_image,
+		       int width, int height, int src_left, int src_top,
+		       int alpha, int bt);
 static void draw_blend_none(struct image * RESTRICT dst_image, int dst_left,
 			    int dst_top, struct image * RESTRICT src_image,
 			    int width, int height, int src_left, int src_top);
@@ -74,6 +132,12 @@ static void draw_blend_sub(struct image * RESTRICT dst_image, int dst_left,
 			   int dst_top, struct image * RESTRICT src_image,
 			   int width, int height, int src_left, int src_top,
 			   int alpha);
+#ifndef USE_FLOAT_BLEND
+static void draw_blend_fast_pm(struct image * RESTRICT dst_image, int dst_left,
+			       int dst_top, struct image * RESTRICT src_image,
+			       int width, int height, int src_left,
+			       int src_top, int alpha);
+#endif
 
 /*
  * 初期化
@@ -142,6 +206,10 @@ static struct image *create_image_helper(int w, int h)
 	img->need_free = true;
 	img->locked_pixels = NULL;
 	img->texture = NULL;
+	img->premultiplied = false;
+	img->spans = NULL;
+	img->span_index = NULL;
+	img->ref_count = 1;
 
 	return img;
 }
@@ -169,6 +237,10 @@ struct image *create_image_with_pixels(int w, int h, pixel_t *buf)
 	img->pixels = buf;
 	img->need_free = false;
 	img->locked_pixels = NULL;
+	img->premultiplied = false;
+	img->spans = NULL;
+	img->span_index = NULL;
+	img->ref_count = 1;
 
 	/* 成功 */
 	return img;
@@ -206,10 +278,17 @@ struct image *create_image_from_color_string(int w, int h, const char *color)
 
 /*
  * イメージを削除する
+ *  - 参照カウントを減らし、0になった場合に解放する
  */
 void destroy_image(struct image *img)
 {
 	assert(img != NULL);
+	assert(img->ref_count > 0);
+
+	/* 他に参照があれば解放しない */
+	if (--img->ref_count > 0)
+		return;
+
 	assert(img->width > 0 && img->height > 0);
 	assert(img->pixels != NULL);
 	assert(img->locked_pixels == NULL);
@@ -227,10 +306,36 @@ void destroy_image(struct image *img)
 	}
 	img->pixels = NULL;
 
+	/* スパンのメモリを解放する */
+	destroy_image_spans(img);
+
 	/* イメージ構造体のメモリを解放する */
 	free(img);
 }
 
+/*
+ * イメージの参照カウントを増やす
+ *  - 参照をやめるときはdestroy_image()を呼び出す
+ */
+struct image *ref_image(struct image *img)
+{
+	assert(img != NULL);
+	assert(img->ref_count > 0);
+
+	img->ref_count++;
+	return img;
+}
+
+/*
+ * イメージの参照カウントを取得する
+ */
+int get_image_ref_count(struct image *img)
+{
+	assert(img != NULL);
+
+	return img->ref_count;
+}
+
 /*
  * ロック操作
  */
@@ -240,6 +345,9 @@ void destroy_image(struct image *img)
  */
 bool lock_image(struct image *img)
 {
+	/* ピクセルが書き換えられるのでスパンを無効にする */
+	destroy_image_spans(img);
+
 	if (!lock_texture(img->width, img->height, img->pixels,
 			  &img->locked_pixels, &img->texture))
 		return false;
@@ -256,6 +364,180 @@ void unlock_image(struct image *img)
 		       &img->locked_pixels, &img->texture);
 }
 
+/*
+ * スパン
+ */
+
+/*
+ * イメージの行ごとのスパンを作成する
+ *  - ロックされていない状態で呼び出す(ロックするとスパンは破棄される)
+ *  - 合成の区間しかない場合と細切れすぎる場合はスパンを作成しない
+ */
+bool build_image_spans(struct image *img)
+{
+	uint32_t *spans, *tmp;
+	pixel_t *row;
+	int *index;
+	int x, y, start, type, cur, n, cap, last;
+	bool useful;
+
+	assert(img != NULL);
+	assert(img->locked_pixels == NULL);
+
+	destroy_image_spans(img);
+
+	index = malloc(sizeof(int) * (size_t)(img->height + 1));
+	if (index == NULL) {
+		log_memory();
+		return false;
+	}
+
+	cap = img->height * 4;
+	spans = malloc(sizeof(uint32_t) * (size_t)cap);
+	if (spans == NULL) {
+		log_memory();
+		free(index);
+		return false;
+	}
+
+	n = 0;
+	useful = false;
+	for (y = 0; y < img->height; y++) {
+		index[y] = n;
+		row = img->pixels + img->width * y;
+		start = 0;
+		type = get_span_type(row[0]);
+		cur = type;
+		for (x = 1; x <= img->width; x++) {
+			/* 同じ種類のピクセルが続く間は区間を伸ばす */
+			if (x < img->width) {
+				cur = get_span_type(row[x]);
+				if (cur == type)
+					continue;
+			}
+
+			/* 区間が短すぎる場合は合成の区間にする */
+			if (type != SPAN_BLEND && x - start < SPAN_MIN_RUN)
+				type = SPAN_BLEND;
+			if (type != SPAN_BLEND)
+				useful = true;
+
+			/* 直前のスパンと同じ種類なら連結する */
+			last = n > index[y] ? SPAN_TYPE(spans[n - 1]) : -1;
+			if (last == type) {
+				spans[n - 1] = MAKE_SPAN(x, type);
+			} else {
+				if (n == cap) {
+					cap *= 2;
+					tmp = realloc(spans, sizeof(uint32_t) *
+						      (size_t)cap);
+					if (tmp == NULL) {
+						log_memory();
+						free(spans);
+						free(index);
+						return false;
+					}
+					spans = tmp;
+				}
+				spans[n++] = MAKE_SPAN(x, type);
+			}
+
+			/* 次の区間を開始する */
+			start = x;
+			type = cur;
+		}
+	}
+	index[img->height] = n;
+
+	/* 合成の区間しかない場合と、細切れすぎる場合は使わない */
+	if (!useful || n > img->height * SPAN_MAX_AVERAGE) {
+		free(spans);
+		free(index);
+		return true;
+	}
+
+	img->spans = spans;
+	img->span_index = index;
+	return true;
+}
+
+/* ピクセルのスパンの種類を求める */
+static int get_span_type(pixel_t p)
+{
+	uint32_t a;
+
+	a = get_pixel_a(p);
+	if (a == 0)
+		return SPAN_TRANSPARENT;
+	if (a == 255)
+		return SPAN_OPAQUE;
+	return SPAN_BLEND;
+}
+
+/* スパンを破棄する */
+static void destroy_image_spans(struct image *img)
+{
+	if (img->spans != NULL) {
+		free(img->spans);
+		img->spans = NULL;
+	}
+	if (img->span_index != NULL) {
+		free(img->span_index);
+		img->span_index = NULL;
+	}
+}
+
+/*
+ * 乗算済みアルファ
+ */
+
+/*
+ * イメージを乗算済みアルファに変換する
+ *  - RGBの各値をA値で乗算して255で割る(四捨五入)
+ *  - 変換後はBLEND_FASTでのみ描画できる
+ */
+void premultiply_image(struct image *img)
+{
+#ifdef USE_PREMULTIPLIED_ALPHA
+	pixel_t *p;
+	uint32_t a, rb, g;
+	int i, n;
+
+	assert(img != NULL);
+	assert(img->locked_pixels != NULL);
+
+	if (img->premultiplied)
+		return;
+
+	p = img->locked_pixels;
+	n = img->width * img->height;
+	for (i = 0; i < n; i++) {
+		a = get_pixel_a(p[i]);
+		if (a == 255)
+			continue;
+
+		/* R/Bを同時に処理する(チャンネル間で桁上りしない) */
+		rb = (p[i] & 0xff00ff) * a + 0x800080;
+		rb = ((rb + ((rb >> 8) & 0xff00ff)) >> 8) & 0xff00ff;
+		g = div_255_round(get_pixel_g(p[i]) * a);
+		p[i] = (a << 24) | rb | (g << 8);
+	}
+
+	img->premultiplied = true;
+#else
+	/* GPUで描画する場合とUSE_FLOAT_BLENDの場合は何もしない */
+	UNUSED_PARAMETER(img);
+#endif
+}
+
+/*
+ * イメージが乗算済みアルファであるか
+ */
+bool is_image_premultiplied(struct image *img)
+{
+	return img->premultiplied;
+}
+
 /*
  * 情報の取得
  */
@@ -399,6 +681,10 @@ void draw_image(struct image * RESTRICT dst_image, int dst_left, int dst_top,
 		struct image * RESTRICT src_image, int width, int height,
 		int src_left, int src_top, int alpha, int bt)
 {
+#ifdef USE_DRAW_THREAD
+	struct draw_band_args args;
+#endif
+
 	/* 引数をチェックする */
 	assert(dst_image != NULL);
 	assert(dst_image != src_image);
@@ -410,6 +696,7 @@ void draw_image(struct image * RESTRICT dst_image, int dst_left, int dst_top,
 	assert(width >= 0 && height >= 0);
 	assert(bt == BLEND_NONE || bt == BLEND_FAST || bt == BLEND_NORMAL ||
 	       bt == BLEND_ADD || bt == BLEND_SUB);
+	assert(!src_image->premultiplied || bt == BLEND_FAST);
 	assert(dst_image->locked_pixels != NULL);
 
 	/* 描画の必要があるか判定する */
@@ -422,6 +709,53 @@ void draw_image(struct image * RESTRICT dst_image, int dst_left, int dst_top,
 			 &dst_left, &dst_top, &src_left, &src_top))
 		return;	/* 描画範囲外 */
 
+#ifdef USE_DRAW_THREAD
+	/* 大きな描画は行の帯に分けて並列に行う */
+	args.dst_image = dst_image;
+	args.dst_left = dst_left;
+	args.dst_top = dst_top;
+	args.src_image = src_image;
+	args.width = width;
+	args.src_left = src_left;
+	args.src_top = src_top;
+	args.alpha = alpha;
+	args.bt = bt;
+	if (run_draw_thread(draw_band, &args, width, height))
+		return;
+#endif
+
+	/* 描画を行う */
+	draw_clipped(dst_image, dst_left, dst_top, src_image, width, height,
+		     src_left, src_top, alpha, bt);
+}
+
+#ifdef USE_DRAW_THREAD
+/* 帯(行の範囲)を描画する(描画スレッドから呼ばれる) */
+static void draw_band(void *p, int top, int height)
+{
+	struct draw_band_args *args;
+
+	args = p;
+	draw_clipped(args->dst_image, args->dst_left, args->dst_top + top,
+		     args->src_image, args->width, height, args->src_left,
+		     args->src_top + top, args->alpha, args->bt);
+}
+#endif
+
+/* クリッピング済みの矩形を描画する */
+static void draw_clipped(struct image * RESTRICT dst_image, int dst_left,
+			 int dst_top, struct image * RESTRICT src_image,
+			 int width, int height, int src_left, int src_top,
+			 int alpha, int bt)
+{
+	/* スパンがあればスパンごとに描画する */
+	if (src_image->spans != NULL &&
+	    (bt == BLEND_FAST || bt == BLEND_NORMAL)) {
+		draw_spans(dst_image, dst_left, dst_top, src_image, width,
+			   height, src_left, src_top, alpha, bt);
+		return;
+	}
+
 	/* 描画を行う */
 	switch(bt) {
 	case BLEND_NONE:
@@ -429,6 +763,14 @@ void draw_image(struct image * RESTRICT dst_image, int dst_left, int dst_top,
 				height, src_left, src_top);
 		break;
 	case BLEND_FAST:
+#ifndef USE_FLOAT_BLEND
+		if (src_image->premultiplied) {
+			draw_blend_fast_pm(dst_image, dst_left, dst_top,
+					   src_image, width, height, src_left,
+					   src_top, alpha);
+			break;
+		}
+#endif
 		draw_blend_fast(dst_image, dst_left, dst_top, src_image, width,
 				height, src_left, src_top, alpha);
 		break;
@@ -450,6 +792,76 @@ void draw_image(struct image * RESTRICT dst_image, int dst_left, int dst_top,
 	}
 }
 
+/*
+ * スパンごとに描画する
+ *  - 透明な区間は転送先を変更しない
+ *  - 描画のアルファ値が255なら、不透明な区間は転送元をコピーする
+ *  - その他の区間は通常の描画関数で1行ずつ合成する
+ *  - 結果はスパンを使わない場合と完全に一致する
+ *    (ただしBLEND_FASTで転送先のA値が255でない場合、透明な区間のA値は
+ *     255にならずに元のままとなる。スプライトの外側と同じ扱いである)
+ */
+static void draw_spans(struct image * RESTRICT dst_image, int dst_left,
+		       int dst_top, struct image * RESTRICT src_image,
+		       int width, int height, int src_left, int src_top,
+		       int alpha, int bt)
+{
+	pixel_t * RESTRICT src_ptr, * RESTRICT dst_ptr;
+	uint32_t span;
+	int y, i, sx, sy, dx, dy, end, len;
+
+	for (y = 0; y < height; y++) {
+		sy = src_top + y;
+		dy = dst_top + y;
+		src_ptr = get_image_pixels(src_image) + src_image->width * sy;
+		dst_ptr = get_image_pixels(dst_image) + dst_image->width * dy;
+
+		/* 描画範囲の左端を含むスパンを探す */
+		i = src_image->span_index[sy];
+		while (SPAN_END(src_image->spans[i]) <= src_left)
+			i++;
+
+		/* 描画範囲の右端までスパンを処理する */
+		for (sx = src_left; sx < src_left + width; sx = end, i++) {
+			span = src_image->spans[i];
+			end = SPAN_END(span);
+			if (end > src_left + width)
+				end = src_left + width;
+			len = end - sx;
+			dx = dst_left + (sx - src_left);
+
+			switch (SPAN_TYPE(span)) {
+			case SPAN_TRANSPARENT:
+				continue;
+			case SPAN_OPAQUE:
+				if (alpha == 255) {
+					memcpy(dst_ptr + dx, src_ptr + sx,
+					       sizeof(pixel_t) * (size_t)len);
+					continue;
+				}
+				break;
+			default:
+				break;
+			}
+
+			/* 合成する */
+			if (bt == BLEND_NORMAL) {
+				draw_blend_normal(dst_image, dx, dy, src_image,
+						  len, 1, sx, sy, alpha);
+#ifndef USE_FLOAT_BLEND
+			} else if (src_image->premultiplied) {
+				draw_blend_fast_pm(dst_image, dx, dy,
+						   src_image, len, 1, sx, sy,
+						   alpha);
+#endif
+			} else {
+				draw_blend_fast(dst_image, dx, dy, src_image,
+						len, 1, sx, sy, alpha);
+			}
+		}
+	}
+}
+
 /*
  * クリッピング
  */
@@ -600,8 +1012,12 @@ bool clip_by_dest(
 
 /*
  * アルファブレンドの描画
- *  - ベクトル化が見込めるため、同一のソース(drawimage.h)をインクルードして
- *    異なるコンパイルオプションでコンパイルするために次のファイルがある
+ *  - 同一のソースをインクルードして異なるコンパイルオプションでコンパイル
+ *    するために次のファイルがある
+ *  - novec.cとsse.cはdrawimage.hを使い、コンパイラのベクトル化に任せる
+ *  - sse2.cからavx.cまではdrawimagesse2.h(SSE2の組み込み関数)を使う
+ *  - avx2.cとavx512.cはdrawimageavx2.h(AVX2の組み込み関数)を使う
+ *  - USE_FLOAT_BLENDを定義した場合は、すべてdrawimage.hを使う
  *  -- novec.c ... 最悪のケースでSSEが使えなかった場合(MMX Pentiumまで)
  *  -- sse.c ... Pentium III
  *  -- sse2.c ... Pentium 4
@@ -610,6 +1026,7 @@ bool clip_by_dest(
  *  -- sse42.c ... Core i (Nehalem)
  *  -- avx.c ... Core i (Sandy Bridge)
  *  -- avx2.c ... Core i (Haswell)
+ *  -- avx512.c ... Xeon (Skylake-SP)
  *  - MMXの最適化はgcc/clangにないし、需要もないので、ベクトル化なしとした
  *  - Mac向けではIntelでSSE3, Apple SiliconでNEONが固定で使われる
  */
@@ -625,6 +1042,7 @@ bool clip_by_dest(
 #define DRAW_BLEND_NORMAL		draw_blend_normal
 #define DRAW_BLEND_ADD			draw_blend_add
 #define DRAW_BLEND_SUB			draw_blend_sub
+#define DRAW_BLEND_FAST_PM		draw_blend_fast_pm
 #include "drawimage.h"
 
 /*
@@ -639,6 +1057,7 @@ bool clip_by_dest(
 #define DRAW_BLEND_NORMAL		draw_blend_normal_avx512
 #define DRAW_BLEND_ADD			draw_blend_add_avx512
 #define DRAW_BLEND_SUB			draw_blend_sub_avx512
+#define DRAW_BLEND_FAST_PM		draw_blend_fast_pm_avx512
 #include "drawimage.h"
 
 /* AVX2版の描画関数を宣言する */
@@ -648,6 +1067,7 @@ bool clip_by_dest(
 #define DRAW_BLEND_NORMAL		draw_blend_normal_avx2
 #define DRAW_BLEND_ADD			draw_blend_add_avx2
 #define DRAW_BLEND_SUB			draw_blend_sub_avx2
+#define DRAW_BLEND_FAST_PM		draw_blend_fast_pm_avx2
 #include "drawimage.h"
 
 /* AVX版の描画関数を宣言する */
@@ -657,6 +1077,7 @@ bool clip_by_dest(
 #define DRAW_BLEND_NORMAL		draw_blend_normal_avx
 #define DRAW_BLEND_ADD			draw_blend_add_avx
 #define DRAW_BLEND_SUB			draw_blend_sub_avx
+#define DRAW_BLEND_FAST_PM		draw_blend_fast_pm_avx
 #include "drawimage.h"
 
 #if !defined(_MSC_VER)
@@ -668,6 +1089,7 @@ bool clip_by_dest(
 #define DRAW_BLEND_NORMAL		draw_blend_normal_sse42
 #define DRAW_BLEND_ADD			draw_blend_add_sse42
 #define DRAW_BLEND_SUB			draw_blend_sub_sse42
+#define DRAW_BLEND_FAST_PM		draw_blend_fast_pm_sse42
 #include "drawimage.h"
 
 /* SSE4.1版の描画関数を宣言する */
@@ -677,6 +1099,7 @@ bool clip_by_dest(
 #define DRAW_BLEND_NORMAL		draw_blend_normal_sse41
 #define DRAW_BLEND_ADD			draw_blend_add_sse41
 #define DRAW_BLEND_SUB			draw_blend_sub_sse41
+#define DRAW_BLEND_FAST_PM		draw_blend_fast_pm_sse41
 #include "drawimage.h"
 
 /* SSE3版の描画関数を宣言する */
@@ -686,6 +1109,7 @@ bool clip_by_dest(
 #define DRAW_BLEND_NORMAL		draw_blend_normal_sse3
 #define DRAW_BLEND_ADD			draw_blend_add_sse3
 #define DRAW_BLEND_SUB			draw_blend_sub_sse3
+#define DRAW_BLEND_FAST_PM		draw_blend_fast_pm_sse3
 #include "drawimage.h"
 
 #endif /* !defined(_MSC_VER) */
@@ -697,6 +1121,7 @@ bool clip_by_dest(
 #define DRAW_BLEND_NORMAL		draw_blend_normal_sse2
 #define DRAW_BLEND_ADD			draw_blend_add_sse2
 #define DRAW_BLEND_SUB			draw_blend_sub_sse2
+#define DRAW_BLEND_FAST_PM		draw_blend_fast_pm_sse2
 #include "drawimage.h"
 
 /* SSE版の描画関数を宣言する */
@@ -706,6 +1131,7 @@ bool clip_by_dest(
 #define DRAW_BLEND_NORMAL		draw_blend_normal_sse
 #define DRAW_BLEND_ADD			draw_blend_add_sse
 #define DRAW_BLEND_SUB			draw_blend_sub_sse
+#define DRAW_BLEND_FAST_PM		draw_blend_fast_pm_sse
 #include "drawimage.h"
 
 /* 非ベクトル版の描画関数を宣言する */
@@ -715,6 +1141,7 @@ bool clip_by_dest(
 #define DRAW_BLEND_NORMAL		draw_blend_normal_novec
 #define DRAW_BLEND_ADD			draw_blend_add_novec
 #define DRAW_BLEND_SUB			draw_blend_sub_novec
+#define DRAW_BLEND_FAST_PM		draw_blend_fast_pm_novec
 #include "drawimage.h"
 
 /*
@@ -795,6 +1222,53 @@ static void draw_blend_fast(struct image *dst_image, int dst_left, int dst_top,
 	}
 }
 
+#ifndef USE_FLOAT_BLEND
+static void draw_blend_fast_pm(struct image *dst_image, int dst_left,
+			       int dst_top, struct image *src_image, int width,
+			       int height, int src_left, int src_top, int alpha)
+{
+	if (has_avx512) {
+		draw_blend_fast_pm_avx512(dst_image, dst_left, dst_top,
+					  src_image, width, height, src_left,
+					  src_top, alpha);
+	} else if (has_avx2) {
+		draw_blend_fast_pm_avx2(dst_image, dst_left, dst_top,
+					src_image, width, height, src_left,
+					src_top, alpha);
+	} else if (has_avx) {
+		draw_blend_fast_pm_avx(dst_image, dst_left, dst_top,
+				       src_image, width, height, src_left,
+				       src_top, alpha);
+#if !defined(_MSC_VER)
+	} else if (has_sse42) {
+		draw_blend_fast_pm_sse42(dst_image, dst_left, dst_top,
+					 src_image, width, height, src_left,
+					 src_top, alpha);
+	} else if (has_sse41) {
+		draw_blend_fast_pm_sse41(dst_image, dst_left, dst_top,
+					 src_image, width, height, src_left,
+					 src_top, alpha);
+	} else if (has_sse3) {
+		draw_blend_fast_pm_sse3(dst_image, dst_left, dst_top,
+					src_image, width, height, src_left,
+					src_top, alpha);
+#endif
+	} else if (has_sse2) {
+		draw_blend_fast_pm_sse2(dst_image, dst_left, dst_top,
+					src_image, width, height, src_left,
+					src_top, alpha);
+	} else if (has_sse) {
+		draw_blend_fast_pm_sse(dst_image, dst_left, dst_top,
+				       src_image, width, height, src_left,
+				       src_top, alpha);
+	} else {
+		draw_blend_fast_pm_novec(dst_image, dst_left, dst_top,
+					 src_image, width, height, src_left,
+					 src_top, alpha);
+	}
+}
+#endif
+
 static void draw_blend_normal(struct image *dst_image, int dst_left,
 			      int dst_top, struct image *src_image, int width,
 			      int height, int src_left, int src_top, int alpha)
@@ -917,8 +1391,23 @@ static void draw_blend_sub(struct image *dst_image, int dst_left, int dst_top,
 /*
  * マスクつき描画
  *  - ベクトル化を見込めないためimage.cで直接実装する
+ *  - ただし、SSE2とAVX2の組み込み関数版がある場合はそちらを使う
  */
 
+#if defined(SSE_VERSIONING) && !defined(USE_FLOAT_BLEND)
+/* AVX2版のマスクつき描画関数を宣言する */
+void draw_image_mask_avx2(struct image * RESTRICT dst_image, int dst_left,
+			  int dst_top, struct image * RESTRICT src_image,
+			  int width, int height, int src_left, int src_top,
+			  const unsigned char *mask_rows);
+
+/* SSE2版のマスクつき描画関数を宣言する */
+void draw_image_mask_sse2(struct image * RESTRICT dst_image, int dst_left,
+			  int dst_top, struct image * RESTRICT src_image,
+			  int width, int height, int src_left, int src_top,
+			  const unsigned char *mask_rows);
+#endif
+
 /* マスクの幅 */
 #define MASK_WIDTH	(8)
 
@@ -978,6 +1467,22 @@ void draw_image_mask(
 	assert(src_image->width == width && src_image->height == height);
 	assert(dst_image->locked_pixels != NULL);
 
+#if defined(SSE_VERSIONING) && !defined(USE_FLOAT_BLEND)
+	/* 組み込み関数版があれば使う */
+	if (has_avx2) {
+		draw_image_mask_avx2(dst_image, dst_left, dst_top, src_image,
+				     width, height, src_left, src_top,
+				     mask_bitmap[mask_level]);
+		return;
+	}
+	if (has_sse2) {
+		draw_image_mask_sse2(dst_image, dst_left, dst_top, src_image,
+				     width, height, src_left, src_top,
+				     mask_bitmap[mask_level]);
+		return;
+	}
+#endif
+
 	sw = get_image_width(src_image);
 	dw = get_image_width(dst_image);
 	src_ptr = get_image_pixels(src_image) + sw * src_top + src_left;
@@ -118,6 +118,162 @@ static INLINE uint32_t get_pixel_a(pixel_t p)
 
 #endif
 
+/*
+ * ブレンドの演算方式
+ *  - コンパイル時にUSE_FLOAT_BLENDを定義すると、浮動小数点で合成する
+ *  - 定義しない場合、8.8固定小数点の整数演算で合成する
+ *  - 整数版の結果は浮動小数点版の結果と±1の範囲で一致する
+ *  - 整数版ではSIMD版の描画関数とスカラ版の描画関数の結果が完全に一致する
+ */
+#ifndef USE_FLOAT_BLEND
+
+/*
+ * 以下は整数版の1ピクセル分の合成
+ *  - ARGB/ABGRのどちらでもR/Bはビット0と16に、Gはビット8にある
+ *  - そのため、R/Bを1回の乗算で同時に処理できる(チャンネル間で桁上りしない)
+ */
+
+/* 0から255*255までの値を255で割る(四捨五入) */
+static INLINE uint32_t div_255_round(uint32_t x)
+{
+	x += 128;
+	return (x + (x >> 8)) >> 8;
+}
+
+/* 0から255のアルファ値を0から256の固定小数点の係数に変換する */
+static INLINE uint32_t alpha_to_fixed(uint32_t a)
+{
+	return a + (a >> 7);
+}
+
+/* 転送元ピクセルのアルファ値と描画のアルファ値から係数を求める */
+static INLINE uint32_t get_blend_factor(pixel_t src, uint32_t alpha)
+{
+	return alpha_to_fixed(div_255_round(alpha * get_pixel_a(src)));
+}
+
+/* 通常のブレンドでR/BとGを合成する */
+static INLINE pixel_t blend_pixel_rgb(pixel_t src, pixel_t dst, uint32_t fa)
+{
+	uint32_t rb, g;
+
+	rb = (((src & 0xff00ff) * fa + (dst & 0xff00ff) * (256 - fa)) >> 8) &
+		0xff00ff;
+	g = (((src & 0xff00) * fa + (dst & 0xff00) * (256 - fa)) >> 8) &
+		0xff00;
+	return rb | g;
+}
+
+/* BLEND_FASTの合成を行う(A値は255になる) */
+static INLINE pixel_t blend_pixel_fast(pixel_t src, pixel_t dst,
+				       uint32_t alpha)
+{
+	return 0xff000000 |
+		blend_pixel_rgb(src, dst, get_blend_factor(src, alpha));
+}
+
+/* BLEND_NORMALの合成を行う(A値は飽和加算する) */
+static INLINE pixel_t blend_pixel_normal(pixel_t src, pixel_t dst,
+					 uint32_t alpha)
+{
+	uint32_t add_a;
+
+	add_a = get_pixel_a(src) + get_pixel_a(dst);
+	add_a = add_a > 255 ? 255 : add_a;
+
+	return (add_a << 24) |
+		blend_pixel_rgb(src, dst, get_blend_factor(src, alpha));
+}
+
+/* BLEND_ADDの合成を行う(RGBAの各値を飽和加算する) */
+static INLINE pixel_t blend_pixel_add(pixel_t src, pixel_t dst,
+				      uint32_t alpha)
+{
+	uint32_t fa, rb, g, add_a, c;
+
+	fa = get_blend_factor(src, alpha);
+
+	/* R/Bの飽和加算を行う(桁上りを255に丸める) */
+	rb = (dst & 0xff00ff) + (((src & 0xff00ff) * fa >> 8) & 0xff00ff);
+	c = rb & 0x1000100;
+	rb = (rb | (c - (c >> 8))) & 0xff00ff;
+
+	/* Gの飽和加算を行う */
+	g = (dst & 0xff00) + (((src & 0xff00) * fa >> 8) & 0xff00);
+	c = g & 0x10000;
+	g = (g | (c - (c >> 8))) & 0xff00;
+
+	/* A値の飽和加算を行う */
+	add_a = get_pixel_a(src) + get_pixel_a(dst);
+	add_a = add_a > 255 ? 255 : add_a;
+
+	return (add_a << 24) | rb | g;
+}
+
+/* BLEND_SUBの合成を行う(RGB各値は飽和減算、A値は飽和加算する) */
+static INLINE pixel_t blend_pixel_sub(pixel_t src, pixel_t dst,
+				      uint32_t alpha)
+{
+	uint32_t fa, rb, g, add_a, c;
+
+	fa = get_blend_factor(src, alpha);
+
+	/* R/Bの飽和減算を行う(桁借りを0に丸める) */
+	rb = ((dst & 0xff00ff) | 0x1000100) -
+		(((src & 0xff00ff) * fa >> 8) & 0xff00ff);
+	c = rb & 0x1000100;
+	rb &= (c - (c >> 8)) & 0xff00ff;
+
+	/* Gの飽和減算を行う */
+	g = ((dst & 0xff00) | 0x10000) - (((src & 0xff00) * fa >> 8) & 0xff00);
+	c = g & 0x10000;
+	g &= (c - (c >> 8)) & 0xff00;
+
+	/* A値の飽和加算を行う */
+	add_a = get_pixel_a(src) + get_pixel_a(dst);
+	add_a = add_a > 255 ? 255 : add_a;
+
+	return (add_a << 24) | rb | g;
+}
+
+/*
+ * 以下は乗算済みアルファ(RGBにA値を乗算済み)の転送元の合成
+ *  - 転送元のRGBはA値を超えないので、合成結果は桁上りしない
+ */
+
+/* 乗算済みアルファのピクセルの全チャンネルに係数(0から256)を乗算する */
+static INLINE pixel_t scale_pixel_pm(pixel_t src, uint32_t fs)
+{
+	return (((src & 0xff00ff) * fs >> 8) & 0xff00ff) |
+		(((src >> 8) & 0xff00ff) * fs & 0xff00ff00);
+}
+
+/* 乗算済みアルファでBLEND_FASTの合成を行う(A値は255になる) */
+static INLINE pixel_t blend_pixel_fast_pm(pixel_t src, pixel_t dst)
+{
+	uint32_t ia;
+
+	/* 転送先にだけ(256 - A)を乗算して加算する */
+	ia = 256 - alpha_to_fixed(get_pixel_a(src));
+	return 0xff000000 | ((src & 0xffffff) +
+			     (((dst & 0xff00ff) * ia >> 8) & 0xff00ff) +
+			     (((dst & 0xff00) * ia >> 8) & 0xff00));
+}
+
+#endif /* USE_FLOAT_BLEND */
+
+/*
+ * 乗算済みアルファの形式を使うか
+ *  - キャラのイメージを読み込み時に乗算済みアルファに変換しておき、
+ *    合成時の乗算を減らす
+ *  - GPUで描画する場合はシェーダ/ステートが非乗算済みを前提とするので使わない
+ *  - USE_FLOAT_BLENDの場合は乗算済みの描画関数がないので使わない
+ */
+#if !defined(USE_OPENGL) && !defined(USE_DIRECT3D) && \
+    !defined(USE_FLOAT_BLEND)
+#define USE_PREMULTIPLIED_ALPHA
+#endif
+
 /* イメージを作成する */
 struct image *create_image(int w, int h);
 
@@ -127,12 +283,50 @@ struct image *create_image_with_pixels(int w, int h, pixel_t *ptr);
 /* ファイル名を指定してイメージを作成する */
 struct image *create_image_from_file(const char *dir, const char *file);
 
+/* ファイル名を指定して乗算済みアルファのイメージを作成する */
+struct image *create_premultiplied_image_from_file(const char *dir,
+						   const char *file);
+
+/* イメージ読み込みスレッドの初期化処理を行う */
+bool init_image_loader(void);
+
+/* イメージ読み込みスレッドの終了処理を行う */
+void cleanup_image_loader(void);
+
+/* イメージの読み込みを要求する */
+void request_image_load(const char *dir, const char *file, bool premultiply);
+
+/* イメージの読み込みが完了していないかを調べる(未要求なら要求する) */
+bool is_image_loading(const char *dir, const char *file, bool premultiply);
+
+/* 読み込みが完了したイメージを受け取る */
+struct image *take_loaded_image(const char *dir, const char *file,
+				bool premultiply);
+
+/* イメージの読み込みの完了を反映する */
+void process_image_loads(void);
+
+/* 受け取られずに残っている完了済みの読み込み要求を破棄する */
+void cancel_image_loads(void);
+
+/* イメージがキャッシュにあるかを調べる(あればLRUの順位を上げる) */
+bool touch_cached_image(const char *dir, const char *file, bool premultiply);
+
+/* イメージキャッシュを破棄する */
+void cleanup_image_cache(void);
+
 /* 文字列で色を指定してイメージを作成する */
 struct image *create_image_from_color_string(int w, int h, const char *color);
 
-/* イメージを削除する */
+/* イメージを削除する(参照カウントが0になったら解放する) */
 void destroy_image(struct image *img);
 
+/* イメージの参照カウントを増やす */
+struct image *ref_image(struct image *img);
+
+/* イメージの参照カウントを取得する */
+int get_image_ref_count(struct image *img);
+
 /* イメージをロックする */
 bool lock_image(struct image *img);
 
@@ -142,6 +336,15 @@ void unlock_image(struct image *img);
 /* ピクセルへのポインタを取得する(for glyph.c) */
 pixel_t *get_image_pixels(struct image *img);
 
+/* イメージの行ごとの透明/不透明のスパンを作成する */
+bool build_image_spans(struct image *img);
+
+/* イメージを乗算済みアルファに変換する */
+void premultiply_image(struct image *img);
+
+/* イメージが乗算済みアルファであるか */
+bool is_image_premultiplied(struct image *img);
+
 /* イメージの幅を取得する */
 int get_image_width(struct image *img);
 
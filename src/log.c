@@ -310,6 +310,20 @@ void log_script_label_not_found(const char *name)
 	}
 }
 
+/*
+ * ラベルが重複しているエラーを記録する
+ */
+void log_script_duplicate_label(const char *name)
+{
+	if (is_english_mode()) {
+		log_error("Label \"%s\" is defined more than once.\n",
+			  conv_utf8_to_native(name));
+	} else {
+		log_error("ラベル\"%s\"が重複しています。\n",
+			  conv_utf8_to_native(name));
+	}
+}
+
 /*
  * 左辺値が変数でないエラーを記録する
  */
@@ -445,22 +459,6 @@ void log_script_rgb_negative(int val)
 	}
 }
 
-/*
- * スクリプトが長すぎるエラーを記録する
- */
-void log_script_size(int size)
-{
-	if (is_english_mode()) {
-		log_error("Script \"%s\" exceeds the limit of lines %d. "
-			  "Please split the script.\n",
-			  get_script_file_name(), size);
-	} else {
-		log_error("スクリプト%sが最大コマンド数%dを超えています。"
-			  "分割してください。\n", get_script_file_name(),
-			  size);
-	}
-}
-
 /*
  * スイッチの選択肢にラベルがないエラーを記録する
  * Record error that switch option has no label
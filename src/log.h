@@ -43,6 +43,7 @@ void log_script_empty_serif(void);
 void log_script_ch_position(const char *pos);
 void log_script_fade_method(const char *method);
 void log_script_label_not_found(const char *name);
+void log_script_duplicate_label(const char *name);
 void log_script_lhs_not_variable(const char *lhs);
 void log_script_no_command(const char *file);
 void log_script_not_variable(const char *lhs);
@@ -53,7 +54,6 @@ void log_script_op_error(const char *op);
 void log_script_parse_footer(const char *file, int line, const char *buf);
 void log_script_return_error(void);
 void log_script_rgb_negative(int val);
-void log_script_size(int size);
 void log_script_switch_no_label(void);
 void log_script_switch_no_item(void);
 void log_script_var_index(int index);
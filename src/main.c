@@ -26,6 +26,14 @@
 /* false assertion */
 #define COMMAND_DISPATCH_NOT_IMPLEMENTED	(0)
 
+#ifdef USE_IMAGE_THREAD
+/* 先読みのために調べるコマンドの最大数 */
+#define PRELOAD_COMMAND_MAX	(64)
+
+/* 先読みするイメージのサイズ(MB)の既定値 */
+#define DEFAULT_PRELOAD_SIZE	(32)
+#endif
+
 /*
  * 入力の状態
  *  - ControlキーとSpaceキーは、フレームをまたがって押下状態になる
@@ -72,10 +80,28 @@ static bool flag_skip_mode;
  */
 static bool flag_save_load_enabled = true;
 
+#ifdef USE_IMAGE_THREAD
+/*
+ * 最後に先読みを行った実行位置
+ */
+static int preload_load_count = -1;
+static int preload_index = -1;
+
+/*
+ * 先読みで要求したイメージの見積もりサイズ(バイト)とその上限
+ */
+static size_t preload_size;
+static size_t preload_limit;
+#endif
+
 /*
  * 前方参照
  */
 static bool dispatch_command(int *x, int *y, int *w, int *h, bool *cont);
+#ifdef USE_IMAGE_THREAD
+static void preload_assets(void);
+static bool preload_asset(const char *dir, const char *file, void *arg);
+#endif
 
 /*
  * ゲームループの初期化処理を実行する
@@ -116,6 +142,9 @@ bool game_loop_iter(int *x, int *y, int *w, int *h)
 {
 	bool cont;
 
+	/* 完了したイメージの読み込みを反映する */
+	process_image_loads();
+
 	if (is_save_load_mode()) {
 		/* セーブ画面を実行する */
 		if (!run_save_load_mode(x, y, w, h))
@@ -129,6 +158,11 @@ bool game_loop_iter(int *x, int *y, int *w, int *h)
 			if (!dispatch_command(x, y, w, h, &cont))
 				return false;
 		} while (cont);
+
+#ifdef USE_IMAGE_THREAD
+		/* この先のコマンドで使うイメージを先読みする */
+		preload_assets();
+#endif
 	}
 
 	/* サウンドのフェード処理を実行する */
@@ -148,6 +182,71 @@ bool game_loop_iter(int *x, int *y, int *w, int *h)
 	return true;
 }
 
+#ifdef USE_IMAGE_THREAD
+/*
+ * この先のコマンドで使うイメージを先読みする
+ *  - 実行位置が変わったときに、スクリプトを先に向かって調べて
+ *    イメージの読み込みを要求する
+ *  - 読み込まれたイメージはキャッシュに入るので、コマンドの実行時に
+ *    デコードを待たずに済む
+ */
+static void preload_assets(void)
+{
+	/* 実行位置が変わっていなければ何もしない */
+	if (get_script_load_count() == preload_load_count &&
+	    get_command_index() == preload_index)
+		return;
+	preload_load_count = get_script_load_count();
+	preload_index = get_command_index();
+
+	/* 前回の先読みで受け取られずに残った要求を破棄する */
+	cancel_image_loads();
+
+	if (conf_preload_off)
+		return;
+
+	/*
+	 * 1回に要求するイメージのサイズの上限を求める
+	 *  - デコードするまでサイズはわからないので、画面のサイズで見積もる
+	 */
+	preload_size = 0;
+	preload_limit = (size_t)(conf_preload_max_size > 0 ?
+				 conf_preload_max_size : DEFAULT_PRELOAD_SIZE) *
+		1024 * 1024;
+
+	enum_lookahead_assets(PRELOAD_COMMAND_MAX, preload_asset, NULL);
+}
+
+/* アセットを先読みする(上限に達したら偽を返す) */
+static bool preload_asset(const char *dir, const char *file, void *arg)
+{
+	bool premultiply;
+
+	UNUSED_PARAMETER(arg);
+
+	/* イメージ以外は対象にしない */
+	if (strcmp(dir, BG_DIR) == 0)
+		premultiply = false;
+	else if (strcmp(dir, CH_DIR) == 0)
+		premultiply = true;
+	else
+		return true;
+
+	/* キャッシュにあれば、使われる前に破棄されにくくする */
+	if (touch_cached_image(dir, file, premultiply))
+		return true;
+
+	/* 上限に達したら止める */
+	preload_size += (size_t)conf_window_width *
+		(size_t)conf_window_height * sizeof(pixel_t);
+	if (preload_size > preload_limit)
+		return false;
+
+	request_image_load(dir, file, premultiply);
+	return true;
+}
+#endif
+
 /*
  * コマンドをディスパッチする
  */
@@ -16,7 +16,10 @@
  *  - PROTOTYPE_ONLY
  */
 
-#if defined(OSX) || defined(IOS)
+#if defined(OSX) || defined(IOS) || \
+    defined(LINUX) || defined(FREEBSD) || defined(NETBSD)
+
+#include <math.h>
 
 /* ミキシングを行う */
 void MUL_ADD_PCM(uint32_t *dst, uint32_t *src, float vol, int samples)
@@ -33,7 +33,7 @@ struct wfile {
 /*
  * 前方参照
  */
-static void ungetc_rfile(struct rfile *rf, char c);
+static size_t find_line_end(const char *p, size_t len);
 
 /*
  * 初期化
@@ -98,6 +98,17 @@ struct rfile *open_rfile(const char *dir, const char *file, bool save_data)
 	return rf;
 }
 
+/*
+ * ファイルがパッケージから読み込まれるかを調べる
+ *  - Android版ではパッケージを使用しない
+ */
+bool is_packaged_file(const char *dir, const char *file)
+{
+	UNUSED_PARAMETER(dir);
+	UNUSED_PARAMETER(file);
+	return false;
+}
+
 /*
  * ファイルのサイズを取得する
  */
@@ -106,6 +117,16 @@ size_t get_rfile_size(struct rfile *rf)
 	return (size_t)rf->size;
 }
 
+/*
+ * ファイルの内容をコピーせずに参照する
+ *  - ファイル全体がメモリ上にあるので、そのまま返す
+ */
+const void *get_rfile_data(struct rfile *rf, size_t *size)
+{
+	*size = (size_t)rf->size;
+	return rf->buf;
+}
+
 /*
  * ファイル読み込みストリームから読み込む
  */
@@ -120,54 +141,78 @@ size_t read_rfile(struct rfile *rf, void *buf, size_t size)
 	return size;
 }
 
-/* ファイル読み込みストリームに1文字戻す */
-static void ungetc_rfile(struct rfile *rf, char c)
-{
-	/* FIXME: cを戻していない */
-	assert(rf->pos != 0);
-	rf->pos--;
-}
-
 /*
  * ファイル読み込みストリームから1行読み込む
+ *  - ファイル全体がメモリ上にあるので、直接改行を探す
  */
 const char *gets_rfile(struct rfile *rf, char *buf, size_t size)
 {
-	char *ptr;
-	size_t len;
-	char c;
-
-	ptr = (char *)buf;
-
-	for (len = 0; len < size - 1; len++) {
-		if (read_rfile(rf, &c, 1) != 1) {
-			*ptr = '\0';
-			return len == 0 ? NULL : buf;
-		}
-		if (c == '\n' || c == '\0') {
-			*ptr = '\0';
-			return buf;
-		}
-		if (c == '\r') {
-			if (read_rfile(rf, &c, 1) != 1) {
-				ungetc_rfile(rf, c);
-				*ptr = '\0';
-				return buf;
-			}
-			if (c == '\n') {
-				*ptr = '\0';
-				return buf;
-			}
-			ungetc_rfile(rf, c);
-			*ptr = '\0';
-			return buf;
-		}
-		*ptr++ = c;
+	const char *p;
+	size_t avail, n;
+
+	assert(size > 0);
+
+	/* ファイルの終端に達している場合 */
+	if (rf->pos == rf->size) {
+		buf[0] = '\0';
+		return NULL;
 	}
-	*ptr = '\0';
+
+	/* 改行の手前までをコピーする */
+	p = rf->buf + rf->pos;
+	avail = (size_t)(rf->size - rf->pos);
+	if (avail > size - 1)
+		avail = size - 1;
+	n = find_line_end(p, avail);
+	memcpy(buf, p, n);
+	buf[n] = '\0';
+	rf->pos += n;
+	if (n == avail)
+		return buf;
+
+	/* 改行を読み飛ばす(CRLFは1つの改行とする) */
+	rf->pos++;
+	if (p[n] == '\r' && rf->pos < rf->size && p[n + 1] == '\n')
+		rf->pos++;
 	return buf;
 }
 
+/* 最初の改行(LF、CR、NUL)の位置を求める(なければlenを返す) */
+static size_t find_line_end(const char *p, size_t len)
+{
+	const char *q;
+
+	q = memchr(p, '\n', len);
+	if (q != NULL)
+		len = (size_t)(q - p);
+	q = memchr(p, '\r', len);
+	if (q != NULL)
+		len = (size_t)(q - p);
+	q = memchr(p, '\0', len);
+	if (q != NULL)
+		len = (size_t)(q - p);
+	return len;
+}
+
+/*
+ * ファイル読み込みストリームの読み込み位置を設定する
+ */
+bool seek_rfile(struct rfile *rf, size_t pos)
+{
+	if (pos > rf->size)
+		return false;
+	rf->pos = pos;
+	return true;
+}
+
+/*
+ * ファイル読み込みストリームの読み込み位置を取得する
+ */
+size_t tell_rfile(struct rfile *rf)
+{
+	return (size_t)rf->pos;
+}
+
 /*
  * ファイル読み込みストリームを閉じる
  */
@@ -247,16 +292,37 @@ size_t write_wfile(struct wfile *wf, const void *buf, size_t size)
 /*
  * ファイル読み込みストリームを閉じる
  */
-void close_wfile(struct wfile *wf)
+bool close_wfile(struct wfile *wf)
 {
 	jclass cls;
 	jmethodID mid;
+	jboolean ret;
 
 	cls = (*jni_env)->FindClass(jni_env, "jp/luxion/suika/MainActivity");
-	mid = (*jni_env)->GetMethodID(jni_env, cls, "closeSaveFile", "(Ljava/io/OutputStream;)V");
-	(*jni_env)->CallVoidMethod(jni_env, main_activity, mid, wf->os);
+	mid = (*jni_env)->GetMethodID(jni_env, cls, "closeSaveFile", "(Ljava/io/OutputStream;)Z");
+	ret = (*jni_env)->CallBooleanMethod(jni_env, main_activity, mid, wf->os);
 	
 	(*jni_env)->DeleteGlobalRef(jni_env, wf->os);
 
 	free(wf);
+
+	return ret == JNI_TRUE;
+}
+
+/*
+ * 書き込みを終えたファイルの名前を変えて、既存のファイルを置き換える
+ */
+bool replace_file(const char *dir, const char *src, const char *dst)
+{
+	jclass cls;
+	jmethodID mid;
+	jboolean ret;
+
+	assert(strcmp(dir, SAVE_DIR) == 0);
+
+	cls = (*jni_env)->FindClass(jni_env, "jp/luxion/suika/MainActivity");
+	mid = (*jni_env)->GetMethodID(jni_env, cls, "renameSaveFile", "(Ljava/lang/String;Ljava/lang/String;)Z");
+	ret = (*jni_env)->CallBooleanMethod(jni_env, main_activity, mid, (*jni_env)->NewStringUTF(jni_env, src), (*jni_env)->NewStringUTF(jni_env, dst));
+
+	return ret == JNI_TRUE;
 }
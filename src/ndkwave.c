@@ -86,3 +86,11 @@ bool is_wave_looped(struct wave *w)
 {
 	return w->loop;
 }
+
+/*
+ * PCMキャッシュを破棄する
+ *  - NDKではJava側で再生するので、キャッシュを持たない
+ */
+void cleanup_wave_cache(void)
+{
+}
@@ -20,12 +20,9 @@
 #define DRAW_BLEND_NORMAL		draw_blend_normal_novec
 #define DRAW_BLEND_ADD			draw_blend_add_novec
 #define DRAW_BLEND_SUB			draw_blend_sub_novec
+#define DRAW_BLEND_FAST_PM		draw_blend_fast_pm_novec
 #include "drawimage.h"
 
-/* 非ベクトル化版scale_samples()を宣言する */
-#define SCALE_SAMPLES scale_samples_novec
-#include "scalesamples.h"
-
 /* 非ベクトル化版draw_glyph_func()を定義する */
 #define DRAW_GLYPH_FUNC draw_glyph_func_novec
 #include "drawglyph.h"
@@ -0,0 +1,304 @@
+﻿/* -*- coding: utf-8-with-signature; tab-width: 8; indent-tabs-mode: t; -*- */
+
+/*
+ * Suika 2
+ * Copyright (C) 2001-2021, TABATA Keiichi. All rights reserved.
+ */
+
+/*
+ * 先読みスレッド
+ *  - 次に@loadされそうなスクリプトを解析し、スクリプトとそれが参照する
+ *    アセットのファイルをバックグラウンドで読んでOSのキャッシュに載せる
+ *  - 読んだ内容は保持しないので、プロセスのメモリ使用量は増えない
+ *  - 新しい要求があると処理中の要求は中止される
+ *  - conf_prefetch_onが0の場合はスレッドを作成しない
+ */
+
+#include "suika.h"
+#include "prefetch.h"
+
+#include <pthread.h>
+
+/* 1回の要求で読むサイズの上限(MB)の既定値 */
+#define DEFAULT_MAX_SIZE	(64)
+
+/* スクリプトのファイル名のサイズ */
+#define SCRIPT_NAME_SIZE	(256)
+
+/* マップされていないファイルを読む単位 */
+#define READ_BUF_SIZE		(65536)
+
+/* マップされたファイルを参照する間隔(ページサイズ) */
+#define TOUCH_STRIDE		(4096)
+
+/* 1回の要求で重複を調べるファイルの最大数 */
+#define WARMED_MAX		(1024)
+
+/* 先読みスレッド */
+static pthread_t thread;
+
+/* 先読みスレッドが動作中であるか */
+static bool is_running;
+
+/* 排他制御用ミューテックス */
+static pthread_mutex_t mutex;
+
+/* メインスレッドから先読みスレッドへの要求用条件変数 */
+static pthread_cond_t req;
+
+/* 要求されたスクリプト */
+static char req_script[SCRIPT_NAME_SIZE];
+
+/* 要求の世代(要求ごとに増やす) */
+static unsigned int req_seq;
+
+/* 使用終了の要求に使うフラグ */
+static bool quit;
+
+/* 1回の要求で読むサイズの上限(バイト) */
+static size_t max_size;
+
+/*
+ * 以下は先読みスレッドのみが使用する
+ */
+
+/* 処理中の要求の世代 */
+static unsigned int cur_seq;
+
+/* 処理中の要求で読んだサイズ */
+static size_t warmed_size;
+
+/* 処理中の要求で読んだファイル名のハッシュ値 */
+static uint32_t warmed_hash[WARMED_MAX];
+static int warmed_count;
+
+/* マップされていないファイルを読むバッファ */
+static char read_buf[READ_BUF_SIZE];
+
+/* マップされたファイルの参照が最適化で消されないようにする */
+static volatile unsigned int touch_sum;
+
+/*
+ * 前方参照
+ */
+static void *prefetch_thread(void *p);
+static void prefetch_script(const char *fname);
+static bool prefetch_asset(const char *dir, const char *file, void *arg);
+static void warm_file(const char *dir, const char *file);
+static bool is_canceled(void);
+static uint32_t hash_file_name(const char *dir, const char *file);
+
+/*
+ * 先読みスレッドの初期化処理を行う
+ */
+bool init_prefetch(void)
+{
+	is_running = false;
+	req_seq = 0;
+	quit = false;
+	max_size = (size_t)(conf_prefetch_max_size > 0 ?
+			    conf_prefetch_max_size : DEFAULT_MAX_SIZE) *
+		1024 * 1024;
+
+	if (!conf_prefetch_on)
+		return true;
+
+	pthread_mutex_init(&mutex, NULL);
+	pthread_cond_init(&req, NULL);
+
+	/* 先読みスレッドを作成する */
+	if (pthread_create(&thread, NULL, prefetch_thread, NULL) != 0) {
+		/* 作成できなかった場合は先読みしない */
+		log_api_error("pthread_create");
+		pthread_cond_destroy(&req);
+		pthread_mutex_destroy(&mutex);
+		return true;
+	}
+	is_running = true;
+
+	return true;
+}
+
+/*
+ * 先読みスレッドの終了処理を行う
+ */
+void cleanup_prefetch(void)
+{
+	void *p;
+
+	if (!is_running)
+		return;
+
+	/* 先読みスレッドに終了を要求する */
+	pthread_mutex_lock(&mutex);
+	quit = true;
+	pthread_cond_signal(&req);
+	pthread_mutex_unlock(&mutex);
+
+	/* 先読みスレッドの終了を待つ */
+	pthread_join(thread, &p);
+	is_running = false;
+
+	pthread_cond_destroy(&req);
+	pthread_mutex_destroy(&mutex);
+}
+
+/*
+ * スクリプトとそのアセットの先読みを要求する
+ *  - 処理中の要求があれば中止させる
+ */
+void request_prefetch_script(const char *fname)
+{
+	if (!is_running)
+		return;
+	if (strlen(fname) >= SCRIPT_NAME_SIZE)
+		return;
+
+	pthread_mutex_lock(&mutex);
+	strcpy(req_script, fname);
+	req_seq++;
+	pthread_cond_signal(&req);
+	pthread_mutex_unlock(&mutex);
+}
+
+/* 先読みスレッド */
+static void *prefetch_thread(void *p)
+{
+	char fname[SCRIPT_NAME_SIZE];
+	unsigned int seq;
+
+	UNUSED_PARAMETER(p);
+
+	seq = 0;
+
+	pthread_mutex_lock(&mutex);
+	while (1) {
+		/* 新しい要求か終了要求を待つ */
+		while (seq == req_seq && !quit)
+			pthread_cond_wait(&req, &mutex);
+		if (quit)
+			break;
+		seq = req_seq;
+		strcpy(fname, req_script);
+		pthread_mutex_unlock(&mutex);
+
+		/* 先読みする */
+		cur_seq = seq;
+		prefetch_script(fname);
+
+		pthread_mutex_lock(&mutex);
+	}
+	pthread_mutex_unlock(&mutex);
+
+	return NULL;
+}
+
+/* スクリプトとそのアセットを先読みする */
+static void prefetch_script(const char *fname)
+{
+	char bin_name[SCRIPT_NAME_SIZE];
+
+	warmed_size = 0;
+	warmed_count = 0;
+
+	if (!check_file_exist(SCRIPT_DIR, fname))
+		return;
+
+	/* コンパイル済みスクリプトがあれば読んでおく */
+	snprintf(bin_name, sizeof(bin_name), "%s%s", fname,
+		 COMPILED_SCRIPT_EXT);
+	if (check_file_exist(SCRIPT_DIR, bin_name))
+		warm_file(SCRIPT_DIR, bin_name);
+
+	/* スクリプトを解析し、参照されるアセットを先頭から順に読む */
+	scan_script_assets(fname, prefetch_asset, NULL);
+}
+
+/* アセットを先読みする(中止する場合は偽を返す) */
+static bool prefetch_asset(const char *dir, const char *file, void *arg)
+{
+	uint32_t h;
+	int i;
+
+	UNUSED_PARAMETER(arg);
+
+	/* 新しい要求があるか、上限に達していれば中止する */
+	if (is_canceled() || warmed_size >= max_size)
+		return false;
+
+	/* 同じ要求ですでに読んだファイルは読まない */
+	h = hash_file_name(dir, file);
+	for (i = 0; i < warmed_count; i++)
+		if (warmed_hash[i] == h)
+			return true;
+	if (warmed_count < WARMED_MAX)
+		warmed_hash[warmed_count++] = h;
+
+	/* 存在しないファイルはスクリプト実行時にエラーになる */
+	if (!check_file_exist(dir, file))
+		return true;
+
+	warm_file(dir, file);
+	return true;
+}
+
+/* ファイルを読んでOSのキャッシュに載せる */
+static void warm_file(const char *dir, const char *file)
+{
+	struct rfile *rf;
+	const uint8_t *data;
+	size_t size, i, len;
+	unsigned int sum;
+
+	rf = open_rfile(dir, file, false);
+	if (rf == NULL)
+		return;
+
+	data = get_rfile_data(rf, &size);
+	if (data != NULL) {
+		/* マップされている場合は各ページを参照する */
+		sum = 0;
+		for (i = 0; i < size; i += TOUCH_STRIDE)
+			sum += data[i];
+		touch_sum += sum;
+		warmed_size += size;
+	} else {
+		/* マップされていない場合は読み捨てる */
+		while ((len = read_rfile(rf, read_buf, sizeof(read_buf))) > 0)
+			warmed_size += len;
+	}
+
+	close_rfile(rf);
+}
+
+/* 処理中の要求より新しい要求があるか調べる */
+static bool is_canceled(void)
+{
+	bool canceled;
+
+	pthread_mutex_lock(&mutex);
+	canceled = quit || cur_seq != req_seq;
+	pthread_mutex_unlock(&mutex);
+
+	return canceled;
+}
+
+/* ディレクトリ名とファイル名のハッシュ値を求める(FNV-1a) */
+static uint32_t hash_file_name(const char *dir, const char *file)
+{
+	uint32_t h;
+
+	h = 2166136261U;
+	while (*dir) {
+		h ^= (uint8_t)*dir++;
+		h *= 16777619U;
+	}
+	h ^= (uint8_t)'/';
+	h *= 16777619U;
+	while (*file) {
+		h ^= (uint8_t)*file++;
+		h *= 16777619U;
+	}
+
+	return h;
+}
@@ -0,0 +1,22 @@
+﻿/* -*- coding: utf-8-with-signature; tab-width: 8; indent-tabs-mode: t; -*- */
+
+/*
+ * Suika 2
+ * Copyright (C) 2001-2021, TABATA Keiichi. All rights reserved.
+ */
+
+#ifndef SUIKA_PREFETCH_H
+#define SUIKA_PREFETCH_H
+
+#include "types.h"
+
+/* 先読みスレッドの初期化処理を行う */
+bool init_prefetch(void);
+
+/* 先読みスレッドの終了処理を行う */
+void cleanup_prefetch(void);
+
+/* スクリプトとそのアセットの先読みを要求する */
+void request_prefetch_script(const char *fname);
+
+#endif
@@ -11,111 +11,432 @@
 #include "suika.h"
 
 /*
- * ファイルスコープ変数
+ * 非同期読み込み
+ *  - USE_IMAGE_THREADが定義されている場合、PNGのデコードをワーカスレッドで
+ *    行い、メインスレッドはデコードの完了を待たずにフレームを進められる
+ *  - 完了した要求はprocess_image_loads()でメインスレッドに渡される
+ *  - 定義されていない場合とスレッドを作成できなかった場合は、
+ *    take_loaded_image()の中で同期的にデコードする
  */
-static struct rfile *rf;
-static png_structp png_ptr;
-static png_infop info_ptr;
-static png_bytep *rows;
-static int width;
-static int height;
-static struct image *image;
+#ifdef USE_IMAGE_THREAD
+#include <pthread.h>
+#endif
+
+/* 読み込みエラーの種類 */
+enum {
+	READ_OK,
+	READ_ERROR_OPEN,	/* ファイルを開けない */
+	READ_ERROR_FORMAT,	/* PNGとして読めない */
+	READ_ERROR_OTHER	/* メモリ不足など(ログ出力済み) */
+};
+
+/* PNGの読み込みコンテキスト */
+struct png_reader {
+	struct rfile *rf;
+	png_structp png_ptr;
+	png_infop info_ptr;
+	png_bytep *rows;
+	int width;
+	int height;
+	struct image *image;
+	bool premultiply;
+};
+
+/*
+ * イメージキャッシュ
+ *  - ファイルから読み込んだイメージを参照カウントつきで共有する
+ *  - キャッシュ自身も1つの参照を持ち、参照カウントが1のエントリは
+ *    どこからも使われていないので、LRUで破棄できる
+ *  - メインスレッドのみが使用する
+ */
+
+/* キャッシュのエントリの最大数 */
+#define CACHE_ENTRY_MAX		(128)
+
+/* キャッシュのサイズ(MB)の既定値 */
+#define DEFAULT_CACHE_SIZE	(64)
+
+/* キャッシュのエントリ */
+struct cache_entry {
+	char *dir;
+	char *file;
+	bool premultiply;
+	struct image *img;
+	size_t size;
+	unsigned int last_used;
+};
+
+/* キャッシュのエントリのテーブル */
+static struct cache_entry cache_tbl[CACHE_ENTRY_MAX];
+
+/* キャッシュのエントリ数 */
+static int cache_count;
+
+/* キャッシュされたイメージの合計サイズ(バイト) */
+static size_t cache_size;
+
+/* 最後に使用した時刻の代わりに使うカウンタ */
+static unsigned int cache_tick;
+
+#ifdef USE_IMAGE_THREAD
+
+/* 読み込み要求の最大数 */
+#define LOAD_REQ_MAX		(16)
+
+/* ディレクトリ名とファイル名のサイズ */
+#define LOAD_DIR_SIZE		(64)
+#define LOAD_FILE_SIZE		(256)
+
+/* 読み込み要求の状態 */
+enum {
+	LOAD_FREE,		/* 未使用 */
+	LOAD_QUEUED,		/* デコード待ち */
+	LOAD_DECODING,		/* デコード中 */
+	LOAD_FINISHED		/* デコード完了(成功または失敗) */
+};
+
+/* 読み込み要求 */
+struct load_req {
+	/* 以下はミューテックスで保護する */
+	int state;
+	struct image *img;
+	int error;
+
+	/* 以下は要求時に設定され、FREEに戻るまで変更されない */
+	char dir[LOAD_DIR_SIZE];
+	char file[LOAD_FILE_SIZE];
+	bool premultiply;
+	unsigned int seq;
+
+	/* メインスレッドのみが使用する(完了がメインスレッドに渡された) */
+	bool is_ready;
+};
+
+/* 読み込みスレッド */
+static pthread_t thread;
+
+/* 読み込みスレッドが動作中であるか */
+static bool is_running;
+
+/* 排他制御用ミューテックス */
+static pthread_mutex_t mutex;
+
+/* メインスレッドから読み込みスレッドへの要求用条件変数 */
+static pthread_cond_t req_cond;
+
+/* 読み込みスレッドからメインスレッドへの完了通知用条件変数 */
+static pthread_cond_t done_cond;
+
+/* 読み込み要求のテーブル */
+static struct load_req req_tbl[LOAD_REQ_MAX];
+
+/* 要求の通し番号(古い順に処理するために使う) */
+static unsigned int req_seq;
+
+/* 使用終了の要求に使うフラグ */
+static bool quit;
+
+#endif /* USE_IMAGE_THREAD */
 
 /*
  * 前方参照
  */
-static struct image *cleanup(void);
-static bool read_image_file(const char *dir, const char *file);
-static bool check_signature(void);
-static bool read_header(void);
+static struct image *load_image(const char *dir, const char *file,
+				bool premultiply);
+static int read_image_file(struct png_reader *r, const char *dir,
+			   const char *file);
+static void cleanup(struct png_reader *r);
+static bool check_signature(struct png_reader *r);
+static bool read_header(struct png_reader *r);
 static void read_callback(png_structp png_ptr, png_bytep buf, png_size_t len);
-static bool read_body(void);
+static bool read_body(struct png_reader *r);
+static int find_cache_entry(const char *dir, const char *file,
+			    bool premultiply);
+static struct image *find_cached_image(const char *dir, const char *file,
+				       bool premultiply);
+static bool add_cached_image(const char *dir, const char *file,
+			     bool premultiply, struct image *img);
+static void evict_cached_images(size_t limit);
+static void remove_cache_entry(int index);
+#ifdef USE_IMAGE_THREAD
+static void log_read_error(int error, const char *dir, const char *file);
+static void *load_thread(void *p);
+static struct load_req *find_req(const char *dir, const char *file,
+				 bool premultiply);
+static struct load_req *alloc_req(void);
+static void free_req(struct load_req *req);
+#endif
 
 /*
  * イメージをファイルから読み込む
  */
 struct image *create_image_from_file(const char *dir, const char *file)
 {
+	return load_image(dir, file, false);
+}
+
+/*
+ * イメージをファイルから読み込んで乗算済みアルファに変換する
+ *  - 乗算済みアルファを使わない場合はcreate_image_from_file()と同じになる
+ */
+struct image *create_premultiplied_image_from_file(const char *dir,
+						   const char *file)
+{
+	return load_image(dir, file, true);
+}
+
+/* イメージを同期的に読み込む */
+static struct image *load_image(const char *dir, const char *file,
+				bool premultiply)
+{
+	struct png_reader r;
+	int error;
+
+#ifndef USE_PREMULTIPLIED_ALPHA
+	premultiply = false;
+#endif
+
+	/* キャッシュにあれば共有する */
+	r.image = find_cached_image(dir, file, premultiply);
+	if (r.image != NULL)
+		return r.image;
+
+	memset(&r, 0, sizeof(r));
+	r.premultiply = premultiply;
+
 	/* ファイルを読み込む */
-	if (!read_image_file(dir, file)) {
+	error = read_image_file(&r, dir, file);
+	cleanup(&r);
+	if (error != READ_OK) {
 		/* 失敗した場合、イメージを破棄する */
-		if (image != NULL) {
-			destroy_image(image);
-			image = NULL;
-		}
+		if (error == READ_ERROR_FORMAT)
+			log_image_file_error(dir, file);
+		if (r.image != NULL)
+			destroy_image(r.image);
+		return NULL;
 	}
 
-	/* イメージを返す */
-	return cleanup();
+	/* キャッシュに追加してイメージを返す */
+	add_cached_image(dir, file, premultiply, r.image);
+	return r.image;
 }
 
-/* ローカル変数をクリアする */
-static struct image *cleanup(void)
+/*
+ * イメージキャッシュを破棄する
+ *  - 使用中のイメージは、使用者がdestroy_image()を呼ぶまで解放されない
+ */
+void cleanup_image_cache(void)
 {
-	struct image *result;
+	while (cache_count > 0)
+		remove_cache_entry(cache_count - 1);
+}
 
-	result = NULL;
-	if (rf != NULL) {
-		close_rfile(rf);
-		rf = NULL;
-	}
-	if (rows != NULL) {
-		free(rows);
-		rows = NULL;
-	}
-	if (png_ptr != NULL) {
-		png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
-		png_ptr = NULL;
-		info_ptr = NULL;
-	}
-	if (image != NULL) {
-		result = image;
-		image = NULL;
+/* キャッシュのエントリを探す(見つからなければ-1を返す) */
+static int find_cache_entry(const char *dir, const char *file,
+			    bool premultiply)
+{
+	struct cache_entry *e;
+	int i;
+
+	for (i = 0; i < cache_count; i++) {
+		e = &cache_tbl[i];
+		if (e->premultiply == premultiply &&
+		    strcmp(e->file, file) == 0 && strcmp(e->dir, dir) == 0)
+			return i;
 	}
-	return result;
+	return -1;
 }
 
-/* イメージファイルを読み込む */
-static bool read_image_file(const char *dir, const char *file)
+/* キャッシュからイメージを探し、見つかれば参照を増やして返す */
+static struct image *find_cached_image(const char *dir, const char *file,
+				       bool premultiply)
 {
-	rf = open_rfile(dir, file, false);
-	if (rf == NULL)
+	int index;
+
+	index = find_cache_entry(dir, file, premultiply);
+	if (index == -1)
+		return NULL;
+
+	cache_tbl[index].last_used = ++cache_tick;
+	return ref_image(cache_tbl[index].img);
+}
+
+/* イメージをキャッシュに追加する(追加できなかった場合は偽を返す) */
+static bool add_cached_image(const char *dir, const char *file,
+			     bool premultiply, struct image *img)
+{
+	struct cache_entry *e;
+	size_t size, limit;
+
+	size = (size_t)get_image_width(img) * (size_t)get_image_height(img) *
+		sizeof(pixel_t);
+	limit = (size_t)(conf_image_cache_size > 0 ?
+			 conf_image_cache_size : DEFAULT_CACHE_SIZE) *
+		1024 * 1024;
+
+	/* 既にある場合は重複させず、既存のエントリで保持されたとみなす */
+	if (find_cache_entry(dir, file, premultiply) != -1)
+		return true;
+
+	/* 1つで上限を超える場合はキャッシュしない */
+	if (size > limit)
 		return false;
 
-	if (!check_signature()) {
-		log_image_file_error(dir, file);
+	/* 空きを作る */
+	evict_cached_images(limit - size);
+	if (cache_count == CACHE_ENTRY_MAX)
 		return false;
-	}
 
-	if (!read_header()) {
-		log_image_file_error(dir, file);
+	e = &cache_tbl[cache_count];
+	e->dir = strdup(dir);
+	e->file = strdup(file);
+	if (e->dir == NULL || e->file == NULL) {
+		log_memory();
+		free(e->dir);
+		free(e->file);
 		return false;
 	}
+	e->premultiply = premultiply;
+	e->img = ref_image(img);
+	e->size = size;
+	e->last_used = ++cache_tick;
+	cache_count++;
+	cache_size += size;
+	return true;
+}
 
-	image = create_image(width, height);
-	if (image == NULL)
-		return false;
+/*
+ * イメージがキャッシュにあるかを調べる
+ *  - ある場合は最近使われたものとして扱い、破棄されにくくする
+ */
+bool touch_cached_image(const char *dir, const char *file, bool premultiply)
+{
+	int index;
 
-	lock_image(image);
+#ifndef USE_PREMULTIPLIED_ALPHA
+	premultiply = false;
+#endif
 
-	if (!read_body()) {
-		log_image_file_error(dir, file);
-		unlock_image(image);
+	index = find_cache_entry(dir, file, premultiply);
+	if (index == -1)
 		return false;
+
+	cache_tbl[index].last_used = ++cache_tick;
+	return true;
+}
+
+/*
+ * 使われていないイメージを古い順に破棄する
+ *  - 合計サイズがlimit以下で、エントリに空きがある状態にする
+ *  - 使用中のイメージは破棄できないので、上限を超えることがある
+ */
+static void evict_cached_images(size_t limit)
+{
+	int i, oldest;
+
+	while (cache_size > limit || cache_count == CACHE_ENTRY_MAX) {
+		/* キャッシュからしか参照されていない最も古いエントリを探す */
+		oldest = -1;
+		for (i = 0; i < cache_count; i++) {
+			if (get_image_ref_count(cache_tbl[i].img) > 1)
+				continue;
+			if (oldest == -1 || cache_tbl[i].last_used <
+			    cache_tbl[oldest].last_used)
+				oldest = i;
+		}
+
+		/* すべて使用中の場合 */
+		if (oldest == -1)
+			break;
+
+		remove_cache_entry(oldest);
 	}
+}
 
-	unlock_image(image);
+/* キャッシュのエントリを削除する */
+static void remove_cache_entry(int index)
+{
+	struct cache_entry *e;
+
+	e = &cache_tbl[index];
+	cache_size -= e->size;
+	destroy_image(e->img);
+	free(e->dir);
+	free(e->file);
+
+	/* 最後のエントリで埋める */
+	cache_count--;
+	if (index != cache_count)
+		*e = cache_tbl[cache_count];
+}
 
-	return true;
+/* 読み込みに使ったリソースを解放する(イメージは解放しない) */
+static void cleanup(struct png_reader *r)
+{
+	if (r->rf != NULL) {
+		close_rfile(r->rf);
+		r->rf = NULL;
+	}
+	if (r->rows != NULL) {
+		free(r->rows);
+		r->rows = NULL;
+	}
+	if (r->png_ptr != NULL) {
+		png_destroy_read_struct(&r->png_ptr, &r->info_ptr, NULL);
+		r->png_ptr = NULL;
+		r->info_ptr = NULL;
+	}
+}
+
+/*
+ * イメージファイルを読み込む
+ *  - ファイルを開けた後はエラーをログに出力しないので、
+ *    ワーカスレッドからも呼び出せる(メモリ不足のログを除く)
+ */
+static int read_image_file(struct png_reader *r, const char *dir,
+			   const char *file)
+{
+	r->rf = open_rfile(dir, file, false);
+	if (r->rf == NULL)
+		return READ_ERROR_OPEN;
+
+	if (!check_signature(r))
+		return READ_ERROR_FORMAT;
+
+	if (!read_header(r))
+		return READ_ERROR_FORMAT;
+
+	r->image = create_image(r->width, r->height);
+	if (r->image == NULL)
+		return READ_ERROR_OTHER;
+
+	lock_image(r->image);
+
+	if (!read_body(r)) {
+		unlock_image(r->image);
+		return READ_ERROR_FORMAT;
+	}
+
+	/* 必要なら乗算済みアルファに変換する */
+	if (r->premultiply)
+		premultiply_image(r->image);
+
+	unlock_image(r->image);
+
+	/* 透明/不透明のスパンを作成する */
+	if (!build_image_spans(r->image))
+		return READ_ERROR_OTHER;
+
+	return READ_OK;
 }
 
 /* シグネチャをチェックする */
-static bool check_signature(void)
+static bool check_signature(struct png_reader *r)
 {
 	png_byte buf[8];
 	size_t len;
 
-	len = read_rfile(rf, buf, 8);
+	len = read_rfile(r->rf, buf, 8);
 	if (len == 0)
 		return false;
 
@@ -126,33 +447,37 @@ static bool check_signature(void)
 }
 
 /* ヘッダを読み込む */
-static bool read_header(void)
+static bool read_header(struct png_reader *r)
 {
+	png_structp png_ptr;
+	png_infop info_ptr;
 	png_byte color_type, bit_depth;
 
-	png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL,
-					 NULL);
-	if (png_ptr == NULL)
+	r->png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL,
+					    NULL);
+	if (r->png_ptr == NULL)
 		return false;
 
-	info_ptr = png_create_info_struct(png_ptr);
-	if (info_ptr == NULL) {
-		png_destroy_read_struct(&png_ptr, NULL, NULL);
+	r->info_ptr = png_create_info_struct(r->png_ptr);
+	if (r->info_ptr == NULL) {
+		png_destroy_read_struct(&r->png_ptr, NULL, NULL);
+		r->png_ptr = NULL;
 		return false;
 	}
 
-	if (setjmp(png_jmpbuf(png_ptr))) {
-		png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+	/* エラー時はcleanup()で破棄する */
+	if (setjmp(png_jmpbuf(r->png_ptr)))
 		return false;
-	}
 
-	png_set_read_fn(png_ptr, rf, read_callback);
+	png_ptr = r->png_ptr;
+	info_ptr = r->info_ptr;
+	png_set_read_fn(png_ptr, r->rf, read_callback);
 	png_set_sig_bytes(png_ptr, 8);
 	png_read_info(png_ptr, info_ptr);
 
 	/* サイズ、カラータイプ、ビット幅を取得する */
-	width = (int)png_get_image_width(png_ptr, info_ptr);
-	height = (int)png_get_image_height(png_ptr, info_ptr);
+	r->width = (int)png_get_image_width(png_ptr, info_ptr);
+	r->height = (int)png_get_image_height(png_ptr, info_ptr);
 	color_type = png_get_color_type(png_ptr, info_ptr);
 	bit_depth = png_get_bit_depth(png_ptr, info_ptr);
 
@@ -217,27 +542,465 @@ static void read_callback(png_structp png_ptr, png_bytep buf, png_size_t len)
 }
 
 /* イメージ本体を読み込む */
-static bool read_body(void)
+static bool read_body(struct png_reader *r)
 {
 	int y;
 	pixel_t *pixels;
 	
-	if (setjmp(png_jmpbuf(png_ptr))) {
-		png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+	/* エラー時はcleanup()で破棄する */
+	if (setjmp(png_jmpbuf(r->png_ptr)))
 		return false;
+
+	r->rows = malloc(sizeof(png_bytep) * (size_t)r->height);
+	if (r->rows == NULL)
+		return false;
+
+	assert(png_get_rowbytes(r->png_ptr, r->info_ptr) ==
+	       (size_t)(r->width * 4));
+
+	pixels = get_image_pixels(r->image);
+	for (y = 0; y < r->height; y++)
+		r->rows[y] = (png_bytep)&pixels[r->width * y];
+
+	png_read_image(r->png_ptr, r->rows);
+
+	return true;
+}
+
+/*
+ * 非同期読み込み
+ */
+
+#ifdef USE_IMAGE_THREAD
+
+/*
+ * イメージ読み込みスレッドの初期化処理を行う
+ */
+bool init_image_loader(void)
+{
+	int i;
+
+	is_running = false;
+	req_seq = 0;
+	quit = false;
+	for (i = 0; i < LOAD_REQ_MAX; i++) {
+		req_tbl[i].state = LOAD_FREE;
+		req_tbl[i].dir[0] = '\0';
 	}
 
-	rows = malloc(sizeof(png_bytep) * (size_t)height);
-	if (rows == NULL)
+	pthread_mutex_init(&mutex, NULL);
+	pthread_cond_init(&req_cond, NULL);
+	pthread_cond_init(&done_cond, NULL);
+
+	/* 読み込みスレッドを作成する */
+	if (pthread_create(&thread, NULL, load_thread, NULL) != 0) {
+		/* 作成できなかった場合は同期的に読み込む */
+		log_api_error("pthread_create");
+		pthread_cond_destroy(&done_cond);
+		pthread_cond_destroy(&req_cond);
+		pthread_mutex_destroy(&mutex);
+		return true;
+	}
+	is_running = true;
+
+	return true;
+}
+
+/*
+ * イメージ読み込みスレッドの終了処理を行う
+ */
+void cleanup_image_loader(void)
+{
+	void *p;
+	int i;
+
+	if (!is_running)
+		return;
+
+	/* 読み込みスレッドに終了を要求する */
+	pthread_mutex_lock(&mutex);
+	quit = true;
+	pthread_cond_signal(&req_cond);
+	pthread_mutex_unlock(&mutex);
+
+	/* 読み込みスレッドの終了を待つ */
+	pthread_join(thread, &p);
+	is_running = false;
+
+	/* 受け取られなかったイメージを破棄する */
+	for (i = 0; i < LOAD_REQ_MAX; i++)
+		if (req_tbl[i].state != LOAD_FREE)
+			free_req(&req_tbl[i]);
+
+	pthread_cond_destroy(&done_cond);
+	pthread_cond_destroy(&req_cond);
+	pthread_mutex_destroy(&mutex);
+}
+
+/*
+ * イメージの読み込みを要求する
+ *  - premultiplyが真の場合はcreate_premultiplied_image_from_file()と同じ
+ *    イメージを作成する
+ *  - 要求できなかった場合はtake_loaded_image()で同期的に読み込まれる
+ */
+void request_image_load(const char *dir, const char *file, bool premultiply)
+{
+	struct load_req *req;
+
+	if (!is_running)
+		return;
+	if (strlen(dir) >= LOAD_DIR_SIZE || strlen(file) >= LOAD_FILE_SIZE)
+		return;
+
+#ifndef USE_PREMULTIPLIED_ALPHA
+	premultiply = false;
+#endif
+
+	/* キャッシュにある場合と、既に要求されている場合 */
+	if (find_cache_entry(dir, file, premultiply) != -1)
+		return;
+	if (find_req(dir, file, premultiply) != NULL)
+		return;
+
+	pthread_mutex_lock(&mutex);
+	req = alloc_req();
+	if (req != NULL) {
+		strcpy(req->dir, dir);
+		strcpy(req->file, file);
+		req->premultiply = premultiply;
+		req->seq = req_seq++;
+		req->img = NULL;
+		req->error = READ_OK;
+		req->is_ready = false;
+		req->state = LOAD_QUEUED;
+		pthread_cond_signal(&req_cond);
+	}
+	pthread_mutex_unlock(&mutex);
+}
+
+/*
+ * イメージの読み込みが完了していないかを調べる
+ *  - 要求されていない場合は要求する
+ *  - 完了はprocess_image_loads()を呼び出した時点で反映される
+ */
+bool is_image_loading(const char *dir, const char *file, bool premultiply)
+{
+	struct load_req *req;
+
+	if (!is_running)
 		return false;
 
-	assert(png_get_rowbytes(png_ptr, info_ptr) == (size_t)(width*4));
+#ifndef USE_PREMULTIPLIED_ALPHA
+	premultiply = false;
+#endif
+
+	/* キャッシュにあれば読み込みは不要 */
+	if (find_cache_entry(dir, file, premultiply) != -1)
+		return false;
+
+	req = find_req(dir, file, premultiply);
+	if (req == NULL) {
+		request_image_load(dir, file, premultiply);
+		req = find_req(dir, file, premultiply);
+		if (req == NULL)
+			return false;	/* 同期的に読み込む */
+	}
+
+	return !req->is_ready;
+}
+
+/*
+ * 読み込みが完了したイメージを受け取る
+ *  - キャッシュにあれば共有する
+ *  - 要求されていない場合は同期的に読み込み、完了していない場合は待つ
+ *  - 失敗した場合はエラーをログに記録してNULLを返す
+ */
+struct image *take_loaded_image(const char *dir, const char *file,
+				bool premultiply)
+{
+	struct load_req *req;
+	struct image *img;
+	int error;
+
+	if (!is_running)
+		return load_image(dir, file, premultiply);
+
+#ifndef USE_PREMULTIPLIED_ALPHA
+	premultiply = false;
+#endif
+
+	req = find_req(dir, file, premultiply);
+	if (req == NULL)
+		return load_image(dir, file, premultiply);
+
+	/* キャッシュにあれば要求を取り消して共有する */
+	if (find_cache_entry(dir, file, premultiply) != -1) {
+		pthread_mutex_lock(&mutex);
+		if (req->state != LOAD_DECODING)
+			free_req(req);
+		pthread_mutex_unlock(&mutex);
+		return load_image(dir, file, premultiply);
+	}
+
+	/* 完了していなければ完了を待つ */
+	pthread_mutex_lock(&mutex);
+	while (req->state != LOAD_FINISHED)
+		pthread_cond_wait(&done_cond, &mutex);
+	img = req->img;
+	error = req->error;
+	req->img = NULL;
+	free_req(req);
+	pthread_mutex_unlock(&mutex);
+
+	/* エラーはメインスレッドでログに記録する */
+	if (img == NULL) {
+		log_read_error(error, dir, file);
+		return NULL;
+	}
 
-	pixels = get_image_pixels(image);
-	for (y = 0; y < height; y++)
-		rows[y] = (png_bytep)&pixels[width * y];
+	/* キャッシュに追加する */
+	add_cached_image(dir, file, premultiply, img);
+	return img;
+}
 
-	png_read_image(png_ptr, rows);
+/*
+ * 読み込みの完了をメインスレッドに反映する
+ *  - ゲームループの1フレームの最初に呼び出す
+ *  - 成功した要求はキャッシュに移し、先読みされたイメージも
+ *    キャッシュの上限の範囲で保持されるようにする
+ *  - 失敗した要求とキャッシュに入らなかった要求は、
+ *    take_loaded_image()で受け取られるか、cancel_image_loads()で
+ *    破棄されるまで残す
+ */
+void process_image_loads(void)
+{
+	struct load_req *req;
+	int i;
+
+	if (!is_running)
+		return;
+
+	pthread_mutex_lock(&mutex);
+	for (i = 0; i < LOAD_REQ_MAX; i++) {
+		req = &req_tbl[i];
+		if (req->state != LOAD_FINISHED || req->is_ready)
+			continue;
+		req->is_ready = true;
+		if (req->img != NULL &&
+		    add_cached_image(req->dir, req->file, req->premultiply,
+				     req->img))
+			free_req(req);
+	}
+	pthread_mutex_unlock(&mutex);
+}
 
+/*
+ * 受け取られずに残っている完了済みの要求を破棄する
+ *  - 先読みを取り消すときに呼び出し、失敗した要求とキャッシュに
+ *    入らなかった要求がテーブルを占有し続けないようにする
+ *  - 破棄されたイメージが必要になった場合は再度読み込まれる
+ */
+void cancel_image_loads(void)
+{
+	int i;
+
+	if (!is_running)
+		return;
+
+	pthread_mutex_lock(&mutex);
+	for (i = 0; i < LOAD_REQ_MAX; i++) {
+		if (req_tbl[i].state == LOAD_FINISHED && req_tbl[i].is_ready)
+			free_req(&req_tbl[i]);
+	}
+	pthread_mutex_unlock(&mutex);
+}
+
+/* 読み込みスレッド */
+static void *load_thread(void *p)
+{
+	struct png_reader r;
+	struct load_req *req;
+	int i, error;
+
+	UNUSED_PARAMETER(p);
+
+	pthread_mutex_lock(&mutex);
+	while (1) {
+		/* 最も古いデコード待ちの要求を探す */
+		req = NULL;
+		for (i = 0; i < LOAD_REQ_MAX; i++) {
+			if (req_tbl[i].state != LOAD_QUEUED)
+				continue;
+			if (req == NULL || req_tbl[i].seq < req->seq)
+				req = &req_tbl[i];
+		}
+
+		/* 要求がなければ待つ */
+		if (req == NULL) {
+			if (quit)
+				break;
+			pthread_cond_wait(&req_cond, &mutex);
+			continue;
+		}
+		req->state = LOAD_DECODING;
+		pthread_mutex_unlock(&mutex);
+
+		/* ファイルがなければ開かずにエラーとする(ログは後で出す) */
+		memset(&r, 0, sizeof(r));
+		r.premultiply = req->premultiply;
+		if (check_file_exist(req->dir, req->file))
+			error = read_image_file(&r, req->dir, req->file);
+		else
+			error = READ_ERROR_OPEN;
+		cleanup(&r);
+		if (error != READ_OK && r.image != NULL) {
+			destroy_image(r.image);
+			r.image = NULL;
+		}
+
+		pthread_mutex_lock(&mutex);
+		req->img = r.image;
+		req->error = error;
+		req->state = LOAD_FINISHED;
+		pthread_cond_signal(&done_cond);
+	}
+	pthread_mutex_unlock(&mutex);
+
+	return NULL;
+}
+
+/* 読み込みのエラーをログに記録する */
+static void log_read_error(int error, const char *dir, const char *file)
+{
+	struct rfile *rf;
+
+	switch (error) {
+	case READ_ERROR_OPEN:
+		/* ファイルを開き直してオープンエラーを記録する */
+		rf = open_rfile(dir, file, false);
+		if (rf != NULL)
+			close_rfile(rf);
+		break;
+	case READ_ERROR_FORMAT:
+		log_image_file_error(dir, file);
+		break;
+	default:
+		break;
+	}
+}
+
+/* 読み込み要求を探す(メインスレッドから呼び出す) */
+static struct load_req *find_req(const char *dir, const char *file,
+				 bool premultiply)
+{
+	int i;
+
+	/* 状態以外はメインスレッドしか変更しないので、ロックせずに読める */
+	for (i = 0; i < LOAD_REQ_MAX; i++) {
+		if (req_tbl[i].dir[0] == '\0')
+			continue;
+		if (req_tbl[i].premultiply == premultiply &&
+		    strcmp(req_tbl[i].file, file) == 0 &&
+		    strcmp(req_tbl[i].dir, dir) == 0)
+			return &req_tbl[i];
+	}
+	return NULL;
+}
+
+/*
+ * 空いている読み込み要求を確保する(ロックした状態で呼び出す)
+ *  - 空きがなければ、受け取られていない最も古い完了済みの要求を破棄する
+ */
+static struct load_req *alloc_req(void)
+{
+	struct load_req *oldest;
+	int i;
+
+	oldest = NULL;
+	for (i = 0; i < LOAD_REQ_MAX; i++) {
+		if (req_tbl[i].state == LOAD_FREE)
+			return &req_tbl[i];
+		if (req_tbl[i].state != LOAD_FINISHED)
+			continue;
+		if (oldest == NULL || req_tbl[i].seq < oldest->seq)
+			oldest = &req_tbl[i];
+	}
+	if (oldest != NULL)
+		free_req(oldest);
+	return oldest;
+}
+
+/* 読み込み要求を解放する(スレッドが処理中でない状態で呼び出す) */
+static void free_req(struct load_req *req)
+{
+	if (req->img != NULL) {
+		destroy_image(req->img);
+		req->img = NULL;
+	}
+	req->dir[0] = '\0';
+	req->file[0] = '\0';
+	req->state = LOAD_FREE;
+}
+
+#else /* USE_IMAGE_THREAD */
+
+/*
+ * イメージ読み込みスレッドの初期化処理を行う
+ */
+bool init_image_loader(void)
+{
 	return true;
 }
+
+/*
+ * イメージ読み込みスレッドの終了処理を行う
+ */
+void cleanup_image_loader(void)
+{
+}
+
+/*
+ * イメージの読み込みを要求する(同期的に読み込むので何もしない)
+ */
+void request_image_load(const char *dir, const char *file, bool premultiply)
+{
+	UNUSED_PARAMETER(dir);
+	UNUSED_PARAMETER(file);
+	UNUSED_PARAMETER(premultiply);
+}
+
+/*
+ * イメージの読み込みが完了していないかを調べる(常に完了している)
+ */
+bool is_image_loading(const char *dir, const char *file, bool premultiply)
+{
+	UNUSED_PARAMETER(dir);
+	UNUSED_PARAMETER(file);
+	UNUSED_PARAMETER(premultiply);
+	return false;
+}
+
+/*
+ * 読み込みが完了したイメージを受け取る(同期的に読み込む)
+ */
+struct image *take_loaded_image(const char *dir, const char *file,
+				bool premultiply)
+{
+	return load_image(dir, file, premultiply);
+}
+
+/*
+ * 読み込みの完了をメインスレッドに反映する(何もしない)
+ */
+void process_image_loads(void)
+{
+}
+
+/*
+ * 受け取られずに残っている完了済みの要求を破棄する(何もしない)
+ */
+void cancel_image_loads(void)
+{
+}
+
+#endif /* USE_IMAGE_THREAD */
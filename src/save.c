@@ -1093,7 +1093,7 @@ static bool deserialize_stage(struct rfile *rf)
 			img = NULL;
 		} else {
 			set_ch_file_name(i, s);
-			img = create_image_from_file(CH_DIR, s);
+			img = create_premultiplied_image_from_file(CH_DIR, s);
 			if (img == NULL)
 				return false;
 		}
@@ -30,6 +30,12 @@
 
 #include "suika.h"
 
+#include <limits.h>	/* INT_MAX */
+
+#ifdef USE_PREFETCH_THREAD
+#include "prefetch.h"
+#endif
+
 /* 1行の読み込みサイズ */
 #define LINE_BUF_SIZE	(65536)
 
@@ -40,14 +46,131 @@
 /* コマンドの引数の最大数(コマンド名も含める) */
 #define PARAM_SIZE	(137)
 
-/* コマンド配列 */
+/* コマンド配列の初期サイズ */
+#define CMD_INIT_SIZE		(1024)
+
+/* 引数テーブルの初期サイズ */
+#define PARAM_TBL_INIT_SIZE	(4096)
+
+/* 文字列アリーナの初期サイズ */
+#define ARENA_INIT_SIZE		(65536)
+
+/* 省略された引数を表すオフセット */
+#define NO_PARAM		(-1)
+
+/* ラベルのハッシュテーブルの初期サイズ(2の累乗) */
+#define LABEL_TBL_INIT_SIZE	(256)
+
+/* ラベルのハッシュテーブルの空きスロット */
+#define NO_LABEL		(-1)
+
+/*
+ * コンパイル済みスクリプト
+ *  - tool/package.cがパッケージ作成時に"<スクリプト名>.suika"として出力する
+ *  - ヘッダ、コマンド配列、引数テーブル、文字列アリーナの順に並ぶ
+ *  - 整数はリトルエンディアンの32ビット値
+ */
+
+/* コンパイル済みスクリプトのマジック */
+#define COMPILED_MAGIC		"SUIKASCB"
+#define COMPILED_MAGIC_SIZE	(8)
+
+/* コンパイル済みスクリプトのフォーマットのバージョン */
+#define COMPILED_VERSION	(1)
+
+/* ヘッダのサイズ(マジック、バージョン、コマンド数、引数の数、アリーナサイズ) */
+#define COMPILED_HEADER_SIZE	(COMPILED_MAGIC_SIZE + 4 * 4)
+
+/* コマンド1つのサイズ(行番号、行の内容、引数の先頭、引数の数) */
+#define COMPILED_CMD_SIZE	(4 * 4)
+
+/* コンパイル済みスクリプトのファイル名のサイズ */
+#define COMPILED_NAME_SIZE	(256)
+
+/*
+ * コマンド配列
+ *  - スクリプトの長さに合わせて伸長する
+ *  - 文字列は文字列アリーナに格納し、オフセットで参照する
+ */
 static struct command {
 	int type;
 	int line;
-	char *text;
-	char *param[PARAM_SIZE];
-} cmd[SCRIPT_CMD_SIZE];
+	int text;		/* 行の内容のオフセット */
+	int param;		/* 引数テーブル内の先頭インデックス */
+	int param_count;	/* 引数の数(コマンド名も含める) */
+} *cmd;
 static int cmd_size;
+static int cmd_alloc_size;
+
+/* 引数テーブル(文字列アリーナ内のオフセットの配列) */
+static int *param_tbl;
+static int param_tbl_size;
+static int param_tbl_alloc_size;
+
+/*
+ * 引数の型付きの値
+ *  - 引数テーブルと同じインデックスで参照する
+ *  - 実行のたびに文字列を変換しないよう、ロード時に変換しておく
+ */
+static struct param_value {
+	int i;		/* 整数値 */
+	float f;	/* 浮動小数点数値 */
+	bool is_var;	/* "$n"の形式であるか */
+	int var;	/* 変数番号("$n"の場合のみ有効, 範囲外もそのまま) */
+	int method;	/* フェードメソッド(フェードメソッドの引数のみ) */
+} *param_val;
+
+/* ロード時にフェードメソッドに変換する引数 */
+static const struct fade_method_param {
+	int type;
+	int index;
+} fade_method_param_tbl[] = {
+	{COMMAND_BG, BG_PARAM_METHOD},
+	{COMMAND_CH, CH_PARAM_METHOD},
+	{COMMAND_CHS, CHS_PARAM_METHOD},
+};
+
+#define FADE_METHOD_PARAM_TBL_SIZE	\
+	(sizeof(fade_method_param_tbl) / sizeof(struct fade_method_param))
+
+/* アセットのファイル名を指定する引数 */
+static const struct asset_param {
+	int type;
+	int index;
+	const char *dir;
+} asset_param_tbl[] = {
+	{COMMAND_BG, BG_PARAM_FILE, BG_DIR},
+	{COMMAND_BGM, BGM_PARAM_FILE, BGM_DIR},
+	{COMMAND_CH, CH_PARAM_FILE, CH_DIR},
+	{COMMAND_SE, SE_PARAM_FILE, SE_DIR},
+	{COMMAND_SERIF, SERIF_PARAM_VOICE, CV_DIR},
+	{COMMAND_MENU, MENU_PARAM_BG_FILE, BG_DIR},
+	{COMMAND_MENU, MENU_PARAM_FG_FILE, BG_DIR},
+	{COMMAND_RETROSPECT, RETROSPECT_PARAM_BG_FILE, BG_DIR},
+	{COMMAND_RETROSPECT, RETROSPECT_PARAM_FG_FILE, BG_DIR},
+	{COMMAND_CHS, CHS_PARAM_CENTER, CH_DIR},
+	{COMMAND_CHS, CHS_PARAM_RIGHT, CH_DIR},
+	{COMMAND_CHS, CHS_PARAM_LEFT, CH_DIR},
+	{COMMAND_CHS, CHS_PARAM_BACK, CH_DIR},
+	{COMMAND_CHS, CHS_PARAM_BG, BG_DIR},
+};
+
+#define ASSET_PARAM_TBL_SIZE	\
+	(sizeof(asset_param_tbl) / sizeof(struct asset_param))
+
+/* 文字列アリーナ */
+static char *arena;
+static size_t arena_size;
+static size_t arena_alloc_size;
+
+/*
+ * ラベルのハッシュテーブル
+ *  - ラベル名からラベルコマンドのインデックスを引く(オープンアドレス法)
+ *  - 使用率が半分を超えると倍に伸長する
+ */
+static int *label_tbl;
+static int label_tbl_size;
+static int label_count;
 
 /*
  * 命令の種類
@@ -91,20 +214,45 @@ struct insn_item {
 static char *cur_script;	/* 実行中のスクリプト名 */
 static int cur_index;		/* 実行中の行番号 */
 static int return_point;	/* 最後にgosubが実行された行番号 */
+static int load_count;		/* スクリプトをロードした回数 */
 
 /*
  * 前方参照
  */
+static bool enum_command_assets(int index, asset_func func, void *arg);
+static const char *get_asset_file_name(const char *param);
+static char *get_serif_voice(char *buf);
+#ifdef USE_PREFETCH_THREAD
+static void prefetch_next_script(void);
+#endif
+static bool read_compiled_script(const char *fname, bool *error);
+static bool decode_compiled_script(const uint8_t *data, size_t size);
+static bool setup_compiled_script(const char *fname);
+static uint32_t get_u32(const uint8_t *p);
 static bool read_script_from_file(const char *fname);
 static bool parse_insn(int index, const char *fname, int line,
 		       const char *buf);
-static char *strtok_escape(char *buf);
+static bool setup_insn(int index, const char *fname, int line,
+		       const char *buf);
+static int get_insn_index(const char *name);
+static char *strtok_escape(char *buf, char **save);
 static bool parse_serif(int index, const char *fname, int line,
 			const char *buf);
 static bool parse_message(int index, const char *fname, int line,
 			  const char *buf);
 static bool parse_label(int index, const char *fname, int line,
 			const char *buf);
+static bool register_label(int index, const char *fname, int line,
+			   const char *buf);
+static void free_commands(void);
+static bool reserve_command(void);
+static bool add_param(int index, int ofs);
+static void set_param_value(int n);
+static int add_string(const char *str);
+static bool add_label(int index);
+static int find_label(const char *label);
+static const char *get_label_name(int index);
+static uint32_t hash_label(const char *label);
 
 /*
  * 初期化
@@ -126,28 +274,8 @@ bool init_script(void)
  */
 void cleanup_script(void)
 {
-	int i, j;
-
-	for (i = 0; i < SCRIPT_CMD_SIZE; i++) {
-		/* コマンドタイプをクリアする */
-		cmd[i].type = COMMAND_MIN;
-
-		/* 行の内容を解放する */
-		if (cmd[i].text != NULL) {
-			free(cmd[i].text);
-			cmd[i].text = NULL;
-		}
-
-		/* 引数の本体を解放する */
-		if (cmd[i].param[0] != NULL) {
-			free(cmd[i].param[0]);
-			cmd[i].param[0] = NULL;
-		}
-
-		/* 引数の参照をNULLで上書きする */
-		for (j = 1; j < PARAM_SIZE; j++)
-			cmd[i].param[j] = NULL;
-	}
+	/* コマンド配列、引数テーブル、文字列アリーナ、ラベルを解放する */
+	free_commands();
 
 	if (cur_script != NULL) {
 		free(cur_script);
@@ -164,20 +292,27 @@ void cleanup_script(void)
  */
 bool load_script(const char *fname)
 {
+	bool error;
+
 	/* 現在のスクリプトを破棄する */
 	cleanup_script();
 
 	/* スクリプト名を保存する */
 	cur_index = 0;
+	load_count++;
 	cur_script = strdup(fname);
 	if (cur_script == NULL) {
 		log_memory();
 		return false;
 	}
 
-	/* スクリプトファイルを読み込む */
-	if (!read_script_from_file(fname))
-		return false;
+	/* コンパイル済みスクリプトがあれば読み込み、なければ構文解析する */
+	if (!read_compiled_script(fname, &error)) {
+		if (error)
+			return false;
+		if (!read_script_from_file(fname))
+			return false;
+	}
 
 	/* コマンドが含まれない場合 */
 	if (cmd_size == 0) {
@@ -187,9 +322,24 @@ bool load_script(const char *fname)
 
 	/* リターンポイントを無効にする */
 	set_return_point(-1);
+
+#ifdef USE_PREFETCH_THREAD
+	/* 次に読み込まれそうなスクリプトを先読みする */
+	prefetch_next_script();
+#endif
+
 	return true;
 }
 
+/*
+ * スクリプトをロードした回数を取得する
+ *  - スクリプトが変わったかを調べるのに使う(同じ名前の再ロードも含む)
+ */
+int get_script_load_count(void)
+{
+	return load_count;
+}
+
 /*
  * スクリプトファイル名を取得する
  */
@@ -206,6 +356,14 @@ int get_command_index(void)
 	return cur_index;
 }
 
+/*
+ * スクリプトのコマンド数を取得する(既読フラグ用)
+ */
+int get_command_count(void)
+{
+	return cmd_size;
+}
+
 /*
  * 実行中のコマンドのインデックスを設定する(ロード用)
  */
@@ -237,26 +395,18 @@ bool move_to_next_command(void)
  */
 bool move_to_label(const char *label)
 {
-	struct command *c;
 	int i;
 
 	/* ラベルを探す */
-	for (i = 0; i < cmd_size; i++) {
-		/* ラベルでないコマンドをスキップする */
-		c = &cmd[i];
-		if (c->type != COMMAND_LABEL)
-			continue;
+	i = find_label(label);
+	if (i != NO_LABEL) {
+		cur_index = i + 1;
 
-		/* ラベルがみつかった場合 */
-		if (strcmp(c->param[LABEL_PARAM_LABEL], label) == 0) {
-			cur_index = i + 1;
+		/* スクリプトの末尾に達した場合 */
+		if (cur_index == cmd_size)
+			return false;
 
-			/* スクリプトの末尾に達した場合 */
-			if (cur_index == cmd_size)
-				return false;
-
-			return true;
-		}
+		return true;
 	}
 
 	/* エラーを出力する */
@@ -334,7 +484,7 @@ const char *get_line_string(void)
 
 	c = &cmd[cur_index];
 
-	return c->text;
+	return arena + c->text;
 }
 
 /*
@@ -365,11 +515,12 @@ const char *get_string_param(int index)
 	c = &cmd[cur_index];
 
 	/* パラメータが省略された場合 */
-	if (c->param[index] == NULL)
+	if (index >= c->param_count ||
+	    param_tbl[c->param + index] == NO_PARAM)
 		return "";
 
 	/* 文字列を返す */
-	return c->param[index];
+	return arena + param_tbl[c->param + index];
 }
 
 /*
@@ -385,11 +536,11 @@ int get_int_param(int index)
 	c = &cmd[cur_index];
 
 	/* パラメータが省略された場合 */
-	if (c->param[index] == NULL)
+	if (index >= c->param_count)
 		return 0;
 
-	/* 整数に変換して返す */
-	return atoi(c->param[index]);
+	/* ロード時に変換した整数を返す */
+	return param_val[c->param + index].i;
 }
 
 /*
@@ -405,11 +556,550 @@ float get_float_param(int index)
 	c = &cmd[cur_index];
 
 	/* パラメータが省略された場合 */
-	if (c->param[index] == NULL)
+	if (index >= c->param_count)
 		return 0.0f;
 
-	/* 浮動小数点数に変換して返す */
-	return (float)atof(c->param[index]);
+	/* ロード時に変換した浮動小数点数を返す */
+	return param_val[c->param + index].f;
+}
+
+/*
+ * フェードメソッドのコマンドパラメータを取得する
+ *  - 不正なメソッドの場合はFADE_METHOD_INVALIDを返す
+ */
+int get_fade_method_param(int index)
+{
+	struct command *c;
+
+	assert(cur_index < cmd_size);
+	assert(index < PARAM_SIZE);
+
+	c = &cmd[cur_index];
+
+	/* パラメータが省略された場合 */
+	if (index >= c->param_count)
+		return get_fade_method("");
+
+	/* ロード時に変換したフェードメソッドを返す */
+	return param_val[c->param + index].method;
+}
+
+/*
+ * コマンドパラメータが変数("$n"の形式)であるかを調べる
+ */
+bool is_var_param(int index)
+{
+	struct command *c;
+
+	assert(cur_index < cmd_size);
+	assert(index < PARAM_SIZE);
+
+	c = &cmd[cur_index];
+
+	/* パラメータが省略された場合 */
+	if (index >= c->param_count)
+		return false;
+
+	return param_val[c->param + index].is_var;
+}
+
+/*
+ * 変数のコマンドパラメータの変数番号を取得する
+ *  - is_var_param()が真の場合のみ意味を持つ(範囲はチェックしない)
+ *  - "$n"の形式でない場合は-1を返す
+ */
+int get_var_index_param(int index)
+{
+	struct command *c;
+
+	assert(cur_index < cmd_size);
+	assert(index < PARAM_SIZE);
+
+	c = &cmd[cur_index];
+
+	/* パラメータが省略された場合 */
+	if (index >= c->param_count)
+		return -1;
+
+	/* ロード時に求めた変数番号を返す */
+	return param_val[c->param + index].var;
+}
+
+/*
+ * アセットの参照
+ */
+
+/*
+ * スクリプト全体のアセット参照を列挙する
+ *  - funcが偽を返すと列挙を中止する
+ */
+void enum_script_assets(asset_func func, void *arg)
+{
+	int i;
+
+	for (i = 0; i < cmd_size; i++)
+		if (!enum_command_assets(i, func, arg))
+			return;
+}
+
+/*
+ * ラベルから次のラベルまでのアセット参照を列挙する
+ *  - funcが偽を返すと列挙を中止する
+ *  - ラベルがみつからない場合は偽を返す
+ */
+bool enum_label_assets(const char *label, asset_func func, void *arg)
+{
+	int i;
+
+	i = find_label(label);
+	if (i == NO_LABEL)
+		return false;
+
+	for (i++; i < cmd_size && cmd[i].type != COMMAND_LABEL; i++)
+		if (!enum_command_assets(i, func, arg))
+			break;
+
+	return true;
+}
+
+/*
+ * 実行位置から先のアセット参照を実行順に列挙する
+ *  - @goto/@gosub/@returnの飛び先をたどる
+ *  - @if/@selectなどの分岐と、@loadや@menuなどの画面遷移で止まる
+ *  - 最大でmax個のコマンドを調べ、funcが偽を返すと列挙を中止する
+ */
+void enum_lookahead_assets(int max, asset_func func, void *arg)
+{
+	const char *label;
+	int index, rp, n, param, ofs;
+
+	index = cur_index;
+	rp = return_point;
+	for (n = 0; n < max && index >= 0 && index < cmd_size; n++) {
+		/* このコマンドのアセットを列挙する */
+		if (!enum_command_assets(index, func, arg))
+			return;
+
+		switch (cmd[index].type) {
+		case COMMAND_GOTO:
+		case COMMAND_GOSUB:
+			/* $LOAD, $SAVEなどの特殊なラベルでは止まる */
+			param = cmd[index].type == COMMAND_GOTO ?
+				GOTO_PARAM_LABEL : GOSUB_PARAM_LABEL;
+			if (param >= cmd[index].param_count)
+				return;
+			ofs = param_tbl[cmd[index].param + param];
+			if (ofs == NO_PARAM)
+				return;
+			label = arena + ofs;
+			if (label[0] == '$')
+				return;
+			if (cmd[index].type == COMMAND_GOSUB)
+				rp = index;
+			index = find_label(label);
+			if (index == NO_LABEL)
+				return;
+			index++;
+			break;
+		case COMMAND_RETURN:
+			if (rp == -1)
+				return;
+			index = rp + 1;
+			rp = -1;
+			break;
+		case COMMAND_IF:
+		case COMMAND_SELECT:
+		case COMMAND_LOAD:
+		case COMMAND_MENU:
+		case COMMAND_NEWS:
+		case COMMAND_SWITCH:
+		case COMMAND_RETROSPECT:
+			/* 分岐先はわからないので止まる */
+			return;
+		default:
+			index++;
+			break;
+		}
+	}
+}
+
+/*
+ * スクリプトファイルを読み込んでアセット参照を列挙する
+ *  - 実行中のスクリプトを変更しないので、別スレッドから呼び出せる
+ *  - ファイルが存在することは呼び出し元で確認しておくこと
+ */
+bool scan_script_assets(const char *fname, asset_func func, void *arg)
+{
+	const char *tok[PARAM_SIZE];
+	struct rfile *rf;
+	char *buf, *save;
+	const char *file;
+	int i, insn, type, count;
+	bool stop;
+
+	/* ファイルをオープンする */
+	rf = open_rfile(SCRIPT_DIR, fname, false);
+	if (rf == NULL)
+		return false;
+	buf = malloc(LINE_BUF_SIZE);
+	if (buf == NULL) {
+		log_memory();
+		close_rfile(rf);
+		return false;
+	}
+
+	/* 行ごとに処理する */
+	stop = false;
+	while (!stop && gets_rfile(rf, buf, LINE_BUF_SIZE) != NULL) {
+		/* 命令行とセリフ行の引数を取得する */
+		if (buf[0] == '@') {
+			tok[0] = strtok_escape(buf, &save);
+			for (count = 1; count < PARAM_SIZE; count++) {
+				tok[count] = strtok_escape(NULL, &save);
+				if (tok[count] == NULL)
+					break;
+			}
+			insn = get_insn_index(tok[0]);
+			if (insn == -1)
+				continue;
+			type = insn_tbl[insn].type;
+		} else if (buf[0] == '*') {
+			tok[SERIF_PARAM_VOICE] = get_serif_voice(buf);
+			if (tok[SERIF_PARAM_VOICE] == NULL)
+				continue;
+			type = COMMAND_SERIF;
+			count = SERIF_PARAM_VOICE + 1;
+		} else {
+			continue;
+		}
+
+		/* アセットを参照する引数を列挙する */
+		for (i = 0; i < (int)ASSET_PARAM_TBL_SIZE; i++) {
+			if (asset_param_tbl[i].type != type ||
+			    asset_param_tbl[i].index >= count)
+				continue;
+			file = get_asset_file_name(
+				tok[asset_param_tbl[i].index]);
+			if (file == NULL)
+				continue;
+			if (!func(asset_param_tbl[i].dir, file, arg)) {
+				stop = true;
+				break;
+			}
+		}
+	}
+
+	free(buf);
+	close_rfile(rf);
+	return true;
+}
+
+/* コマンドのアセット参照を列挙する(中止された場合は偽を返す) */
+static bool enum_command_assets(int index, asset_func func, void *arg)
+{
+	struct command *c;
+	const char *file;
+	int i, ofs;
+
+	c = &cmd[index];
+	for (i = 0; i < (int)ASSET_PARAM_TBL_SIZE; i++) {
+		if (asset_param_tbl[i].type != c->type ||
+		    asset_param_tbl[i].index >= c->param_count)
+			continue;
+		ofs = param_tbl[c->param + asset_param_tbl[i].index];
+		if (ofs == NO_PARAM)
+			continue;
+		file = get_asset_file_name(arena + ofs);
+		if (file == NULL)
+			continue;
+		if (!func(asset_param_tbl[i].dir, file, arg))
+			return false;
+	}
+
+	return true;
+}
+
+/* 引数からファイル名を取得する(ファイルを参照しない指定ならNULLを返す) */
+static const char *get_asset_file_name(const char *param)
+{
+	/* ボイスのリピート指定を取り除く */
+	if (param[0] == '@')
+		param++;
+
+	/* 省略、色指定、消去、停止、変更なしの指定 */
+	if (param[0] == '\0' || param[0] == '#' ||
+	    strcmp(param, "none") == 0 || strcmp(param, "stop") == 0 ||
+	    strcmp(param, "stay") == 0)
+		return NULL;
+
+	return param;
+}
+
+/* セリフ行からボイスを取得する(ボイスがなければNULLを返す) */
+static char *get_serif_voice(char *buf)
+{
+	char *tok[3];
+	char *p;
+	int n;
+
+	/* parse_serif()のstrtok()と同じく'*'で区切る */
+	p = &buf[1];
+	for (n = 0; n < 3; n++) {
+		while (*p == '*')
+			p++;
+		if (*p == '\0')
+			break;
+		tok[n] = p;
+		while (*p != '\0' && *p != '*')
+			p++;
+		if (*p == '*')
+			*p++ = '\0';
+	}
+
+	/* トークンが3つある場合のみ2番目がボイスになる */
+	return n == 3 ? tok[1] : NULL;
+}
+
+#ifdef USE_PREFETCH_THREAD
+/* 最初の@loadで読み込まれるスクリプトを先読みする */
+static void prefetch_next_script(void)
+{
+	int i;
+
+	for (i = 0; i < cmd_size; i++) {
+		if (cmd[i].type == COMMAND_LOAD &&
+		    cmd[i].param_count > LOAD_PARAM_FILE) {
+			request_prefetch_script(arena +
+				param_tbl[cmd[i].param + LOAD_PARAM_FILE]);
+			return;
+		}
+	}
+}
+#endif
+
+/*
+ * コンパイル済みスクリプトの読み込み
+ */
+
+/*
+ * コンパイル済みスクリプトを読み込む
+ *  - テキストとコンパイル済みスクリプトが共にパッケージ内にある場合のみ用いる
+ *  - 用いることができない場合はfalseを返し、*errorをfalseにする
+ *  - スクリプトのエラーの場合はfalseを返し、*errorをtrueにする
+ */
+static bool read_compiled_script(const char *fname, bool *error)
+{
+	char bin_name[COMPILED_NAME_SIZE];
+	struct rfile *rf;
+	const uint8_t *data;
+	uint8_t *buf;
+	size_t size;
+	bool result;
+
+	*error = false;
+
+	/* ファイルシステム上のテキストがあればそちらを優先する */
+	if (strlen(fname) + strlen(COMPILED_SCRIPT_EXT) >= sizeof(bin_name))
+		return false;
+	snprintf(bin_name, sizeof(bin_name), "%s%s", fname,
+		 COMPILED_SCRIPT_EXT);
+	if (!is_packaged_file(SCRIPT_DIR, fname) ||
+	    !is_packaged_file(SCRIPT_DIR, bin_name))
+		return false;
+
+	/* ファイルをオープンする */
+	rf = open_rfile(SCRIPT_DIR, bin_name, false);
+	if (rf == NULL)
+		return false;
+
+	/* マップされていれば直接参照し、そうでなければ一度に読み込む */
+	buf = NULL;
+	data = get_rfile_data(rf, &size);
+	if (data == NULL) {
+		size = get_rfile_size(rf);
+		buf = malloc(size > 0 ? size : 1);
+		if (buf == NULL) {
+			log_memory();
+			close_rfile(rf);
+			return false;
+		}
+		if (read_rfile(rf, buf, size) != size) {
+			free(buf);
+			close_rfile(rf);
+			return false;
+		}
+		data = buf;
+	}
+
+	/* コマンド配列、引数テーブル、文字列アリーナを復元する */
+	result = decode_compiled_script(data, size);
+	if (buf != NULL)
+		free(buf);
+	close_rfile(rf);
+	if (!result) {
+		/* 不正なデータの場合はテキストを構文解析させる */
+		free_commands();
+		return false;
+	}
+
+	/* 命令のタイプを求め、ラベルを登録する */
+	if (!setup_compiled_script(fname)) {
+		*error = true;
+		return false;
+	}
+
+	return true;
+}
+
+/* コンパイル済みスクリプトを検証してコマンド配列などに展開する */
+static bool decode_compiled_script(const uint8_t *data, size_t size)
+{
+	struct command *c;
+	const uint8_t *p;
+	const char *text;
+	uint32_t cmd_count, param_count, arena_len;
+	int i, ofs;
+
+	/* ヘッダをチェックする */
+	if (size < COMPILED_HEADER_SIZE)
+		return false;
+	if (memcmp(data, COMPILED_MAGIC, COMPILED_MAGIC_SIZE) != 0)
+		return false;
+	if (get_u32(data + COMPILED_MAGIC_SIZE) != COMPILED_VERSION)
+		return false;
+	cmd_count = get_u32(data + COMPILED_MAGIC_SIZE + 4);
+	param_count = get_u32(data + COMPILED_MAGIC_SIZE + 8);
+	arena_len = get_u32(data + COMPILED_MAGIC_SIZE + 12);
+	if (cmd_count > INT_MAX / COMPILED_CMD_SIZE ||
+	    param_count > INT_MAX / 4 ||
+	    arena_len == 0 || arena_len > INT_MAX)
+		return false;
+	if ((uint64_t)size != (uint64_t)COMPILED_HEADER_SIZE +
+	    (uint64_t)cmd_count * COMPILED_CMD_SIZE +
+	    (uint64_t)param_count * 4 + (uint64_t)arena_len)
+		return false;
+
+	/* 配列を確保する */
+	cmd = malloc(sizeof(struct command) *
+		     (cmd_count > 0 ? cmd_count : 1));
+	param_tbl = malloc(sizeof(int) * (param_count > 0 ? param_count : 1));
+	param_val = malloc(sizeof(struct param_value) *
+			   (param_count > 0 ? param_count : 1));
+	arena = malloc(arena_len);
+	if (cmd == NULL || param_tbl == NULL || param_val == NULL ||
+	    arena == NULL) {
+		log_memory();
+		return false;
+	}
+	cmd_alloc_size = (int)cmd_count;
+	param_tbl_alloc_size = (int)param_count;
+	arena_alloc_size = arena_len;
+
+	/* 文字列アリーナを復元する */
+	p = data + COMPILED_HEADER_SIZE + cmd_count * COMPILED_CMD_SIZE +
+		param_count * 4;
+	memcpy(arena, p, arena_len);
+	if (arena[arena_len - 1] != '\0')
+		return false;
+	arena_size = arena_len;
+
+	/* 引数テーブルを復元する */
+	p = data + COMPILED_HEADER_SIZE + cmd_count * COMPILED_CMD_SIZE;
+	for (i = 0; i < (int)param_count; i++, p += 4) {
+		ofs = (int)get_u32(p);
+		if (ofs != NO_PARAM && (ofs < 0 || ofs >= (int)arena_len))
+			return false;
+		param_tbl[i] = ofs;
+	}
+	param_tbl_size = (int)param_count;
+
+	/* コマンド配列を復元する */
+	p = data + COMPILED_HEADER_SIZE;
+	for (i = 0; i < (int)cmd_count; i++, p += COMPILED_CMD_SIZE) {
+		c = &cmd[i];
+		c->type = COMMAND_MIN;
+		c->line = (int)get_u32(p);
+		c->text = (int)get_u32(p + 4);
+		c->param = (int)get_u32(p + 8);
+		c->param_count = (int)get_u32(p + 12);
+		if (c->line < 0 || c->text < 0 || c->text >= (int)arena_len ||
+		    c->param < 0 || c->param_count < 0 ||
+		    c->param_count > PARAM_SIZE ||
+		    c->param > (int)param_count - c->param_count)
+			return false;
+
+		/* 行の種類ごとに引数の形をチェックする */
+		text = arena + c->text;
+		switch (text[0]) {
+		case '\0':
+		case '#':
+			return false;
+		case '@':
+		case ':':
+			if (c->param_count == 0 ||
+			    param_tbl[c->param] == NO_PARAM)
+				return false;
+			if (text[0] == ':' && c->param_count != 1)
+				return false;
+			break;
+		case '*':
+			if (c->param_count != 4)
+				return false;
+			break;
+		default:
+			if (c->param_count != 0)
+				return false;
+			break;
+		}
+	}
+	cmd_size = (int)cmd_count;
+
+	return true;
+}
+
+/* 復元したコマンドのタイプを求め、引数とラベルを準備する */
+static bool setup_compiled_script(const char *fname)
+{
+	struct command *c;
+	const char *text;
+	int i, j;
+
+	for (i = 0; i < cmd_size; i++) {
+		c = &cmd[i];
+		text = arena + c->text;
+
+		/* 型付きの値に変換しておく */
+		for (j = 0; j < c->param_count; j++)
+			set_param_value(c->param + j);
+
+		/* 行頭の文字で仕分けする */
+		switch (text[0]) {
+		case '@':
+			if (!setup_insn(i, fname, c->line, text))
+				return false;
+			break;
+		case '*':
+			c->type = COMMAND_SERIF;
+			break;
+		case ':':
+			c->type = COMMAND_LABEL;
+			if (!register_label(i, fname, c->line, text))
+				return false;
+			break;
+		default:
+			c->type = COMMAND_MESSAGE;
+			break;
+		}
+	}
+
+	return true;
+}
+
+/* リトルエンディアンの32ビット値を取得する */
+static uint32_t get_u32(const uint8_t *p)
+{
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+		((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
 }
 
 /*
@@ -442,9 +1132,8 @@ static bool read_script_from_file(const char *fname)
 		if (gets_rfile(rf, buf, sizeof(buf)) == NULL)
 			break;
 
-		/* 最大コマンド数をチェックする */
-		if (line >= SCRIPT_CMD_SIZE) {
-			log_script_size(SCRIPT_CMD_SIZE);
+		/* コマンド配列に空きを確保する */
+		if (!reserve_command()) {
 			result = false;
 			break;
 		}
@@ -495,86 +1184,118 @@ static bool read_script_from_file(const char *fname)
 static bool parse_insn(int index, const char *file, int line, const char *buf)
 {
 	struct command *c;
-	char *tp;
-	int i, min = 0, max = 0;
+	char *tp, *save;
+	int i, top;
 
 	c = &cmd[index];
 
 	/* 行番号とオリジナルの行を保存しておく */
 	c->line = line;
-	c->text = strdup(buf);
-	if (c->text == NULL) {
-		log_memory();
+	c->text = add_string(buf);
+	if (c->text == -1)
 		return false;
-	}
 
 	/* トークン化する文字列を複製する */
-	c->param[0] = strdup(buf);
-	if (c->param[0] == NULL) {
-		log_memory();
+	top = add_string(buf);
+	if (top == -1)
 		return false;
-	}
 
-	/* 最初のトークンを切り出す */
-	strtok_escape(c->param[0]);
-
-	/* コマンドのタイプを取得する */
-	for (i = 0; i < (int)INSN_TBL_SIZE; i++) {
-		if (strcmp(c->param[0], insn_tbl[i].str) == 0) {
-			c->type = insn_tbl[i].type;
-			min = insn_tbl[i].min;
-			max = insn_tbl[i].max;
-			break;
-		}
-	}
-	if (i == INSN_TBL_SIZE) {
-		log_script_command_not_found(c->param[0]);
-		log_script_parse_footer(file, line, buf);
+	/* 最初のトークンを切り出す(アリーナ内でトークン化する) */
+	strtok_escape(arena + top, &save);
+	if (!add_param(index, top))
 		return false;
-	}
 
 	/* 2番目以降のトークンを取得する */
 	i = 1;
-	while ((tp = strtok_escape(NULL))  != NULL && i < PARAM_SIZE) {
-		c->param[i] = tp;
+	while ((tp = strtok_escape(NULL, &save))  != NULL && i < PARAM_SIZE) {
+		if (!add_param(index, (int)(tp - arena)))
+			return false;
 		i++;
 	}
 
+	/* コマンドのタイプを求め、パラメータの数をチェックする */
+	return setup_insn(index, file, line, buf);
+}
+
+/* 命令のタイプを求め、パラメータの数をチェックする */
+static bool setup_insn(int index, const char *file, int line, const char *buf)
+{
+	struct command *c;
+	const char *name;
+	int i, n, min, max;
+
+	c = &cmd[index];
+
+	/* コマンドのタイプを取得する */
+	name = arena + param_tbl[c->param];
+	i = get_insn_index(name);
+	if (i == -1) {
+		log_script_command_not_found(name);
+		log_script_parse_footer(file, line, buf);
+		return false;
+	}
+	c->type = insn_tbl[i].type;
+	min = insn_tbl[i].min;
+	max = insn_tbl[i].max;
+
 	/* パラメータの数をチェックする */
-	if (i - 1 < min) {
-		log_script_too_few_param(min, i - 1);
+	n = c->param_count - 1;
+	if (n < min) {
+		log_script_too_few_param(min, n);
 		log_script_parse_footer(file, line, buf);
 		return false;
 	}
-	if (i - 1 > max) {
-		log_script_too_many_param(max, i - 1);
+	if (n > max) {
+		log_script_too_many_param(max, n);
 		log_script_parse_footer(file, line, buf);
 		return false;
 	}
 
+	/* フェードメソッドの引数を変換しておく */
+	for (i = 0; i < (int)FADE_METHOD_PARAM_TBL_SIZE; i++) {
+		if (fade_method_param_tbl[i].type != c->type ||
+		    fade_method_param_tbl[i].index >= c->param_count)
+			continue;
+		param_val[c->param + fade_method_param_tbl[i].index].method =
+			get_fade_method(arena + param_tbl[c->param +
+				fade_method_param_tbl[i].index]);
+	}
+
 	return true;
 }
 
-/* ダブルクォーテーションでエスケープ可能なトークナイズを実行する */
-static char *strtok_escape(char *buf)
+/* 命令名から命令テーブルのインデックスを求める(なければ-1を返す) */
+static int get_insn_index(const char *name)
 {
-	static char *top = NULL;
+	int i;
+
+	for (i = 0; i < (int)INSN_TBL_SIZE; i++)
+		if (strcmp(name, insn_tbl[i].str) == 0)
+			return i;
+
+	return -1;
+}
+
+/*
+ * ダブルクォーテーションでエスケープ可能なトークナイズを実行する
+ *  - strtok_r()と同様に、続きの位置をsaveに保存する
+ */
+static char *strtok_escape(char *buf, char **save)
+{
+	char *top;
 	char *result;
 
-	/* 初回呼び出しの場合バッファを保存する */
-	if (buf != NULL)
-		top = buf;
+	/* 初回呼び出しの場合バッファを先頭とする */
+	top = buf != NULL ? buf : *save;
 	assert(top != NULL);
 
-	/* すでにバッファの終端に達している場合NULLを返す */
-	if (*top == '\0')
-		return NULL;
-
 	/* 先頭のスペースをスキップする */
 	for (; *top != '\0' && *top == ' '; top++)
 		;
-	if (*top == '\0')
+	if (*top == '\0') {
+		*save = top;
 		return NULL;
+	}
 
 	/* エスケープされている場合 */
 	if (*top == '\"') {
@@ -583,6 +1304,7 @@ static char *strtok_escape(char *buf)
 			;
 		if (*top == '\"')
 			*top++ = '\0';
+		*save = top;
 		return result;
 	}
 	
@@ -592,6 +1314,7 @@ static char *strtok_escape(char *buf)
 		;
 	if (*top == ' ')
 		*top++ = '\0';
+	*save = top;
 	return result;
 }
 
@@ -599,27 +1322,24 @@ static char *strtok_escape(char *buf)
 static bool parse_serif(int index, const char *file, int line, const char *buf)
 {
 	char *first, *second, *third;
+	int top;
 
 	assert(buf[0] == '*');
 
 	/* 行番号とオリジナルの行を保存しておく */
 	cmd[index].type = COMMAND_SERIF;
 	cmd[index].line = line;
-	cmd[index].text = strdup(buf);
-	if (cmd[index].text == NULL) {
-		log_memory();
+	cmd[index].text = add_string(buf);
+	if (cmd[index].text == -1)
 		return false;
-	}
 
 	/* トークン化する文字列を複製する */
-	cmd[index].param[SERIF_PARAM_PTR] = strdup(&buf[1]);
-	if (cmd[index].param[0] == NULL) {
-		log_memory();
+	top = add_string(&buf[1]);
+	if (top == -1)
 		return false;
-	}
 
 	/* トークンを取得する(2つか3つある) */
-	first = strtok(cmd[index].param[0], "*");
+	first = strtok(arena + top, "*");
 	second = strtok(NULL, "*");
 	third = strtok(NULL, "*");
 	if (first == NULL || second == NULL) {
@@ -629,14 +1349,20 @@ static bool parse_serif(int index, const char *file, int line, const char *buf)
 	}
 
 	/* トークンの数で場合分けする */
+	if (!add_param(index, top))
+		return false;
+	if (!add_param(index, (int)(first - arena)))
+		return false;
 	if (third != NULL) {
-		cmd[index].param[SERIF_PARAM_NAME] = first;
-		cmd[index].param[SERIF_PARAM_VOICE] = second;
-		cmd[index].param[SERIF_PARAM_MESSAGE] = third;
+		if (!add_param(index, (int)(second - arena)))
+			return false;
+		if (!add_param(index, (int)(third - arena)))
+			return false;
 	} else {
-		cmd[index].param[SERIF_PARAM_NAME] = first;
-		cmd[index].param[SERIF_PARAM_VOICE] = NULL;
-		cmd[index].param[SERIF_PARAM_MESSAGE] = second;
+		if (!add_param(index, NO_PARAM))
+			return false;
+		if (!add_param(index, (int)(second - arena)))
+			return false;
 	}
 
 	/* 成功 */
@@ -652,11 +1378,9 @@ static bool parse_message(int index, const char *file, int line,
 	/* 行番号とオリジナルの行(メッセージ全体)を保存しておく */
 	cmd[index].type = COMMAND_MESSAGE;
 	cmd[index].line = line;
-	cmd[index].text = strdup(buf);
-	if (cmd[index].text == NULL) {
-		log_memory();
+	cmd[index].text = add_string(buf);
+	if (cmd[index].text == -1)
 		return false;
-	}
 
 	/* 成功 */
 	return true;
@@ -665,24 +1389,297 @@ static bool parse_message(int index, const char *file, int line,
 /* ラベル行をパースする */
 static bool parse_label(int index, const char *file, int line, const char *buf)
 {
-	UNUSED_PARAMETER(file);
+	int ofs;
 
 	/* 行番号とオリジナルの行(メッセージ全体)を保存しておく */
 	cmd[index].type = COMMAND_LABEL;
 	cmd[index].line = line;
-	cmd[index].text = strdup(buf);
-	if (cmd[index].text == NULL) {
-		log_memory();
+	cmd[index].text = add_string(buf);
+	if (cmd[index].text == -1)
 		return false;
-	}
 
 	/* ラベルを保存する */
-	cmd[index].param[LABEL_PARAM_LABEL] = strdup(&buf[1]);
-	if (cmd[index].param[LABEL_PARAM_LABEL] == NULL) {
-		log_memory();
+	ofs = add_string(&buf[1]);
+	if (ofs == -1)
+		return false;
+	if (!add_param(index, ofs))
+		return false;
+
+	/* ラベルをハッシュテーブルに登録する */
+	return register_label(index, file, line, buf);
+}
+
+/* ラベルの重複をチェックし、ハッシュテーブルに登録する */
+static bool register_label(int index, const char *file, int line,
+			   const char *buf)
+{
+	const char *label;
+
+	/* ラベルの重複をチェックする */
+	label = get_label_name(index);
+	if (find_label(label) != NO_LABEL) {
+		log_script_duplicate_label(label);
+		log_script_parse_footer(file, line, buf);
 		return false;
 	}
 
+	/* ラベルをハッシュテーブルに登録する */
+	if (!add_label(index))
+		return false;
+
 	/* 成功 */
 	return true;
 }
+
+/*
+ * コマンド配列と文字列アリーナの管理
+ */
+
+/* コマンド配列、引数テーブル、文字列アリーナ、ラベルを解放する */
+static void free_commands(void)
+{
+	/* コマンド配列を解放する */
+	if (cmd != NULL) {
+		free(cmd);
+		cmd = NULL;
+	}
+	cmd_size = 0;
+	cmd_alloc_size = 0;
+
+	/* 引数テーブルを解放する */
+	if (param_tbl != NULL) {
+		free(param_tbl);
+		param_tbl = NULL;
+	}
+	if (param_val != NULL) {
+		free(param_val);
+		param_val = NULL;
+	}
+	param_tbl_size = 0;
+	param_tbl_alloc_size = 0;
+
+	/* 文字列アリーナを解放する */
+	if (arena != NULL) {
+		free(arena);
+		arena = NULL;
+	}
+	arena_size = 0;
+	arena_alloc_size = 0;
+
+	/* ラベルのハッシュテーブルを解放する */
+	if (label_tbl != NULL) {
+		free(label_tbl);
+		label_tbl = NULL;
+	}
+	label_tbl_size = 0;
+	label_count = 0;
+}
+
+/* コマンド配列の末尾に空きのコマンドを確保する */
+static bool reserve_command(void)
+{
+	struct command *p;
+	int size;
+
+	/* 必要なら配列を倍に伸長する */
+	if (cmd_size == cmd_alloc_size) {
+		size = cmd_alloc_size == 0 ? CMD_INIT_SIZE :
+			cmd_alloc_size * 2;
+		p = realloc(cmd, sizeof(struct command) * (size_t)size);
+		if (p == NULL) {
+			log_memory();
+			return false;
+		}
+		cmd = p;
+		cmd_alloc_size = size;
+	}
+
+	/* 引数なしのコマンドとして初期化する */
+	cmd[cmd_size].type = COMMAND_MIN;
+	cmd[cmd_size].line = 0;
+	cmd[cmd_size].text = -1;
+	cmd[cmd_size].param = param_tbl_size;
+	cmd[cmd_size].param_count = 0;
+	return true;
+}
+
+/* コマンドに引数を追加する(ofsはアリーナ内のオフセットかNO_PARAM) */
+static bool add_param(int index, int ofs)
+{
+	struct param_value *v;
+	int *p;
+	int size;
+
+	/* 引数は最後に確保されたコマンドにのみ追加できる */
+	assert(index == cmd_size);
+	assert(cmd[index].param + cmd[index].param_count == param_tbl_size);
+
+	/* 必要ならテーブルを倍に伸長する */
+	if (param_tbl_size == param_tbl_alloc_size) {
+		size = param_tbl_alloc_size == 0 ? PARAM_TBL_INIT_SIZE :
+			param_tbl_alloc_size * 2;
+		p = realloc(param_tbl, sizeof(int) * (size_t)size);
+		if (p == NULL) {
+			log_memory();
+			return false;
+		}
+		param_tbl = p;
+		v = realloc(param_val, sizeof(struct param_value) *
+			    (size_t)size);
+		if (v == NULL) {
+			log_memory();
+			return false;
+		}
+		param_val = v;
+		param_tbl_alloc_size = size;
+	}
+
+	/* 型付きの値に変換しておく */
+	param_tbl[param_tbl_size] = ofs;
+	set_param_value(param_tbl_size);
+
+	param_tbl_size++;
+	cmd[index].param_count++;
+	return true;
+}
+
+/* 引数テーブルのn番目の引数を型付きの値に変換する */
+static void set_param_value(int n)
+{
+	struct param_value *v;
+	const char *s;
+
+	s = param_tbl[n] == NO_PARAM ? "" : arena + param_tbl[n];
+	v = &param_val[n];
+	v->i = atoi(s);
+	v->f = (float)atof(s);
+	v->is_var = s[0] == '$' && s[1] != '\0';
+	v->var = v->is_var ? atoi(&s[1]) : -1;
+	v->method = FADE_METHOD_INVALID;
+}
+
+/*
+ * 文字列アリーナに文字列を追加する
+ *  - アリーナは伸長の際に移動するので、オフセットを返す
+ *  - 失敗した場合は-1を返す
+ */
+static int add_string(const char *str)
+{
+	char *p;
+	size_t len, size;
+
+	len = strlen(str) + 1;
+
+	/* 必要ならアリーナを倍に伸長する */
+	if (arena_size + len > arena_alloc_size) {
+		size = arena_alloc_size == 0 ? ARENA_INIT_SIZE :
+			arena_alloc_size;
+		while (arena_size + len > size)
+			size *= 2;
+		if (size > INT_MAX) {
+			log_memory();
+			return -1;
+		}
+		p = realloc(arena, size);
+		if (p == NULL) {
+			log_memory();
+			return -1;
+		}
+		arena = p;
+		arena_alloc_size = size;
+	}
+
+	memcpy(arena + arena_size, str, len);
+	arena_size += len;
+	return (int)(arena_size - len);
+}
+
+/*
+ * ラベルのハッシュテーブル
+ */
+
+/* ラベルコマンドをハッシュテーブルに登録する */
+static bool add_label(int index)
+{
+	int *tbl;
+	int i, size;
+	uint32_t h;
+
+	/* 使用率が半分を超える場合はテーブルを倍に伸長する */
+	if ((label_count + 1) * 2 > label_tbl_size) {
+		size = label_tbl_size == 0 ? LABEL_TBL_INIT_SIZE :
+			label_tbl_size * 2;
+		tbl = malloc(sizeof(int) * (size_t)size);
+		if (tbl == NULL) {
+			log_memory();
+			return false;
+		}
+		for (i = 0; i < size; i++)
+			tbl[i] = NO_LABEL;
+
+		/* 登録済みのラベルを移し替える */
+		for (i = 0; i < label_tbl_size; i++) {
+			if (label_tbl[i] == NO_LABEL)
+				continue;
+			h = hash_label(get_label_name(label_tbl[i])) &
+				(uint32_t)(size - 1);
+			while (tbl[h] != NO_LABEL)
+				h = (h + 1) & (uint32_t)(size - 1);
+			tbl[h] = label_tbl[i];
+		}
+
+		free(label_tbl);
+		label_tbl = tbl;
+		label_tbl_size = size;
+	}
+
+	/* 空きスロットに登録する */
+	h = hash_label(get_label_name(index)) & (uint32_t)(label_tbl_size - 1);
+	while (label_tbl[h] != NO_LABEL)
+		h = (h + 1) & (uint32_t)(label_tbl_size - 1);
+	label_tbl[h] = index;
+	label_count++;
+
+	return true;
+}
+
+/* ラベルコマンドのインデックスを探す(みつからなければNO_LABELを返す) */
+static int find_label(const char *label)
+{
+	uint32_t h;
+	int i;
+
+	if (label_tbl_size == 0)
+		return NO_LABEL;
+
+	h = hash_label(label) & (uint32_t)(label_tbl_size - 1);
+	while ((i = label_tbl[h]) != NO_LABEL) {
+		if (strcmp(get_label_name(i), label) == 0)
+			return i;
+		h = (h + 1) & (uint32_t)(label_tbl_size - 1);
+	}
+
+	return NO_LABEL;
+}
+
+/* ラベルコマンドのラベル名を取得する */
+static const char *get_label_name(int index)
+{
+	assert(cmd[index].type == COMMAND_LABEL);
+
+	return arena + param_tbl[cmd[index].param + LABEL_PARAM_LABEL];
+}
+
+/* ラベル名のハッシュ値を求める(FNV-1a) */
+static uint32_t hash_label(const char *label)
+{
+	uint32_t h;
+
+	h = 2166136261U;
+	while (*label) {
+		h ^= (uint8_t)*label++;
+		h *= 16777619U;
+	}
+
+	return h;
+}
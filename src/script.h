@@ -25,12 +25,15 @@
 
 #include "types.h"
 
-/* コマンドの最大数 */
-#define SCRIPT_CMD_SIZE	(65536)
+/* コンパイル済みスクリプトのファイル名の拡張子 */
+#define COMPILED_SCRIPT_EXT	".suika"
 
 /* コマンド構造体 */
 struct command;
 
+/* アセット参照を列挙するコールバック(偽を返すと列挙を中止する) */
+typedef bool (*asset_func)(const char *dir, const char *file, void *arg);
+
 /* コマンドの種類 */
 enum command_type {
 	COMMAND_MIN,		/* invalid value */
@@ -492,12 +495,18 @@ void cleanup_script(void);
 /* スクリプトをロードする */
 bool load_script(const char *fname);
 
+/* スクリプトをロードした回数を取得する */
+int get_script_load_count(void);
+
 /* スクリプトファイル名を取得する */
 const char *get_script_file_name(void);
 
 /* 実行中のコマンドのインデックスを取得する(セーブ用) */
 int get_command_index(void);
 
+/* スクリプトのコマンド数を取得する(既読フラグ用) */
+int get_command_count(void);
+
 /* 実行中のコマンドのインデックスを設定する(gosub,ロード用) */
 bool move_to_command_index(int index);
 
@@ -540,4 +549,29 @@ int get_int_param(int index);
 /* 浮動小数点数のコマンドパラメータを取得する */
 float get_float_param(int index);
 
+/* フェードメソッドのコマンドパラメータを取得する */
+int get_fade_method_param(int index);
+
+/* コマンドパラメータが変数("$n"の形式)であるかを調べる */
+bool is_var_param(int index);
+
+/* 変数のコマンドパラメータの変数番号を取得する(変数でなければ-1) */
+int get_var_index_param(int index);
+
+/*
+ * アセットの参照
+ */
+
+/* スクリプト全体のアセット参照を列挙する */
+void enum_script_assets(asset_func func, void *arg);
+
+/* ラベルから次のラベルまでのアセット参照を列挙する */
+bool enum_label_assets(const char *label, asset_func func, void *arg);
+
+/* スクリプトファイルを読み込んでアセット参照を列挙する(別スレッド可) */
+bool scan_script_assets(const char *fname, asset_func func, void *arg);
+
+/* 実行位置から先のアセット参照を実行順に列挙する */
+void enum_lookahead_assets(int max, asset_func func, void *arg);
+
 #endif
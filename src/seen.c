@@ -16,10 +16,56 @@
 
 #include "suika.h"
 
-/* 既読フラグ */
-bool seen_flag[SCRIPT_CMD_SIZE];
+/*
+ * 既読フラグ
+ *  - すべてのスクリプトの既読フラグをまとめて1つのファイルに保存する
+ *  - スクリプトごとにコマンド数のビット列を持つ
+ *  - 変更があった場合のみファイルに書き込む
+ *
+ * ファイルフォーマット(整数はネイティブのint32_t)
+ *  - スクリプトごとに以下を繰り返す
+ *    - ファイル名の長さ、ファイル名(終端なし)
+ *    - コマンド数、ビット列((コマンド数 + 7) / 8バイト)
+ */
+
+/* 既読フラグのファイル名 */
+#define SEEN_FILE		"seen.sav"
+
+/* 書き込み中の既読フラグファイル名(書き込めたらSEEN_FILEに置き換える) */
+#define SEEN_TMP_FILE		"seen.tmp"
+
+/* 旧形式の既読フラグのサイズ(スクリプトごとのファイル) */
+#define OLD_SEEN_FLAG_SIZE	(65536)
+
+/* ファイル名の長さの上限 */
+#define SEEN_NAME_MAX		(1024)
+
+/* 1スクリプトの既読フラグ */
+struct seen_script {
+	char *name;		/* スクリプトファイル名 */
+	int count;		/* コマンド数 */
+	unsigned char *bits;	/* 既読フラグのビット列 */
+};
+
+/* スクリプトごとの既読フラグ */
+static struct seen_script *seen_tbl;
+static int seen_count;
+static int seen_alloc_count;
+
+/* 実行中のスクリプトの既読フラグ(ない場合はNULL) */
+static struct seen_script *cur_seen;
+
+/* 最後にセーブしてから変更されたか */
+static bool is_dirty;
 
 /* 前方参照 */
+static void load_seen_file(void);
+static bool read_seen_script(struct rfile *rf);
+static struct seen_script *find_seen_script(const char *name);
+static struct seen_script *add_seen_script(const char *name, int count,
+					   unsigned char *bits);
+static bool resize_bits(struct seen_script *s, int count);
+static void load_old_seen_file(struct seen_script *s);
 static const char *hash(const char *file);
 static char hex(int c);
 
@@ -28,7 +74,16 @@ static char hex(int c);
  */
 bool init_seen(void)
 {
-	/* 既読フラグをロードする */
+	seen_tbl = NULL;
+	seen_count = 0;
+	seen_alloc_count = 0;
+	cur_seen = NULL;
+	is_dirty = false;
+
+	/* すべてのスクリプトの既読フラグを読み込む */
+	load_seen_file();
+
+	/* 実行中のスクリプトの既読フラグを選択する */
 	load_seen();
 
 	return true;
@@ -39,84 +94,117 @@ bool init_seen(void)
  */
 void cleanup_seen(void)
 {
+	int i;
+
 	/* 既読フラグをセーブする */
 	save_seen();
+
+	for (i = 0; i < seen_count; i++) {
+		free(seen_tbl[i].name);
+		free(seen_tbl[i].bits);
+	}
+	free(seen_tbl);
+	seen_tbl = NULL;
+	seen_count = 0;
+	seen_alloc_count = 0;
+	cur_seen = NULL;
 }
 
 /*
  * 現在のスクリプトに対応する既読フラグをロードする
+ *  - ファイルは初期化時に読み込み済みなので、メモリ上で選択する
  */
 bool load_seen(void)
 {
-	struct rfile *rf;
 	const char *fname;
-	bool success;
-
-	/* 読み込む前に全部未読にする */
-	memset(seen_flag, 0, sizeof(seen_flag));
-
-	/* ファイル名を求める */
-	fname = hash(get_script_file_name());
+	int count;
+
+	fname = get_script_file_name();
+	count = get_command_count();
+
+	/* 記録済みの場合 */
+	cur_seen = find_seen_script(fname);
+	if (cur_seen != NULL) {
+		/* スクリプトのコマンド数が変わっていれば合わせる */
+		if (cur_seen->count != count && !resize_bits(cur_seen, count)) {
+			cur_seen = NULL;
+			return false;
+		}
+		return true;
+	}
 
-	/* ファイルを開く */
-	rf = open_rfile(SAVE_DIR, fname, true);
-	if (rf == NULL)
+	/* 新しく追加する */
+	cur_seen = add_seen_script(fname, count, NULL);
+	if (cur_seen == NULL)
 		return false;
 
-	success = false;
-	do {
-		/* 既読フラグを読み込む */
-		if (read_rfile(rf, &seen_flag, sizeof(seen_flag)) <
-		    sizeof(seen_flag))
-			break;
-
-		/* 成功 */
-		success = true;
-	} while (0);
+	/* 旧形式のファイルがあれば引き継ぐ */
+	load_old_seen_file(cur_seen);
 
-	/* ファイルをクローズする */
-	close_rfile(rf);
-
-	/* 読み込みに失敗した場合全部未読にする */
-	if (!success)
-		memset(seen_flag, 0, sizeof(seen_flag));
-
-	return success;
+	return true;
 }
 
 /*
- * 現在のスクリプトに対応する既読フラグをセーブする
+ * 既読フラグをセーブする
+ *  - 前回のセーブから変更がなければ書き込まない
+ *  - すべてのスクリプトの既読フラグが1つのファイルに入っているので、
+ *    一時ファイルに書き込めた場合のみ置き換える
  */
 bool save_seen(void)
 {
 	struct wfile *wf;
-	const char *fname;
+	struct seen_script *s;
+	size_t bytes;
+	int32_t n;
+	int i;
 	bool success;
 
+	if (!is_dirty)
+		return true;
+
 	/* セーブディレクトリを作成する */
 	make_sav_dir();
 
-	/* ファイル名を求める */
-	fname = hash(get_script_file_name());
-
-	/* ファイルを開く */
-	wf = open_wfile(SAVE_DIR, fname);
+	/* 一時ファイルを開く */
+	wf = open_wfile(SAVE_DIR, SEEN_TMP_FILE);
 	if (wf == NULL)
 		return false;
 
-	success = false;
-	do {
-		/* 既読フラグを書き込む */
-		if (write_wfile(wf, &seen_flag, sizeof(seen_flag)) <
-		    sizeof(seen_flag))
-			break;
-
-		/* 成功 */
-		success = true;
-	} while (0);
+	success = true;
+	for (i = 0; i < seen_count && success; i++) {
+		s = &seen_tbl[i];
+		success = false;
+		do {
+			/* ファイル名を書き込む */
+			n = (int32_t)strlen(s->name);
+			if (write_wfile(wf, &n, sizeof(n)) < sizeof(n))
+				break;
+			if (write_wfile(wf, s->name, (size_t)n) < (size_t)n)
+				break;
+
+			/* 既読フラグを書き込む */
+			n = s->count;
+			bytes = (size_t)(s->count + 7) / 8;
+			if (write_wfile(wf, &n, sizeof(n)) < sizeof(n))
+				break;
+			if (write_wfile(wf, s->bits, bytes) < bytes)
+				break;
+
+			success = true;
+		} while (0);
+	}
 
 	/* ファイルをクローズする */
-	close_wfile(wf);
+	if (!close_wfile(wf))
+		success = false;
+
+	/* すべて書き込めた場合のみ、既存のファイルを置き換える */
+	if (success)
+		success = replace_file(SAVE_DIR, SEEN_TMP_FILE, SEEN_FILE);
+
+	/* 失敗した場合は次回もう一度書き込む */
+	if (success)
+		is_dirty = false;
 
 	return success;
 }
@@ -129,9 +217,13 @@ bool get_seen(void)
 	int index;
 
 	index = get_command_index();
-	assert(index >= 0 && index < SCRIPT_CMD_SIZE);
+	assert(index >= 0);
+
+	/* 記録できる範囲外のコマンドは未読とする */
+	if (cur_seen == NULL || index >= cur_seen->count)
+		return false;
 
-	return seen_flag[index];
+	return (cur_seen->bits[index / 8] & (1 << (index % 8))) != 0;
 }
 
 /*
@@ -139,12 +231,209 @@ bool get_seen(void)
  */
 void set_seen(void)
 {
+	unsigned char bit;
 	int index;
 
 	index = get_command_index();
-	assert(index >= 0 && index < SCRIPT_CMD_SIZE);
+	assert(index >= 0);
+
+	/* 記録できる範囲外のコマンドは無視する */
+	if (cur_seen == NULL || index >= cur_seen->count)
+		return;
+
+	/* 変更があった場合のみセーブの対象にする */
+	bit = (unsigned char)(1 << (index % 8));
+	if ((cur_seen->bits[index / 8] & bit) == 0) {
+		cur_seen->bits[index / 8] |= bit;
+		is_dirty = true;
+	}
+}
+
+/* 既読フラグのファイルを読み込む */
+static void load_seen_file(void)
+{
+	struct rfile *rf;
+
+	/* ファイルを開く(なければすべて未読) */
+	rf = open_rfile(SAVE_DIR, SEEN_FILE, true);
+	if (rf == NULL)
+		return;
+
+	/* 壊れたレコードの手前までを用いる */
+	while (read_seen_script(rf))
+		;
+
+	/* ファイルをクローズする */
+	close_rfile(rf);
+}
+
+/* 1スクリプトの既読フラグを読み込む */
+static bool read_seen_script(struct rfile *rf)
+{
+	char name[SEEN_NAME_MAX + 1];
+	unsigned char *bits;
+	size_t bytes;
+	int32_t len, count;
 
-	seen_flag[index] = true;
+	/* ファイル名を読み込む */
+	if (read_rfile(rf, &len, sizeof(len)) < sizeof(len))
+		return false;
+	if (len <= 0 || len > SEEN_NAME_MAX)
+		return false;
+	if (read_rfile(rf, name, (size_t)len) < (size_t)len)
+		return false;
+	name[len] = '\0';
+
+	/* 既読フラグを読み込む */
+	if (read_rfile(rf, &count, sizeof(count)) < sizeof(count))
+		return false;
+	if (count < 0)
+		return false;
+	bytes = (size_t)(count + 7) / 8;
+	bits = malloc(bytes > 0 ? bytes : 1);
+	if (bits == NULL) {
+		log_memory();
+		return false;
+	}
+	if (read_rfile(rf, bits, bytes) < bytes) {
+		free(bits);
+		return false;
+	}
+
+	/* 重複したレコードは無視する */
+	if (find_seen_script(name) != NULL) {
+		free(bits);
+		return true;
+	}
+
+	if (add_seen_script(name, count, bits) == NULL) {
+		free(bits);
+		return false;
+	}
+
+	return true;
+}
+
+/* スクリプトの既読フラグを探す */
+static struct seen_script *find_seen_script(const char *name)
+{
+	int i;
+
+	for (i = 0; i < seen_count; i++)
+		if (strcmp(seen_tbl[i].name, name) == 0)
+			return &seen_tbl[i];
+
+	return NULL;
+}
+
+/*
+ * スクリプトの既読フラグを追加する
+ *  - bitsがNULLの場合はすべて未読で作成する
+ *  - テーブルが伸長されるとcur_seenが無効になるので、選択し直す
+ */
+static struct seen_script *add_seen_script(const char *name, int count,
+					   unsigned char *bits)
+{
+	struct seen_script *tbl, *s;
+	const char *cur_name;
+	size_t bytes;
+	int new_count;
+
+	/* テーブルを伸長する */
+	if (seen_count == seen_alloc_count) {
+		cur_name = cur_seen != NULL ? cur_seen->name : NULL;
+		new_count = seen_alloc_count == 0 ? 16 : seen_alloc_count * 2;
+		tbl = realloc(seen_tbl,
+			      sizeof(struct seen_script) * (size_t)new_count);
+		if (tbl == NULL) {
+			log_memory();
+			return NULL;
+		}
+		seen_tbl = tbl;
+		seen_alloc_count = new_count;
+		if (cur_name != NULL)
+			cur_seen = find_seen_script(cur_name);
+	}
+
+	s = &seen_tbl[seen_count];
+	s->name = strdup(name);
+	if (s->name == NULL) {
+		log_memory();
+		return NULL;
+	}
+	if (bits == NULL) {
+		bytes = (size_t)(count + 7) / 8;
+		bits = calloc(bytes > 0 ? bytes : 1, 1);
+		if (bits == NULL) {
+			log_memory();
+			free(s->name);
+			return NULL;
+		}
+	}
+	s->count = count;
+	s->bits = bits;
+	seen_count++;
+
+	return s;
+}
+
+/* 既読フラグのコマンド数を変更する */
+static bool resize_bits(struct seen_script *s, int count)
+{
+	unsigned char *bits;
+	size_t old_bytes, bytes;
+	int i;
+
+	bytes = (size_t)(count + 7) / 8;
+	old_bytes = (size_t)(s->count + 7) / 8;
+	bits = calloc(bytes > 0 ? bytes : 1, 1);
+	if (bits == NULL) {
+		log_memory();
+		return false;
+	}
+
+	/* 範囲内のフラグを引き継ぐ */
+	memcpy(bits, s->bits, bytes < old_bytes ? bytes : old_bytes);
+	for (i = count; i < (int)bytes * 8; i++)
+		bits[i / 8] &= (unsigned char)~(1 << (i % 8));
+
+	free(s->bits);
+	s->bits = bits;
+	s->count = count;
+	is_dirty = true;
+
+	return true;
+}
+
+/* 旧形式(スクリプトごとのファイル)の既読フラグを読み込む */
+static void load_old_seen_file(struct seen_script *s)
+{
+	struct rfile *rf;
+	unsigned char *flag;
+	int i;
+
+	/* ファイルを開く */
+	rf = open_rfile(SAVE_DIR, hash(s->name), true);
+	if (rf == NULL)
+		return;
+
+	flag = malloc(OLD_SEEN_FLAG_SIZE);
+	if (flag == NULL) {
+		log_memory();
+		close_rfile(rf);
+		return;
+	}
+
+	/* 既読フラグ(1コマンド1バイト)を読み込んでビット列に変換する */
+	if (read_rfile(rf, flag, OLD_SEEN_FLAG_SIZE) == OLD_SEEN_FLAG_SIZE) {
+		for (i = 0; i < s->count && i < OLD_SEEN_FLAG_SIZE; i++)
+			if (flag[i])
+				s->bits[i / 8] |= (unsigned char)(1 << (i % 8));
+		is_dirty = true;
+	}
+
+	free(flag);
+	close_rfile(rf);
 }
 
 /* スクリプトファイル名からハッシュを求める */
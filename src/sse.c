@@ -20,12 +20,9 @@
 #define DRAW_BLEND_NORMAL		draw_blend_normal_sse
 #define DRAW_BLEND_ADD			draw_blend_add_sse
 #define DRAW_BLEND_SUB			draw_blend_sub_sse
+#define DRAW_BLEND_FAST_PM		draw_blend_fast_pm_sse
 #include "drawimage.h"
 
-/* SSE版scale_samples()を定義する */
-#define SCALE_SAMPLES scale_samples_sse
-#include "scalesamples.h"
-
 /* SSE版draw_glyph_func()を定義する */
 #define DRAW_GLYPH_FUNC draw_glyph_func_sse
 #include "drawglyph.h"
@@ -14,17 +14,25 @@
 
 #ifdef SSE_VERSIONING
 
-/* SSE2版の描画関数を定義する */
+#ifndef USE_FLOAT_BLEND
+/* SSE2版の描画関数を定義する(SSE2の組み込み関数を使う) */
+#define DRAW_BLEND_NONE			draw_blend_none_sse2
+#define DRAW_BLEND_FAST			draw_blend_fast_sse2
+#define DRAW_BLEND_NORMAL		draw_blend_normal_sse2
+#define DRAW_BLEND_ADD			draw_blend_add_sse2
+#define DRAW_BLEND_SUB			draw_blend_sub_sse2
+#define DRAW_BLEND_FAST_PM		draw_blend_fast_pm_sse2
+#define DRAW_IMAGE_MASK			draw_image_mask_sse2
+#include "drawimagesse2.h"
+#else
+/* SSE2版の描画関数を定義する(浮動小数点版) */
 #define DRAW_BLEND_NONE			draw_blend_none_sse2
 #define DRAW_BLEND_FAST			draw_blend_fast_sse2
 #define DRAW_BLEND_NORMAL		draw_blend_normal_sse2
 #define DRAW_BLEND_ADD			draw_blend_add_sse2
 #define DRAW_BLEND_SUB			draw_blend_sub_sse2
 #include "drawimage.h"
-
-/* SSE2版scale_samples()を定義する */
-#define SCALE_SAMPLES scale_samples_sse2
-#include "scalesamples.h"
+#endif
 
 /* SSE2版draw_glyph_func()を定義する */
 #define DRAW_GLYPH_FUNC draw_glyph_func_sse2
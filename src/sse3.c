@@ -15,17 +15,24 @@
 #ifdef SSE_VERSIONING
 #ifndef _MSC_VER
 
-/* SSE3版の描画関数を定義する */
+#ifndef USE_FLOAT_BLEND
+/* SSE3版の描画関数を定義する(SSE2の組み込み関数を使う) */
+#define DRAW_BLEND_NONE			draw_blend_none_sse3
+#define DRAW_BLEND_FAST			draw_blend_fast_sse3
+#define DRAW_BLEND_NORMAL		draw_blend_normal_sse3
+#define DRAW_BLEND_ADD			draw_blend_add_sse3
+#define DRAW_BLEND_SUB			draw_blend_sub_sse3
+#define DRAW_BLEND_FAST_PM		draw_blend_fast_pm_sse3
+#include "drawimagesse2.h"
+#else
+/* SSE3版の描画関数を定義する(浮動小数点版) */
 #define DRAW_BLEND_NONE			draw_blend_none_sse3
 #define DRAW_BLEND_FAST			draw_blend_fast_sse3
 #define DRAW_BLEND_NORMAL		draw_blend_normal_sse3
 #define DRAW_BLEND_ADD			draw_blend_add_sse3
 #define DRAW_BLEND_SUB			draw_blend_sub_sse3
 #include "drawimage.h"
-
-/* SSE3版scale_samples()を定義する */
-#define SCALE_SAMPLES scale_samples_sse3
-#include "scalesamples.h"
+#endif
 
 /* SSE3版draw_glyph_func()を定義する */
 #define DRAW_GLYPH_FUNC draw_glyph_func_sse3
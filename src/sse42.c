@@ -15,17 +15,24 @@
 #ifdef SSE_VERSIONING
 #ifndef _MSC_VER
 
-/* SSE4.2版の描画関数を定義する */
+#ifndef USE_FLOAT_BLEND
+/* SSE4.2版の描画関数を定義する(SSE2の組み込み関数を使う) */
+#define DRAW_BLEND_NONE			draw_blend_none_sse42
+#define DRAW_BLEND_FAST			draw_blend_fast_sse42
+#define DRAW_BLEND_NORMAL		draw_blend_normal_sse42
+#define DRAW_BLEND_ADD			draw_blend_add_sse42
+#define DRAW_BLEND_SUB			draw_blend_sub_sse42
+#define DRAW_BLEND_FAST_PM		draw_blend_fast_pm_sse42
+#include "drawimagesse2.h"
+#else
+/* SSE4.2版の描画関数を定義する(浮動小数点版) */
 #define DRAW_BLEND_NONE			draw_blend_none_sse42
 #define DRAW_BLEND_FAST			draw_blend_fast_sse42
 #define DRAW_BLEND_NORMAL		draw_blend_normal_sse42
 #define DRAW_BLEND_ADD			draw_blend_add_sse42
 #define DRAW_BLEND_SUB			draw_blend_sub_sse42
 #include "drawimage.h"
-
-/* SSE4.2版scale_samples()を定義する */
-#define SCALE_SAMPLES scale_samples_sse42
-#include "scalesamples.h"
+#endif
 
 /* SSE4.2版draw_glyph_func()を定義する */
 #define DRAW_GLYPH_FUNC draw_glyph_func_sse42
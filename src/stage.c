@@ -31,6 +31,9 @@
 /* カーテンフェードのカーテンの幅 */
 #define CURTAIN_WIDTH	(256)
 
+/* ダーティ矩形の最大数 */
+#define DIRTY_RECT_MAX	(8)
+
 /* レイヤ */
 enum {
 	/* 背景レイヤ */
@@ -196,6 +199,38 @@ static int layer_anime_alpha_to[STAGE_LAYERS];
 static int shake_offset_x;
 static int shake_offset_y;
 
+/*
+ * ダーティ矩形
+ *  - 合成し直す必要がある矩形と、バックイメージに描画された矩形を保持する
+ *  - 数が上限を超えると、面積の増加が最小になる矩形と結合される
+ */
+
+/* 矩形 */
+struct stage_rect {
+	int x, y, w, h;
+};
+
+/* 次の描画で合成し直す必要がある矩形 */
+static struct stage_rect dirty_rect[DIRTY_RECT_MAX];
+static int dirty_rect_count;
+
+/* 現在のフレームでバックイメージに描画された矩形 */
+static struct stage_rect update_rect[DIRTY_RECT_MAX];
+static int update_rect_count;
+
+/*
+ * 背景とキャラの合成イメージ
+ *  - 背景とキャラが変化しない間は合成結果を使い回す
+ *  - GPUを使う場合は作成しない
+ */
+
+/* 背景とキャラを合成したイメージ */
+static struct image *composite_image;
+
+/* 合成イメージのうち合成し直す必要がある矩形 */
+static struct stage_rect composite_rect[DIRTY_RECT_MAX];
+static int composite_rect_count;
+
 /*
  * 前方参照
  */
@@ -207,6 +242,8 @@ static bool setup_switch(void);
 static bool setup_news(void);
 static bool setup_save(void);
 static bool create_fade_layer_images(void);
+static bool create_composite_image(void);
+static void update_composite_image(void);
 static void destroy_layer_image(int layer);
 static void draw_stage_fi_fo_fade(int fade_method);
 static void draw_stage_fi_fo_fade_normal(void);
@@ -236,6 +273,12 @@ static void draw_layer_image_rect(struct image *target, int layer, int x,
 static bool draw_char_on_layer(int layer, int x, int y, uint32_t wc,
 			       pixel_t color, pixel_t outline_color,int *w,
 			       int *h);
+static void invalidate_layer(int layer);
+static void invalidate_all(void);
+static void add_update_rect(int x, int y, int w, int h);
+static void add_rect(struct stage_rect *list, int *count, int x, int y, int w,
+		     int h);
+static int get_rect_area(int w, int h);
 
 /*
  * 初期化
@@ -280,6 +323,10 @@ bool init_stage(void)
 	if (!create_fade_layer_images())
 		return false;
 
+	/* 背景とキャラの合成イメージを作成する */
+	if (!create_composite_image())
+		return false;
+
 	/* ブレンドタイプを設定する */
 	layer_blend[LAYER_BG] = BLEND_NONE;
 	layer_blend[LAYER_CHB] = BLEND_FAST;
@@ -502,6 +549,22 @@ static bool create_fade_layer_images(void)
 	return true;
 }
 
+/* 背景とキャラの合成イメージを作成する */
+static bool create_composite_image(void)
+{
+#if !defined(USE_OPENGL) && !defined(USE_DIRECT3D)
+	composite_image = create_image(conf_window_width, conf_window_height);
+	if (composite_image == NULL)
+		return false;
+
+	/* 最初の描画で全体を合成する */
+	add_rect(composite_rect, &composite_rect_count, 0, 0,
+		 conf_window_width, conf_window_height);
+#endif
+
+	return true;
+}
+
 /*
  * ステージの終了処理を行う
  */
@@ -512,6 +575,11 @@ void cleanup_stage(void)
 	for (i = LAYER_BG; i < STAGE_LAYERS; i++)
 		destroy_layer_image(i);
 
+	if (composite_image != NULL) {
+		destroy_image(composite_image);
+		composite_image = NULL;
+	}
+
 	if (namebox_image != NULL) {
 		destroy_image(namebox_image);
 		namebox_image = NULL;
@@ -593,11 +661,26 @@ void draw_stage_rect(int x, int y, int w, int h)
 	if (y + h >= conf_window_height)
 		h = conf_window_height - y;
 
-	render_layer_image_rect(LAYER_BG, x, y, w, h);
-	render_layer_image_rect(LAYER_CHB, x, y, w, h);
-	render_layer_image_rect(LAYER_CHL, x, y, w, h);
-	render_layer_image_rect(LAYER_CHR, x, y, w, h);
-	render_layer_image_rect(LAYER_CHC, x, y, w, h);
+	/* 描画する矩形を記録する */
+	add_update_rect(x, y, w, h);
+
+	/* 画面全体を描画する場合はダーティ矩形が不要になる */
+	if (x == 0 && y == 0 && w == conf_window_width &&
+	    h == conf_window_height)
+		dirty_rect_count = 0;
+
+	if (composite_image != NULL) {
+		/* 背景とキャラは合成イメージからコピーする */
+		update_composite_image();
+		render_image(x, y, composite_image, w, h, x, y, 255,
+			     BLEND_NONE);
+	} else {
+		render_layer_image_rect(LAYER_BG, x, y, w, h);
+		render_layer_image_rect(LAYER_CHB, x, y, w, h);
+		render_layer_image_rect(LAYER_CHL, x, y, w, h);
+		render_layer_image_rect(LAYER_CHR, x, y, w, h);
+		render_layer_image_rect(LAYER_CHC, x, y, w, h);
+	}
 	if (is_msgbox_visible)
 		render_layer_image_rect(LAYER_MSG, x, y, w, h);
 	if (is_namebox_visible)
@@ -608,6 +691,45 @@ void draw_stage_rect(int x, int y, int w, int h)
 		render_layer_image_rect(LAYER_SEL, x, y, w, h);
 }
 
+/*
+ * ステージのダーティ矩形だけを描画する
+ *  - 描画した矩形を囲う矩形を返す
+ */
+void draw_stage_dirty(int *x, int *y, int *w, int *h)
+{
+#if !defined(USE_OPENGL) && !defined(USE_DIRECT3D)
+	struct stage_rect r;
+	int i, n;
+#endif
+
+	assert(!is_save_load_mode());
+	assert(stage_mode != STAGE_MODE_BG_FADE);
+	assert(stage_mode != STAGE_MODE_CH_FADE);
+
+#if defined(USE_OPENGL) || defined(USE_DIRECT3D)
+	/* GPUでは毎フレーム画面全体を描画する */
+	draw_stage();
+	*x = 0;
+	*y = 0;
+	*w = conf_window_width;
+	*h = conf_window_height;
+#else
+	*x = 0;
+	*y = 0;
+	*w = 0;
+	*h = 0;
+
+	/* 画面全体の描画でクリアされるので、数を先に保存しておく */
+	n = dirty_rect_count;
+	for (i = 0; i < n; i++) {
+		r = dirty_rect[i];
+		draw_stage_rect(r.x, r.y, r.w, r.h);
+		union_rect(x, y, w, h, *x, *y, *w, *h, r.x, r.y, r.w, r.h);
+	}
+	dirty_rect_count = 0;
+#endif
+}
+
 /*
  * 背景フェードモードが有効な際のステージ描画を行う
  */
@@ -616,6 +738,7 @@ void draw_stage_bg_fade(int fade_method)
 	assert(!is_save_load_mode());
 	assert(stage_mode == STAGE_MODE_BG_FADE);
 
+	add_update_rect(0, 0, conf_window_width, conf_window_height);
 	draw_stage_fi_fo_fade(fade_method);
 }
 
@@ -627,6 +750,7 @@ void draw_stage_ch_fade(int fade_method)
 	assert(!is_save_load_mode());
 	assert(stage_mode == STAGE_MODE_CH_FADE);
 
+	add_update_rect(0, 0, conf_window_width, conf_window_height);
 	draw_stage_fi_fo_fade(fade_method);
 }
 
@@ -1261,6 +1385,8 @@ static float cw_step(int method, float progress)
  */
 void draw_stage_shake(void)
 {
+	add_update_rect(0, 0, conf_window_width, conf_window_height);
+
 	/* 背景を塗り潰す */
 	if (conf_window_white) {
 		render_clear(0, 0, conf_window_width, conf_window_height,
@@ -1284,6 +1410,8 @@ void draw_stage_with_buttons(int x1, int y1, int w1, int h1, int x2, int y2,
 {
 	assert(stage_mode == STAGE_MODE_IDLE);
 
+	add_update_rect(0, 0, conf_window_width, conf_window_height);
+
 	/* 背景を描画する */
 	render_image(0, 0, layer_image[LAYER_FO],
 		     get_image_width(layer_image[LAYER_FO]),
@@ -1335,12 +1463,17 @@ void draw_stage_rect_with_buttons(int old_x, int old_y, int old_w, int old_h,
 	UNUSED_PARAMETER(old_w);
 	UNUSED_PARAMETER(old_h);
 
+	add_update_rect(0, 0, conf_window_width, conf_window_height);
+
 	/* 背景を描画する */
 	render_image(0, 0, layer_image[LAYER_FO],
 		     get_image_width(layer_image[LAYER_FO]),
 		     get_image_height(layer_image[LAYER_FO]),
 		     0, 0, 255, BLEND_NONE);
 #else
+	add_update_rect(old_x, old_y, old_w, old_h);
+	add_update_rect(new_x, new_y, new_w, new_h);
+
 	/* 古いボタンを消す */
 	render_image(old_x, old_y, layer_image[LAYER_FO], old_w, old_h, old_x,
 		     old_y, 255, BLEND_NONE);
@@ -1361,6 +1494,8 @@ void draw_stage_history(void)
 	assert(stage_mode != STAGE_MODE_BG_FADE);
 	assert(stage_mode != STAGE_MODE_CH_FADE);
 
+	add_update_rect(0, 0, conf_window_width, conf_window_height);
+
 	/* ステージを描画する */
 	render_image(0, 0, layer_image[LAYER_FO], conf_window_width,
 		     conf_window_height, 0, 0, 255, BLEND_NONE);
@@ -1563,6 +1698,8 @@ const char *get_bg_file_name(void)
  */
 void change_bg_immediately(struct image *img)
 {
+	invalidate_all();
+
 	destroy_layer_image(LAYER_BG);
 	layer_image[LAYER_BG] = img;
 }
@@ -1576,6 +1713,7 @@ void start_bg_fade(struct image *img)
 
 	/* 背景フェードを有効にする */
 	stage_mode = STAGE_MODE_BG_FADE;
+	invalidate_all();
 
 	/* フェードアウト用のレイヤにステージを描画する */
 	lock_image(layer_image[LAYER_FO]);
@@ -1625,6 +1763,7 @@ void stop_bg_fade(void)
 	assert(stage_mode == STAGE_MODE_BG_FADE);
 
 	stage_mode = STAGE_MODE_IDLE;
+	invalidate_all();
 	destroy_layer_image(LAYER_BG);
 	layer_image[LAYER_BG] = new_bg_img;
 	new_bg_img = NULL;
@@ -1710,11 +1849,13 @@ void change_ch_immediately(int pos, struct image *img, int x, int y, int alpha)
 	       pos == CH_CENTER);
 
 	layer = pos_to_layer(pos);
+	invalidate_layer(layer);
 	destroy_layer_image(layer);
 	layer_image[layer] = img;
 	layer_x[layer] = x;
 	layer_y[layer] = y;
 	layer_alpha[layer] = alpha;
+	invalidate_layer(layer);
 }
 
 /*
@@ -1728,9 +1869,11 @@ void change_ch_attributes(int pos, int x, int y, int alpha)
 	       pos == CH_CENTER);
 
 	layer = pos_to_layer(pos);
+	invalidate_layer(layer);
 	layer_x[layer] = x;
 	layer_y[layer] = y;
 	layer_alpha[layer] = alpha;
+	invalidate_layer(layer);
 }
 
 /*
@@ -1745,6 +1888,7 @@ void start_ch_fade(int pos, struct image *img, int x, int y, int alpha)
 	       pos == CH_CENTER);
 
 	stage_mode = STAGE_MODE_CH_FADE;
+	invalidate_all();
 
 	/* キャラフェードアウトレイヤにステージを描画する */
 	lock_image(layer_image[LAYER_FO]);
@@ -1802,6 +1946,7 @@ void start_ch_fade_multi(const bool *stay, struct image **img, const int *x,
 
 	/* このフェードでもSTAGE_MODE_CH_FADEを利用する */
 	stage_mode = STAGE_MODE_CH_FADE;
+	invalidate_all();
 
 	/* キャラフェードアウトレイヤにステージを描画する */
 	lock_image(layer_image[LAYER_FO]);
@@ -1908,6 +2053,8 @@ void set_ch_anime_progress(float progress)
 		if (!layer_anime_run[i])
 			continue;
 
+		/* 移動前と移動後の矩形を再描画の対象にする */
+		invalidate_layer(i);
 		layer_alpha[i] = (uint8_t)get_anime_interpolation(progress,
 					(float)layer_anime_alpha_from[i],
 					(float)layer_anime_alpha_to[i]);
@@ -1917,6 +2064,7 @@ void set_ch_anime_progress(float progress)
 		layer_y[i] = (int)get_anime_interpolation(progress,
 					(float)layer_anime_y_from[i],
 					(float)layer_anime_y_to[i]);
+		invalidate_layer(i);
 	}
 }
 
@@ -1943,9 +2091,11 @@ void stop_ch_anime(void)
 		if (!layer_anime_run[i])
 			continue;
 
+		invalidate_layer(i);
 		layer_alpha[i] = layer_anime_alpha_to[i];
 		layer_x[i] = layer_anime_x_to[i];
 		layer_y[i] = layer_anime_y_to[i];
+		invalidate_layer(i);
 	}
 }
 
@@ -2023,6 +2173,9 @@ void clear_namebox(void)
  */
 void show_namebox(bool show)
 {
+	if (is_namebox_visible != show)
+		invalidate_layer(LAYER_NAME);
+
 	is_namebox_visible = show;
 }
 
@@ -2106,6 +2259,9 @@ void clear_msgbox_rect_with_fg(int x, int y, int w, int h)
  */
 void show_msgbox(bool show)
 {
+	if (is_msgbox_visible != show)
+		invalidate_layer(LAYER_MSG);
+
 	is_msgbox_visible = show;
 }
 
@@ -2145,6 +2301,9 @@ void get_click_rect(int *x, int *y, int *w, int *h)
  */
 void show_click(bool show)
 {
+	if (is_click_visible != show)
+		invalidate_layer(LAYER_CLICK);
+
 	is_click_visible = show;
 }
 
@@ -2183,6 +2342,9 @@ void clear_selbox(int fg_x, int fg_y, int fg_w, int fg_h)
  */
 void show_selbox(bool show)
 {
+	if (is_selbox_visible != show)
+		invalidate_layer(LAYER_SEL);
+
 	is_selbox_visible = show;
 }
 
@@ -2580,13 +2742,10 @@ static void render_layer_image_rect(int layer, int x, int y, int w, int h)
 	/* 背景イメージがセットされていなければクリアする */
 	if (layer == LAYER_BG && layer_image[LAYER_BG] == NULL) {
 		if (conf_window_white) {
-			render_clear(x, y, conf_window_width,
-				     conf_window_height,
+			render_clear(x, y, w, h,
 				     make_pixel(0xff, 0xff, 0xff, 0xff));
 		} else {
-			render_clear(x, y, conf_window_width,
-				     conf_window_height,
-				     make_pixel(0, 0, 0, 0));
+			render_clear(x, y, w, h, make_pixel(0, 0, 0, 0));
 		}
 		return;
 	}
@@ -2675,3 +2834,176 @@ void union_rect(int *x, int *y, int *w, int *h, int x1, int y1, int w1, int h1,
 	*w = w1 > w2 ? w1 - *x + 1 : w2 - *x + 1;
 	*h = h1 > h2 ? h1 - *y + 1 : h2 - *y + 1;
 }
+
+/*
+ * ダーティ矩形
+ */
+
+/* レイヤの矩形を再描画の対象にする */
+static void invalidate_layer(int layer)
+{
+	assert(layer >= LAYER_BG && layer < STAGE_LAYERS);
+
+	if (layer_image[layer] == NULL)
+		return;
+
+	add_rect(dirty_rect, &dirty_rect_count, layer_x[layer], layer_y[layer],
+		 get_image_width(layer_image[layer]),
+		 get_image_height(layer_image[layer]));
+
+	/* 背景とキャラは合成イメージも合成し直す */
+	if (layer <= LAYER_CHC) {
+		add_rect(composite_rect, &composite_rect_count,
+			 layer_x[layer], layer_y[layer],
+			 get_image_width(layer_image[layer]),
+			 get_image_height(layer_image[layer]));
+	}
+}
+
+/* 画面全体を再描画の対象にする */
+static void invalidate_all(void)
+{
+	add_rect(dirty_rect, &dirty_rect_count, 0, 0, conf_window_width,
+		 conf_window_height);
+	add_rect(composite_rect, &composite_rect_count, 0, 0,
+		 conf_window_width, conf_window_height);
+}
+
+/* 背景とキャラの合成イメージの無効な矩形を合成し直す */
+static void update_composite_image(void)
+{
+	struct stage_rect r;
+	int i;
+
+	if (composite_rect_count == 0)
+		return;
+
+	lock_image(composite_image);
+	for (i = 0; i < composite_rect_count; i++) {
+		r = composite_rect[i];
+		draw_layer_image_rect(composite_image, LAYER_BG, r.x, r.y,
+				      r.w, r.h);
+		draw_layer_image_rect(composite_image, LAYER_CHB, r.x, r.y,
+				      r.w, r.h);
+		draw_layer_image_rect(composite_image, LAYER_CHL, r.x, r.y,
+				      r.w, r.h);
+		draw_layer_image_rect(composite_image, LAYER_CHR, r.x, r.y,
+				      r.w, r.h);
+		draw_layer_image_rect(composite_image, LAYER_CHC, r.x, r.y,
+				      r.w, r.h);
+	}
+	unlock_image(composite_image);
+
+	composite_rect_count = 0;
+}
+
+/* バックイメージに描画した矩形を記録する */
+static void add_update_rect(int x, int y, int w, int h)
+{
+	add_rect(update_rect, &update_rect_count, x, y, w, h);
+}
+
+/*
+ * 矩形のリストに矩形を追加する
+ *  - 画面外の部分は切り取られる
+ *  - 結合しても面積の増加が小さい矩形は結合する
+ *  - リストが一杯の場合は、面積の増加が最小になる矩形と結合する
+ */
+static void add_rect(struct stage_rect *list, int *count, int x, int y, int w,
+		     int h)
+{
+	int i, ux, uy, uw, uh, area, grow, best, best_grow;
+
+	/* 画面内に切り取る */
+	if (x < 0) {
+		w += x;
+		x = 0;
+	}
+	if (y < 0) {
+		h += y;
+		y = 0;
+	}
+	if (x + w > conf_window_width)
+		w = conf_window_width - x;
+	if (y + h > conf_window_height)
+		h = conf_window_height - y;
+	if (w <= 0 || h <= 0)
+		return;
+
+	while (1) {
+		/* 結合すべき矩形を探す */
+		best = -1;
+		best_grow = 0;
+		for (i = 0; i < *count; i++) {
+			union_rect(&ux, &uy, &uw, &uh, list[i].x, list[i].y,
+				   list[i].w, list[i].h, x, y, w, h);
+			area = get_rect_area(list[i].w, list[i].h) +
+			       get_rect_area(w, h);
+
+			/* 囲う矩形が2つの面積の和の1.25倍以下なら結合する */
+			if (get_rect_area(uw, uh) * 4 <= area * 5) {
+				best = i;
+				break;
+			}
+
+			/* リストが一杯の場合に備えて増加が最小の矩形を探す */
+			grow = get_rect_area(uw, uh) -
+			       get_rect_area(list[i].w, list[i].h);
+			if (best == -1 || grow < best_grow) {
+				best = i;
+				best_grow = grow;
+			}
+		}
+
+		/* 結合しない場合はリストに追加する */
+		if (i == *count && *count < DIRTY_RECT_MAX) {
+			list[*count].x = x;
+			list[*count].y = y;
+			list[*count].w = w;
+			list[*count].h = h;
+			(*count)++;
+			return;
+		}
+
+		/* 結合した矩形をリストから外して追加し直す */
+		union_rect(&x, &y, &w, &h, list[best].x, list[best].y,
+			   list[best].w, list[best].h, x, y, w, h);
+		list[best] = list[*count - 1];
+		(*count)--;
+	}
+}
+
+/* 矩形の面積を求める */
+static int get_rect_area(int w, int h)
+{
+	return w * h;
+}
+
+/*
+ * フレームで描画された矩形の記録をクリアする
+ */
+void clear_stage_update_rects(void)
+{
+	update_rect_count = 0;
+}
+
+/*
+ * フレームで描画された矩形の数を取得する
+ */
+int get_stage_update_rect_count(void)
+{
+	return update_rect_count;
+}
+
+/*
+ * フレームで描画された矩形を取得する
+ */
+void get_stage_update_rect(int index, int *x, int *y, int *w, int *h)
+{
+	assert(index >= 0 && index < update_rect_count);
+
+	*x = update_rect[index].x;
+	*y = update_rect[index].y;
+	*w = update_rect[index].w;
+	*h = update_rect[index].h;
+}
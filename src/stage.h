@@ -78,6 +78,9 @@ void draw_stage_keep(void);
 /* ステージの矩形を描画する */
 void draw_stage_rect(int x, int y, int w, int h);
 
+/* ステージのダーティ矩形だけを描画する */
+void draw_stage_dirty(int *x, int *y, int *w, int *h);
+
 /* 背景フェードモードが有効な際のステージ描画を行う */
 void draw_stage_bg_fade(int fade_method);
 
@@ -353,4 +356,13 @@ void draw_char_on_fi(int x, int y, uint32_t wc, int *w, int *h);
 void union_rect(int *x, int *y, int *w, int *h, int x1, int y1, int w1, int h1,
 		int x2, int y2, int w2, int h2);
 
+/* フレームで描画された矩形の記録をクリアする */
+void clear_stage_update_rects(void);
+
+/* フレームで描画された矩形の数を取得する */
+int get_stage_update_rect_count(void);
+
+/* フレームで描画された矩形を取得する */
+void get_stage_update_rect(int index, int *x, int *y, int *w, int *h);
+
 #endif
@@ -33,6 +33,21 @@
 #define SAMPLING_RATE	(44100)
 #define IOSIZE		(4096)
 
+/*
+ * デコード済みのPCMサンプル(44.1kHz 16bit stereo)
+ *  - 短い効果音とボイスはファイルを開くたびにデコードせず、これを共有する
+ *  - キャッシュと再生中のwaveがそれぞれ1つの参照を持つ
+ */
+struct pcm_clip {
+	uint32_t *samples;
+	int count;
+	int ref_count;
+
+	/* ファイルで指定されたループの開始位置と終了位置 */
+	int loop_start;
+	int loop_end;
+};
+
 /*
  * 44.1kHz 16bit stereoのPCMストリーム
  */
@@ -40,27 +55,116 @@ struct wave {
 	/* 入力ファイル */
 	char *dir;
 	char *file;
+	size_t file_size;
 	bool loop;
 	int times;	/* loop=trueのとき、-1なら無限、0以上は残り回数 */
 	bool monaural;
 
+	/*
+	 * ループの開始位置と終了位置(サンプル数)
+	 *  - VorbisコメントのLOOPSTARTとLOOPLENGTH(またはLOOPEND)で指定する
+	 *  - 指定がなければファイルの先頭から終端までループする
+	 *  - 終了位置が-1ならファイルの終端
+	 */
+	ogg_int64_t loop_start;
+	ogg_int64_t loop_end;
+
 	/* 状態 */
 	bool eos;
 	bool err;
 
 	/* Vorbisのオブジェクト */
 	OggVorbis_File ovf;
+
+	/* デコード済みのサンプル(NULLでなければovfは使わない) */
+	struct pcm_clip *clip;
+	int pos;
+};
+
+/*
+ * PCMキャッシュ
+ *  - 短いファイルはすべてデコードして、LRUで保持する
+ *  - 参照カウントが1のエントリはどこからも使われていないので、破棄できる
+ *  - メインスレッドのみが使用する(サウンドスレッドはサンプルを読むだけ)
+ */
+
+/* キャッシュのエントリの最大数 */
+#define CACHE_ENTRY_MAX		(64)
+
+/* キャッシュのサイズ(MB)の既定値 */
+#define DEFAULT_CACHE_SIZE	(16)
+
+/* キャッシュする1ファイルのデコード後のサイズ(KB)の既定値 */
+#define DEFAULT_CLIP_SIZE	(2048)
+
+/* キャッシュのエントリ */
+struct cache_entry {
+	char *dir;
+	char *file;
+	struct pcm_clip *clip;
+	unsigned int last_used;
 };
 
+/* キャッシュのエントリのテーブル */
+static struct cache_entry cache_tbl[CACHE_ENTRY_MAX];
+
+/* キャッシュのエントリ数 */
+static int cache_count;
+
+/* キャッシュされたサンプルの合計サイズ(バイト) */
+static size_t cache_size;
+
+/* 最後に使用した時刻の代わりに使うカウンタ */
+static unsigned int cache_tick;
+
+/*
+ * デコードしてみたら上限を超えたファイル
+ *  - 再生のたびにデコードし直さないように覚えておく
+ *  - いっぱいになったら古いものから上書きする
+ */
+
+/* 上限を超えたファイルを覚えておく最大数 */
+#define LARGE_ENTRY_MAX		(64)
+
+/* 上限を超えたファイルのエントリ */
+struct large_entry {
+	char *dir;
+	char *file;
+};
+
+/* 上限を超えたファイルのテーブル */
+static struct large_entry large_tbl[LARGE_ENTRY_MAX];
+
+/* 次に上書きするエントリ */
+static int large_next;
+
 /*
  * 前方参照
  */
-static bool reopen(struct wave *w);
+static bool open_stream(struct wave *w);
+static void read_loop_points(struct wave *w);
 static size_t read_func(void *ptr, size_t size, size_t nmemb,
 			void *datasource);
+static int seek_func(void *datasource, ogg_int64_t offset, int whence);
+static long tell_func(void *datasource);
 static int close_func(void *datasource);
+static bool is_looping(struct wave *w);
+static int get_read_frames(struct wave *w, int frames);
+static bool rewind_loop(struct wave *w);
 static int get_wave_samples_monaural(struct wave *w, uint32_t *buf, int samples);
 static int get_wave_samples_stereo(struct wave *w, uint32_t *buf, int samples);
+static int get_clip_samples(struct wave *w, uint32_t *buf, int samples);
+static bool decode_clip(struct wave *w);
+static void release_clip(struct pcm_clip *clip);
+static size_t get_clip_limit(void);
+static struct pcm_clip *find_cached_clip(const char *dir, const char *file);
+static void add_cached_clip(const char *dir, const char *file,
+			    struct pcm_clip *clip);
+static void evict_cached_clips(size_t limit);
+static void remove_cache_entry(int index);
+static bool is_cacheable(struct wave *w);
+static bool is_large_file(const char *dir, const char *file);
+static void add_large_file(const char *dir, const char *file);
 
 /*
  * ファイルからPCMストリームを作成する
@@ -100,25 +204,46 @@ struct wave *create_wave_from_file(const char *dir, const char *fname,
 		return NULL;
 	}
 
+	/* wave構造体を初期化する */
+	w->loop = loop;
+	w->times = -1;
+	w->eos = false;
+	w->pos = 0;
+
+	/* デコード済みのサンプルがキャッシュにあれば、それを再生する */
+	w->clip = find_cached_clip(dir, fname);
+	if (w->clip != NULL) {
+		w->monaural = false;
+		w->loop_start = w->clip->loop_start;
+		w->loop_end = w->clip->loop_end;
+		return w;
+	}
+
 	/* ファイルをオープンする */
-	if (!reopen(w))
+	if (!open_stream(w))
 		return NULL;
 	
 	/* TODO: ov_info()でサンプリングレートとチャンネル数をチェック */
 	vi = ov_info(&w->ovf, -1);
 	w->monaural = vi->channels == 1 ? true : false;
 
-	/* wave構造体を初期化する */
-	w->loop = loop;
-	w->times = -1;
-	w->eos = false;
+	/* ループの開始位置と終了位置を取得する */
+	read_loop_points(w);
+
+	/* 短い効果音とボイスであれば、すべてデコードしてキャッシュする */
+	if (is_cacheable(w))
+		if (!decode_clip(w))
+			return NULL;
 
 	/* 成功 */
 	return w;
 }
 
-/* ファイルをリオープンする */
-static bool reopen(struct wave *w)
+/*
+ * ファイルをオープンする
+ *  - シークできるので、ループするときはov_pcm_seek()で戻る
+ */
+static bool open_stream(struct wave *w)
 {
 	struct rfile *rf;
 	ov_callbacks cb;
@@ -132,12 +257,13 @@ static bool reopen(struct wave *w)
 		free(w);
 		return false;
 	}
+	w->file_size = get_rfile_size(rf);
 
 	/* コールバックを使ってファイルを開く */
 	cb.read_func = read_func;
 	cb.close_func = close_func;
-	cb.seek_func = NULL;
-	cb.tell_func = NULL;
+	cb.seek_func = seek_func;
+	cb.tell_func = tell_func;
 	err = ov_open_callbacks(rf, &w->ovf, NULL, 0, cb);
 	if (err != 0) {
 		log_audio_file_error(w->dir, w->file);
@@ -166,6 +292,43 @@ static size_t read_func(void *ptr, size_t size, size_t nmemb, void *datasource)
 	return len / size;
 }
 
+/* ファイルシークコールバック */
+static int seek_func(void *datasource, ogg_int64_t offset, int whence)
+{
+	struct rfile *rf;
+	ogg_int64_t pos;
+
+	assert(datasource != NULL);
+
+	rf = (struct rfile *)datasource;
+
+	switch (whence) {
+	case SEEK_SET:
+		pos = offset;
+		break;
+	case SEEK_CUR:
+		pos = (ogg_int64_t)tell_rfile(rf) + offset;
+		break;
+	case SEEK_END:
+		pos = (ogg_int64_t)get_rfile_size(rf) + offset;
+		break;
+	default:
+		return -1;
+	}
+	if (pos < 0)
+		return -1;
+
+	return seek_rfile(rf, (size_t)pos) ? 0 : -1;
+}
+
+/* ファイル位置取得コールバック */
+static long tell_func(void *datasource)
+{
+	assert(datasource != NULL);
+
+	return (long)tell_rfile((struct rfile *)datasource);
+}
+
 /* ファイルクローズコールバック */
 static int close_func(void *datasource)
 {
@@ -176,6 +339,40 @@ static int close_func(void *datasource)
 	return 0;
 }
 
+/* Vorbisコメントからループの開始位置と終了位置を取得する */
+static void read_loop_points(struct wave *w)
+{
+	vorbis_comment *vc;
+	ogg_int64_t total, start, end;
+	const char *s;
+
+	w->loop_start = 0;
+	w->loop_end = -1;
+
+	vc = ov_comment(&w->ovf, -1);
+	if (vc == NULL)
+		return;
+	s = vorbis_comment_query(vc, "LOOPSTART", 0);
+	if (s == NULL)
+		return;
+	start = (ogg_int64_t)strtol(s, NULL, 10);
+	end = -1;
+	if ((s = vorbis_comment_query(vc, "LOOPLENGTH", 0)) != NULL)
+		end = start + (ogg_int64_t)strtol(s, NULL, 10);
+	else if ((s = vorbis_comment_query(vc, "LOOPEND", 0)) != NULL)
+		end = (ogg_int64_t)strtol(s, NULL, 10);
+
+	/* ファイルの範囲外は無視する */
+	total = ov_pcm_total(&w->ovf, -1);
+	if (start < 0 || (total > 0 && start >= total))
+		return;
+	if (end <= start || (total > 0 && end >= total))
+		end = -1;
+
+	w->loop_start = start;
+	w->loop_end = end;
+}
+
 /*
  * PCMストリームのループ回数を設定する
  */
@@ -192,7 +389,10 @@ void set_wave_repeat_times(struct wave *w, int n)
  */
 void destroy_wave(struct wave *w)
 {
-	ov_clear(&w->ovf);
+	if (w->clip != NULL)
+		release_clip(w->clip);
+	else
+		ov_clear(&w->ovf);
 	free(w->dir);
 	free(w->file);
 	free(w);
@@ -215,6 +415,10 @@ int get_wave_samples(struct wave *w, uint32_t *buf, int samples)
 	if (w->eos)
 		return 0;
 
+	/* デコード済みの場合 */
+	if (w->clip != NULL)
+		return get_clip_samples(w, buf, samples);
+
 	/* モノラルの場合 */
 	if (w->monaural)
 		return get_wave_samples_monaural(w, buf, samples);
@@ -234,29 +438,27 @@ static int get_wave_samples_monaural(struct wave *w, uint32_t *buf, int samples)
 	retain = 0;
 	last_ret_bytes = -1;
 	while (retain < samples) {
-		/* デコードする */
-		read_bytes = (samples - retain) * 2 > 4096 ? 4096 :
-			     (samples - retain) * 2;
-		ret_bytes = ov_read(&w->ovf, (char *)mbuf, read_bytes, 0, 2,
-				    1, &bitstream);
+		/* デコードする(ループの終了位置を越えない) */
+		read_bytes = get_read_frames(w, samples - retain) * 2;
+		if (read_bytes > IOSIZE)
+			read_bytes = IOSIZE;
+		ret_bytes = read_bytes == 0 ? 0 :
+			ov_read(&w->ovf, (char *)mbuf, read_bytes, 0, 2, 1,
+				&bitstream);
 		if (ret_bytes == 0) {
 			/* 終端に達した */
-			if (w->loop && (w->times == -1 || w->times > 0)) {
-				/* ストリームを再度オープンする */
-				if (last_ret_bytes == 0)
-					return 0; 	/* エラー */
-				ov_clear(&w->ovf);
-				if (!reopen(w))
-					return 0;	/* エラー */
-				last_ret_bytes = ret_bytes;
-				if (w->times != -1)
-					w->times--;
-			} else {
-				/* 読み込んだサンプル数を返す */
-				w->eos = true;
-				return retain;
+			if (is_looping(w) && last_ret_bytes != 0 &&
+			    rewind_loop(w)) {
+				/* ループの開始位置に戻った */
+				last_ret_bytes = 0;
+				continue;
 			}
+
+			/* 読み込んだサンプル数を返す */
+			w->eos = true;
+			return retain;
 		}
+		last_ret_bytes = ret_bytes;
 
 		/* ステレオに変換する */
 		for (i = 0; i < ret_bytes / 2; i++) {
@@ -276,37 +478,390 @@ static int get_wave_samples_monaural(struct wave *w, uint32_t *buf, int samples)
 static int get_wave_samples_stereo(struct wave *w, uint32_t *buf, int samples)
 {
 	long ret_bytes, last_ret_bytes;
-	int retain, bitstream;
+	int retain, read_bytes, bitstream;
 
 	/* サンプルの取得が完了するか、終端に達するまで続ける */
 	retain = 0;
 	last_ret_bytes = -1;
 	while (retain < samples) {
-		/* デコードする */
-		ret_bytes = ov_read(&w->ovf, (char *)(buf + retain),
-				    (samples - retain) * 4, 0, 2, 1,
-				    &bitstream);
+		/* デコードする(ループの終了位置を越えない) */
+		read_bytes = get_read_frames(w, samples - retain) * 4;
+		ret_bytes = read_bytes == 0 ? 0 :
+			ov_read(&w->ovf, (char *)(buf + retain), read_bytes,
+				0, 2, 1, &bitstream);
 		if (ret_bytes == 0) {
 			/* 終端に達した */
-			if (w->loop && (w->times == -1 || w->times > 0)) {
-				/* ストリームを再度オープンする */
-				if (last_ret_bytes == 0)
-					return 0; 	/* エラー */
-				ov_clear(&w->ovf);
-				if (!reopen(w))
-					return 0;	/* エラー */
-				last_ret_bytes = ret_bytes;
+			if (is_looping(w) && last_ret_bytes != 0 &&
+			    rewind_loop(w)) {
+				/* ループの開始位置に戻った */
+				last_ret_bytes = 0;
+				continue;
+			}
+
+			/* 読み込んだサンプル数を返す */
+			w->eos = true;
+			return retain;
+		}
+		last_ret_bytes = ret_bytes;
+		retain += (int)ret_bytes / 4;
+	}
+
+	/* 指定されたサンプル数の分だけ取得できた */
+	return samples;
+}
+
+/* まだループするかを調べる */
+static bool is_looping(struct wave *w)
+{
+	return w->loop && (w->times == -1 || w->times > 0);
+}
+
+/* ループの終了位置を越えずにデコードできるサンプル数を求める */
+static int get_read_frames(struct wave *w, int frames)
+{
+	ogg_int64_t rest;
+
+	/* ループしない場合はファイルの終端まで再生する */
+	if (w->loop_end == -1 || !is_looping(w))
+		return frames;
+
+	rest = w->loop_end - ov_pcm_tell(&w->ovf);
+	if (rest <= 0)
+		return 0;
+	if (rest < frames)
+		return (int)rest;
+	return frames;
+}
+
+/*
+ * ループの開始位置に戻る
+ *  - ファイルを開き直さずにシークするので、途切れずにつながる
+ */
+static bool rewind_loop(struct wave *w)
+{
+	if (ov_pcm_seek(&w->ovf, w->loop_start) != 0)
+		return false;
+
+	if (w->times != -1)
+		w->times--;
+	return true;
+}
+
+/* デコード済みのサンプルを取得する */
+static int get_clip_samples(struct wave *w, uint32_t *buf, int samples)
+{
+	int retain, len, end;
+
+	/* サンプルの取得が完了するか、終端に達するまで続ける */
+	retain = 0;
+	while (retain < samples) {
+		/* ループする間はループの終了位置までにする */
+		end = w->clip->count;
+		if (is_looping(w) && w->loop_end != -1 &&
+		    w->loop_end < end)
+			end = (int)w->loop_end;
+
+		if (w->pos >= end) {
+			/* 終端に達した */
+			if (is_looping(w) && end > w->loop_start) {
+				/* ループの開始位置に戻る */
+				w->pos = (int)w->loop_start;
 				if (w->times != -1)
 					w->times--;
-			} else {
-				/* 読み込んだサンプル数を返す */
-				w->eos = true;
-				return retain;
+				continue;
 			}
+
+			/* 読み込んだサンプル数を返す */
+			w->eos = true;
+			return retain;
 		}
-		retain += (int)ret_bytes / 4;
+
+		/* コピーする */
+		len = samples - retain;
+		if (len > end - w->pos)
+			len = end - w->pos;
+		memcpy(buf + retain, w->clip->samples + w->pos,
+		       (size_t)len * sizeof(uint32_t));
+		retain += len;
+		w->pos += len;
 	}
 
 	/* 指定されたサンプル数の分だけ取得できた */
 	return samples;
 }
+
+/*
+ * ファイルをすべてデコードしてキャッシュに追加する
+ *  - 上限を超えた場合はストリームを開き直し、通常どおりデコードする
+ *  - ファイルを開き直せなかった場合はwを解放して偽を返す
+ */
+static bool decode_clip(struct wave *w)
+{
+	struct pcm_clip *clip;
+	uint32_t *samples, *p;
+	int count, cap, limit, ret;
+	bool loop;
+
+	limit = (int)(get_clip_limit() / sizeof(uint32_t));
+
+	/* 終端に達するまでデコードする */
+	samples = NULL;
+	count = 0;
+	cap = 0;
+	loop = w->loop;
+	w->loop = false;
+	while (!w->eos) {
+		/* バッファを広げる */
+		if (count == cap) {
+			if (cap == limit)
+				break;
+			cap = cap == 0 ? SAMPLING_RATE : cap * 2;
+			if (cap > limit)
+				cap = limit;
+			p = realloc(samples, (size_t)cap * sizeof(uint32_t));
+			if (p == NULL) {
+				log_memory();
+				break;
+			}
+			samples = p;
+		}
+
+		ret = get_wave_samples(w, samples + count, cap - count);
+		if (ret <= 0 && !w->eos)
+			break;
+		count += ret;
+	}
+	w->loop = loop;
+
+	/* 終端に達しなかった場合、先頭に戻って通常どおりデコードする */
+	if (!w->eos) {
+		if (cap == limit)
+			add_large_file(w->dir, w->file);
+		free(samples);
+		w->eos = false;
+		if (ov_pcm_seek(&w->ovf, 0) == 0)
+			return true;
+		ov_clear(&w->ovf);
+		return open_stream(w);
+	}
+	ov_clear(&w->ovf);
+	w->eos = false;
+
+	/* 共有するサンプルを作成する */
+	clip = malloc(sizeof(struct pcm_clip));
+	if (clip == NULL) {
+		log_memory();
+		free(samples);
+		free(w->file);
+		free(w->dir);
+		free(w);
+		return false;
+	}
+	if (count > 0 && count < cap) {
+		p = realloc(samples, (size_t)count * sizeof(uint32_t));
+		if (p != NULL)
+			samples = p;
+	}
+	clip->samples = samples;
+	clip->count = count;
+	clip->ref_count = 1;
+	clip->loop_start = (int)w->loop_start;
+	clip->loop_end = (int)w->loop_end;
+	w->clip = clip;
+	w->monaural = false;
+
+	/* キャッシュに追加する */
+	add_cached_clip(w->dir, w->file, clip);
+	return true;
+}
+
+/* サンプルの参照を減らし、0になれば解放する */
+static void release_clip(struct pcm_clip *clip)
+{
+	assert(clip->ref_count > 0);
+
+	if (--clip->ref_count > 0)
+		return;
+
+	free(clip->samples);
+	free(clip);
+}
+
+/* キャッシュする1ファイルのデコード後のサイズの上限を取得する */
+static size_t get_clip_limit(void)
+{
+	return (size_t)(conf_sound_cache_clip_size > 0 ?
+			conf_sound_cache_clip_size : DEFAULT_CLIP_SIZE) * 1024;
+}
+
+/*
+ * PCMキャッシュを破棄する
+ *  - 再生中のサンプルは、destroy_wave()が呼ばれるまで解放されない
+ */
+void cleanup_wave_cache(void)
+{
+	int i;
+
+	while (cache_count > 0)
+		remove_cache_entry(cache_count - 1);
+
+	for (i = 0; i < LARGE_ENTRY_MAX; i++) {
+		free(large_tbl[i].dir);
+		free(large_tbl[i].file);
+		large_tbl[i].dir = NULL;
+		large_tbl[i].file = NULL;
+	}
+	large_next = 0;
+}
+
+/*
+ * すべてデコードしてキャッシュするかを調べる
+ *  - 効果音とボイスのみを対象とし、BGMはストリーミングで再生する
+ *  - Vorbisの圧縮率は10倍前後なので、デコード後に上限を超えそうな
+ *    ファイルと、一度上限を超えたファイルは試さない
+ */
+static bool is_cacheable(struct wave *w)
+{
+	if (strcmp(w->dir, SE_DIR) != 0 && strcmp(w->dir, CV_DIR) != 0)
+		return false;
+	if (w->file_size > get_clip_limit() / 10)
+		return false;
+	if (is_large_file(w->dir, w->file))
+		return false;
+	return true;
+}
+
+/* デコードしたら上限を超えたファイルであるかを調べる */
+static bool is_large_file(const char *dir, const char *file)
+{
+	int i;
+
+	for (i = 0; i < LARGE_ENTRY_MAX; i++) {
+		if (large_tbl[i].file == NULL)
+			continue;
+		if (strcmp(large_tbl[i].file, file) == 0 &&
+		    strcmp(large_tbl[i].dir, dir) == 0)
+			return true;
+	}
+	return false;
+}
+
+/* デコードしたら上限を超えたファイルを記録する */
+static void add_large_file(const char *dir, const char *file)
+{
+	struct large_entry *e;
+
+	e = &large_tbl[large_next];
+	free(e->dir);
+	free(e->file);
+	e->dir = strdup(dir);
+	e->file = strdup(file);
+	if (e->dir == NULL || e->file == NULL) {
+		log_memory();
+		free(e->dir);
+		free(e->file);
+		e->dir = NULL;
+		e->file = NULL;
+		return;
+	}
+	large_next = (large_next + 1) % LARGE_ENTRY_MAX;
+}
+
+/* キャッシュからサンプルを探し、見つかれば参照を増やして返す */
+static struct pcm_clip *find_cached_clip(const char *dir, const char *file)
+{
+	struct cache_entry *e;
+	int i;
+
+	for (i = 0; i < cache_count; i++) {
+		e = &cache_tbl[i];
+		if (strcmp(e->file, file) == 0 && strcmp(e->dir, dir) == 0) {
+			e->last_used = ++cache_tick;
+			e->clip->ref_count++;
+			return e->clip;
+		}
+	}
+	return NULL;
+}
+
+/* サンプルをキャッシュに追加する(追加できなくても再生には影響しない) */
+static void add_cached_clip(const char *dir, const char *file,
+			    struct pcm_clip *clip)
+{
+	struct cache_entry *e;
+	size_t size, limit;
+
+	size = (size_t)clip->count * sizeof(uint32_t);
+	limit = (size_t)(conf_sound_cache_size > 0 ?
+			 conf_sound_cache_size : DEFAULT_CACHE_SIZE) *
+		1024 * 1024;
+
+	/* 1つで上限を超える場合はキャッシュしない */
+	if (size > limit)
+		return;
+
+	/* 空きを作る */
+	evict_cached_clips(limit - size);
+	if (cache_count == CACHE_ENTRY_MAX)
+		return;
+
+	e = &cache_tbl[cache_count];
+	e->dir = strdup(dir);
+	e->file = strdup(file);
+	if (e->dir == NULL || e->file == NULL) {
+		log_memory();
+		free(e->dir);
+		free(e->file);
+		return;
+	}
+	e->clip = clip;
+	e->last_used = ++cache_tick;
+	clip->ref_count++;
+	cache_count++;
+	cache_size += size;
+}
+
+/*
+ * 使われていないサンプルを古い順に破棄する
+ *  - 合計サイズがlimit以下で、エントリに空きがある状態にする
+ *  - 再生中のサンプルは破棄できないので、上限を超えることがある
+ */
+static void evict_cached_clips(size_t limit)
+{
+	int i, oldest;
+
+	while (cache_size > limit || cache_count == CACHE_ENTRY_MAX) {
+		/* キャッシュからしか参照されていない最も古いエントリを探す */
+		oldest = -1;
+		for (i = 0; i < cache_count; i++) {
+			if (cache_tbl[i].clip->ref_count > 1)
+				continue;
+			if (oldest == -1 || cache_tbl[i].last_used <
+			    cache_tbl[oldest].last_used)
+				oldest = i;
+		}
+
+		/* すべて再生中の場合 */
+		if (oldest == -1)
+			break;
+
+		remove_cache_entry(oldest);
+	}
+}
+
+/* キャッシュのエントリを削除する */
+static void remove_cache_entry(int index)
+{
+	struct cache_entry *e;
+
+	e = &cache_tbl[index];
+	cache_size -= (size_t)e->clip->count * sizeof(uint32_t);
+	release_clip(e->clip);
+	free(e->dir);
+	free(e->file);
+
+	/* 最後のエントリで埋める */
+	cache_count--;
+	if (index != cache_count)
+		*e = cache_tbl[cache_count];
+}
@@ -31,8 +31,11 @@ bool is_wave_eos(struct wave *w);
 /* PCMストリームからサンプルを取得する */
 int get_wave_samples(struct wave *w, uint32_t *, int samples);
 
-/* PCMバッファにボリュームを適用する */
-void scale_samples(uint32_t *buf, int frames, float vol);
+/* PCMキャッシュを破棄する */
+void cleanup_wave_cache(void);
+
+/* PCMバッファにボリュームを適用して合成する(ALSA, Audio Unit) */
+void mul_add_pcm(uint32_t *dst, uint32_t *src, float vol, int samples);
 
 /* PCMストリームのファイル名を取得する(NDK) */
 const char *get_wave_file_name(struct wave *w);
@@ -27,6 +27,8 @@
 
 #include "suika.h"
 #include "asound.h"
+#include "drawthread.h"
+#include "prefetch.h"
 
 #ifdef SSE_VERSIONING
 #include "x86.h"
@@ -161,6 +163,18 @@ static bool init(void)
 	if (!init_conf())
 		return false;
 
+	/* 描画スレッドを開始する */
+	if (!init_draw_thread())
+		return false;
+
+	/* 先読みスレッドを開始する */
+	if (!init_prefetch())
+		return false;
+
+	/* イメージ読み込みスレッドを開始する */
+	if (!init_image_loader())
+		return false;
+
 	/* ALSAの使用を開始する */
 	if (!init_asound()) {
 		log_error("Can't initialize sound.\n");
@@ -200,6 +214,15 @@ static void cleanup(void)
 	/* ALSAの使用を終了する */
 	cleanup_asound();
 
+	/* イメージ読み込みスレッドを終了する */
+	cleanup_image_loader();
+
+	/* 先読みスレッドを終了する */
+	cleanup_prefetch();
+
+	/* 描画スレッドを終了する */
+	cleanup_draw_thread();
+
 	/* ウィンドウを破棄する */
 	destroy_window();
 
@@ -487,7 +510,7 @@ static void destroy_back_image(void)
 /* イベントループ */
 static void run_game_loop(void)
 {
-	int x, y, w, h;
+	int x, y, w, h, i, n;
 	bool cont;
 
 	/* フレームの開始時刻を取得する */
@@ -498,6 +521,7 @@ static void run_game_loop(void)
 		lock_image(back_image);
 
 		/* フレームイベントを呼び出す */
+		clear_stage_update_rects();
 		x = y = w = h = 0;
 		cont = on_event_frame(&x, &y, &w, &h);
 
@@ -509,8 +533,16 @@ static void run_game_loop(void)
 			break;
 
 		/* 描画を行う */
-		if (w != 0 && h != 0)
+		n = get_stage_update_rect_count();
+		if (n > 0) {
+			/* ステージが描画した矩形だけを転送する */
+			for (i = 0; i < n; i++) {
+				get_stage_update_rect(i, &x, &y, &w, &h);
+				sync_back_image(x, y, w, h);
+			}
+		} else if (w != 0 && h != 0) {
 			sync_back_image(x, y, w, h);
+		}
 
 		/* フレームの描画を行う */
 		if (!wait_for_next_frame())
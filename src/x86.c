@@ -68,12 +68,12 @@ static uint32_t asm_xgetbv(void)
 static void asm_cpuid(uint32_t fn, uint32_t* eax, uint32_t* ebx, uint32_t* ecx,
 	uint32_t* edx)
 {
-	uint32_t regs[4];
-	__cpuid(regs, fn);
-	*eax = regs[0];
-	*ebx = regs[1];
-	*ecx = regs[2];
-	*edx = regs[3];
+	int regs[4];
+	__cpuidex(regs, (int)fn, 0);
+	*eax = (uint32_t)regs[0];
+	*ebx = (uint32_t)regs[1];
+	*ecx = (uint32_t)regs[2];
+	*edx = (uint32_t)regs[3];
 }
 
 uint32_t asm_xgetbv(void)
@@ -88,13 +88,22 @@ uint32_t asm_xgetbv(void)
  */
 void x86_check_cpuid_flags(void)
 {
-	uint32_t a, b, c, d;
+	uint32_t a, b, c, d, max_fn;
 	bool has_osxsave;
 
+	/* CPUID命令の最大の機能番号を取得する */
+	asm_cpuid(0, &a, &b, &c, &d);
+	max_fn = a;
+
 	/* CPUID命令でベクトル命令のサポートを調べる */
-	asm_cpuid(7, &a, &b, &c, &d);
-	has_avx512 = b & (1 << 16);
-	has_avx2 = b & (1 << 5);
+	if (max_fn >= 7) {
+		asm_cpuid(7, &a, &b, &c, &d);
+		has_avx512 = b & (1 << 16);
+		has_avx2 = b & (1 << 5);
+	} else {
+		has_avx512 = false;
+		has_avx2 = false;
+	}
 	asm_cpuid(1, &a, &b, &c, &d);
 	has_avx = c & (1 << 28);
 	has_osxsave = c & (1 << 27);
@@ -113,8 +122,8 @@ void x86_check_cpuid_flags(void)
 	if (has_osxsave) {
 		a = asm_xgetbv();
 
-		/* ZMMが保存されない場合 */
-		if (has_avx512 && (a & 0xc0) != 0xc0) {
+		/* opmaskとZMMが保存されない場合 */
+		if (has_avx512 && (a & 0xe6) != 0xe6) {
 			/* OS disables AVX512F. */
 			has_avx512 = false;
 		}
@@ -132,8 +141,9 @@ void x86_check_cpuid_flags(void)
 		has_avx = false;
 	}
 
-	/* For now, disable AVX512 because I can't test it. */
-	has_avx512 = false;
+	/* AVX-512版はAVX2の命令も使うため、AVX2がなければ使わない */
+	if (!has_avx2)
+		has_avx512 = false;
 }
 
 #ifdef WIN
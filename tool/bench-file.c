@@ -0,0 +1,227 @@
+﻿/* -*- coding: utf-8-with-signature; tab-width: 8; indent-tabs-mode: t; -*- */
+
+/*
+ * Suika 2
+ * Copyright (C) 2001-2016, TABATA Keiichi. All rights reserved.
+ */
+
+/*
+ * パッケージのファイルエントリ検索のベンチマーク
+ *  - 大量のエントリを持つパッケージを作成し、以前の線形探索と
+ *    ハッシュテーブルによる検索の一回あたりの時間を比較する
+ *  - file.cの内部関数を使うため、file.cをそのままインクルードする
+ */
+
+#include "../src/file.c"
+
+#include <time.h>
+
+/* ベンチマーク用パッケージのエントリ数 */
+#define BENCH_ENTRY_COUNT	(20000)
+
+/* 線形探索の検索回数 */
+#define LINEAR_LOOKUP_COUNT	(20000)
+
+/* ハッシュ検索の検索回数 */
+#define HASH_LOOKUP_COUNT	(2000000)
+
+/* ベンチマーク用パッケージのファイル名 */
+#define BENCH_PACKAGE_FILE	"bench-file.arc"
+
+/*
+ * 前方参照
+ */
+static bool write_package(void);
+static void make_entry_name(char *buf, int index);
+static int find_entry_linear(const char *name);
+static double now_usec(void);
+
+/*
+ * メイン
+ */
+int main(void)
+{
+	static char name[BENCH_ENTRY_COUNT][FILE_NAME_SIZE];
+	double start, build_usec, linear_usec, hash_usec;
+	long linear_sum, hash_sum;
+	int i, j;
+
+	/* パッケージを作成して読み込む */
+	if (!write_package())
+		return 1;
+	if (!init_file() || entry_count != BENCH_ENTRY_COUNT) {
+		printf("Failed to load %s\n", BENCH_PACKAGE_FILE);
+		remove(BENCH_PACKAGE_FILE);
+		return 1;
+	}
+
+	/* ハッシュテーブルの作成時間を測る */
+	start = now_usec();
+	build_entry_hash();
+	build_usec = now_usec() - start;
+
+	/* 検索するファイル名を散らばった順序で用意する */
+	for (i = 0; i < BENCH_ENTRY_COUNT; i++)
+		make_entry_name(name[i], (int)((i * 7919L) % BENCH_ENTRY_COUNT));
+
+	/* 以前の線形探索を測る */
+	linear_sum = 0;
+	start = now_usec();
+	for (i = 0; i < LINEAR_LOOKUP_COUNT; i++)
+		linear_sum += find_entry_linear(name[i % BENCH_ENTRY_COUNT]);
+	linear_usec = (now_usec() - start) / LINEAR_LOOKUP_COUNT;
+
+	/* ハッシュテーブルによる検索を測る */
+	hash_sum = 0;
+	start = now_usec();
+	for (i = 0; i < HASH_LOOKUP_COUNT; i++)
+		hash_sum += find_entry(name[i % BENCH_ENTRY_COUNT]);
+	hash_usec = (now_usec() - start) / HASH_LOOKUP_COUNT;
+
+	/* 両方の検索結果が一致するか確認する */
+	for (i = 0; i < BENCH_ENTRY_COUNT; i++) {
+		j = find_entry(name[i]);
+		if (j < 0 || j != find_entry_linear(name[i])) {
+			printf("Lookup mismatch: %s\n", name[i]);
+			cleanup_file();
+			remove(BENCH_PACKAGE_FILE);
+			return 1;
+		}
+	}
+	if (find_entry("bg/none.png") != -1) {
+		printf("Lookup mismatch: bg/none.png\n");
+		cleanup_file();
+		remove(BENCH_PACKAGE_FILE);
+		return 1;
+	}
+
+	printf("entries:            %d\n", BENCH_ENTRY_COUNT);
+	printf("linear strcmp scan: %.2f us per lookup\n", linear_usec);
+	printf("hash lookup:        %.2f us per lookup\n", hash_usec);
+	printf("table build:        %.2f ms\n", build_usec / 1000.0);
+	printf("(checksum %ld %ld)\n", linear_sum,
+	       hash_sum / (HASH_LOOKUP_COUNT / LINEAR_LOOKUP_COUNT));
+
+	cleanup_file();
+	remove(BENCH_PACKAGE_FILE);
+	return 0;
+}
+
+/* ベンチマーク用パッケージを書き出す */
+static bool write_package(void)
+{
+	char buf[FILE_NAME_SIZE];
+	FILE *fp;
+	uint64_t count, size, offset;
+	int i;
+
+	fp = fopen(BENCH_PACKAGE_FILE, "wb");
+	if (fp == NULL) {
+		printf("Can't open %s\n", BENCH_PACKAGE_FILE);
+		return false;
+	}
+
+	/* 中身は各1バイトとする */
+	count = BENCH_ENTRY_COUNT;
+	fwrite(&count, sizeof(uint64_t), 1, fp);
+	offset = sizeof(uint64_t) +
+		(uint64_t)BENCH_ENTRY_COUNT *
+		(FILE_NAME_SIZE + sizeof(uint64_t) * 2);
+	size = 1;
+	for (i = 0; i < BENCH_ENTRY_COUNT; i++) {
+		memset(buf, 0, sizeof(buf));
+		make_entry_name(buf, i);
+		fwrite(buf, FILE_NAME_SIZE, 1, fp);
+		fwrite(&size, sizeof(uint64_t), 1, fp);
+		fwrite(&offset, sizeof(uint64_t), 1, fp);
+		offset++;
+	}
+	for (i = 0; i < BENCH_ENTRY_COUNT; i++)
+		fputc('x', fp);
+
+	if (fclose(fp) != 0) {
+		printf("Can't write %s\n", BENCH_PACKAGE_FILE);
+		remove(BENCH_PACKAGE_FILE);
+		return false;
+	}
+	return true;
+}
+
+/* エントリ名を作成する */
+static void make_entry_name(char *buf, int index)
+{
+	static const char *dir[] = {"bg", "ch", "cv", "se", "txt"};
+
+	snprintf(buf, FILE_NAME_SIZE, "%s/file%05d.dat", dir[index % 5],
+		 index);
+}
+
+/* 以前の線形探索でファイルエントリを検索する */
+static int find_entry_linear(const char *name)
+{
+	uint64_t i;
+
+	for (i = 0; i < entry_count; i++) {
+		if (strcmp(entry[i].name, name) == 0)
+			return (int)i;
+	}
+	return -1;
+}
+
+/* 現在時刻をマイクロ秒で取得する */
+static double now_usec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec * 1000000.0 + (double)ts.tv_nsec / 1000.0;
+}
+
+/*
+ * file.cが使うプラットフォーム関数の代わり
+ */
+
+char *make_valid_path(const char *dir, const char *file)
+{
+	char *buf;
+	size_t len;
+
+	/* パッケージはベンチマーク用のファイルに差し替える */
+	if (dir == NULL && strcmp(file, PACKAGE_FILE) == 0)
+		return strdup(BENCH_PACKAGE_FILE);
+
+	len = (dir != NULL ? strlen(dir) + 1 : 0) + strlen(file) + 1;
+	buf = malloc(len);
+	if (buf == NULL)
+		return NULL;
+	if (dir != NULL)
+		snprintf(buf, len, "%s/%s", dir, file);
+	else
+		snprintf(buf, len, "%s", file);
+	return buf;
+}
+
+void log_memory(void)
+{
+	printf("Out of memory.\n");
+}
+
+void log_package_file_error(void)
+{
+	printf("Package file error.\n");
+}
+
+void log_file_name(const char *dir, const char *file)
+{
+	printf("Invalid file name: %s/%s\n", dir, file);
+}
+
+void log_dir_file_open(const char *dir, const char *file)
+{
+	printf("Can't open %s/%s\n", dir, file);
+}
+
+void log_file_open(const char *fname)
+{
+	printf("Can't open %s\n", fname);
+}
@@ -16,6 +16,7 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
 
 #ifdef _WIN32
 #include <windows.h>
@@ -46,6 +47,46 @@ const char *dir_names[] = {
 /* ディレクトリ名の数 */
 #define DIR_COUNT	(sizeof(dir_names) / sizeof(const char *))
 
+/*
+ * コンパイル済みスクリプト
+ *  - src/script.cの読み込み処理と同じ形式で出力すること
+ */
+
+/* スクリプトのディレクトリ */
+#define SCRIPT_DIR_PREFIX	"txt/"
+
+/* コンパイル済みスクリプトのファイル名の拡張子 */
+#define COMPILED_EXT		".suika"
+
+/* コンパイル済みスクリプトのマジック */
+#define COMPILED_MAGIC		"SUIKASCB"
+#define COMPILED_MAGIC_SIZE	(8)
+
+/* コンパイル済みスクリプトのフォーマットのバージョン */
+#define COMPILED_VERSION	(1)
+
+/* エンジンの1行の読み込みサイズ */
+#define LINE_BUF_SIZE		(65536)
+
+/* コマンドの引数の最大数(コマンド名も含める) */
+#define PARAM_SIZE		(137)
+
+/* 省略された引数を表すオフセット */
+#define NO_PARAM		(-1)
+
+/* 伸長可能なバイト列 */
+struct bytes {
+	uint8_t *p;
+	size_t len;
+	size_t alloc;
+};
+
+/* コンパイル中のコマンド配列、引数テーブル、文字列アリーナ */
+struct bytes cmd_bytes, param_bytes, arena_bytes;
+
+/* コンパイル中のコマンド数と引数の数 */
+uint32_t cmd_count, param_count;
+
 /* ファイルエントリ */
 struct entry {
 	/* ファイル名 */
@@ -56,6 +97,9 @@ struct entry {
 
 	/* ファイルのアーカイブ内でのオフセット */
 	uint64_t offset;
+
+	/* メモリ上で生成したファイルの内容(NULLならファイルから読む) */
+	uint8_t *data;
 } entry[ENTRY_SIZE];
 
 /* ファイル数 */
@@ -65,6 +109,12 @@ uint64_t file_count;
 uint64_t offset;
 
 /* 前方参照 */
+bool compile_script(const char *path, uint8_t **data, size_t *size);
+bool compile_line(char *buf, int line);
+char *strtok_escape(char *buf);
+bool add_bytes(struct bytes *b, const void *data, size_t len);
+bool add_u32(struct bytes *b, uint32_t val);
+int add_string(const char *str);
 bool write_file_entries(FILE *fp);
 bool write_file_bodies(FILE *fp);
 
@@ -136,6 +186,328 @@ bool get_file_names(const char *dir)
 }
 #endif
 
+/*
+ * スクリプトをコンパイルしたエントリを追加する
+ *  - コンパイルできないスクリプトはエンジンがテキストを構文解析する
+ */
+bool compile_scripts(void)
+{
+	uint8_t *data;
+	size_t size, len;
+	uint64_t i, count;
+
+	count = file_count;
+	for (i = 0; i < count; i++) {
+		/* スクリプトのみを対象にする */
+		if (strncmp(entry[i].name, SCRIPT_DIR_PREFIX,
+			    strlen(SCRIPT_DIR_PREFIX)) != 0)
+			continue;
+		len = strlen(entry[i].name);
+		if (len >= strlen(COMPILED_EXT) &&
+		    strcmp(entry[i].name + len - strlen(COMPILED_EXT),
+			   COMPILED_EXT) == 0)
+			continue;
+		if (len + strlen(COMPILED_EXT) >= FILE_NAME_SIZE)
+			continue;
+		if (file_count == ENTRY_SIZE) {
+			printf("Too many files.");
+			return false;
+		}
+
+		/* コンパイルする */
+		if (!compile_script(entry[i].name, &data, &size)) {
+			printf("  %s (not compiled)\n", entry[i].name);
+			continue;
+		}
+
+		/* エントリを追加する */
+		snprintf(entry[file_count].name, FILE_NAME_SIZE, "%s%s",
+			 entry[i].name, COMPILED_EXT);
+		entry[file_count].size = size;
+		entry[file_count].data = data;
+		printf("  %s\n", entry[file_count].name);
+		file_count++;
+	}
+	return true;
+}
+
+/*
+ * スクリプトをコンパイルする
+ *  - エンジンのgets_rfile()と同じく、LF、CRLF、CR、NULで行を区切る
+ */
+bool compile_script(const char *path, uint8_t **data, size_t *size)
+{
+	static char buf[LINE_BUF_SIZE];
+	struct bytes out;
+	uint8_t *text;
+	FILE *fp;
+	long file_size;
+	size_t pos, top, len;
+	int line;
+	bool success;
+
+	/* ファイル全体を読み込む */
+#ifdef _WIN32
+	char *win_path = strdup(path);
+	*strchr(win_path, '/') = '\\';
+	fp = fopen(win_path, "rb");
+	free(win_path);
+#else
+	fp = fopen(path, "rb");
+#endif
+	if (fp == NULL)
+		return false;
+	fseek(fp, 0, SEEK_END);
+	file_size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	if (file_size < 0) {
+		fclose(fp);
+		return false;
+	}
+	text = malloc((size_t)file_size + 1);
+	if (text == NULL) {
+		fclose(fp);
+		return false;
+	}
+	if (fread(text, 1, (size_t)file_size, fp) != (size_t)file_size) {
+		free(text);
+		fclose(fp);
+		return false;
+	}
+	fclose(fp);
+
+	/* 行ごとに処理する */
+	cmd_bytes.len = param_bytes.len = arena_bytes.len = 0;
+	cmd_count = param_count = 0;
+	success = true;
+	pos = 0;
+	line = 0;
+	while (success && pos < (size_t)file_size) {
+		/* 行末を探す */
+		top = pos;
+		while (pos < (size_t)file_size && text[pos] != '\n' &&
+		       text[pos] != '\r' && text[pos] != '\0')
+			pos++;
+
+		/* エンジンで行が分割される長さであればコンパイルしない */
+		len = pos - top;
+		if (len >= LINE_BUF_SIZE - 1) {
+			success = false;
+			break;
+		}
+		memcpy(buf, text + top, len);
+		buf[len] = '\0';
+
+		/* 改行をスキップする */
+		if (pos < (size_t)file_size) {
+			if (text[pos] == '\r' && pos + 1 < (size_t)file_size &&
+			    text[pos + 1] == '\n')
+				pos++;
+			pos++;
+		}
+
+		success = compile_line(buf, line++);
+	}
+	free(text);
+	if (!success || cmd_count == 0 || arena_bytes.len > INT32_MAX)
+		return false;
+
+	/* ヘッダ、コマンド配列、引数テーブル、文字列アリーナの順に並べる */
+	out.p = NULL;
+	out.len = out.alloc = 0;
+	if (!add_bytes(&out, COMPILED_MAGIC, COMPILED_MAGIC_SIZE) ||
+	    !add_u32(&out, COMPILED_VERSION) ||
+	    !add_u32(&out, cmd_count) ||
+	    !add_u32(&out, param_count) ||
+	    !add_u32(&out, (uint32_t)arena_bytes.len) ||
+	    !add_bytes(&out, cmd_bytes.p, cmd_bytes.len) ||
+	    !add_bytes(&out, param_bytes.p, param_bytes.len) ||
+	    !add_bytes(&out, arena_bytes.p, arena_bytes.len)) {
+		free(out.p);
+		return false;
+	}
+
+	*data = out.p;
+	*size = out.len;
+	return true;
+}
+
+/*
+ * 1行をコンパイルする
+ *  - src/script.cの各parse_*()と同じ順に文字列と引数を追加する
+ */
+bool compile_line(char *buf, int line)
+{
+	char *tp, *first, *second, *third;
+	uint32_t param;
+	int text, top, count;
+
+	/* 空行とコメント行はコマンドにならない */
+	if (buf[0] == '\0' || buf[0] == '#')
+		return true;
+
+	/* オリジナルの行を保存する */
+	text = add_string(buf);
+	if (text == -1)
+		return false;
+
+	/* 行頭の文字で仕分けして引数を追加する */
+	param = param_count;
+	count = 0;
+	switch (buf[0]) {
+	case '@':
+		/* 命令行はダブルクォーテーションでエスケープ可能な空白区切り */
+		top = add_string(buf);
+		if (top == -1)
+			return false;
+		strtok_escape((char *)arena_bytes.p + top);
+		if (!add_u32(&param_bytes, (uint32_t)top))
+			return false;
+		count = 1;
+		while ((tp = strtok_escape(NULL)) != NULL &&
+		       count < PARAM_SIZE) {
+			if (!add_u32(&param_bytes,
+				     (uint32_t)(tp - (char *)arena_bytes.p)))
+				return false;
+			count++;
+		}
+		break;
+	case '*':
+		/* セリフ行は'*'区切りで2つか3つのトークンがある */
+		top = add_string(&buf[1]);
+		if (top == -1)
+			return false;
+		first = strtok((char *)arena_bytes.p + top, "*");
+		second = strtok(NULL, "*");
+		third = strtok(NULL, "*");
+		if (first == NULL || second == NULL)
+			return false;
+		if (third == NULL) {
+			third = second;
+			second = NULL;
+		}
+		if (!add_u32(&param_bytes, (uint32_t)top) ||
+		    !add_u32(&param_bytes,
+			     (uint32_t)(first - (char *)arena_bytes.p)) ||
+		    !add_u32(&param_bytes, second == NULL ?
+			     (uint32_t)NO_PARAM :
+			     (uint32_t)(second - (char *)arena_bytes.p)) ||
+		    !add_u32(&param_bytes,
+			     (uint32_t)(third - (char *)arena_bytes.p)))
+			return false;
+		count = 4;
+		break;
+	case ':':
+		/* ラベル行はラベル名が引数になる */
+		top = add_string(&buf[1]);
+		if (top == -1)
+			return false;
+		if (!add_u32(&param_bytes, (uint32_t)top))
+			return false;
+		count = 1;
+		break;
+	default:
+		/* メッセージ行は引数を持たない */
+		break;
+	}
+	param_count += (uint32_t)count;
+
+	/* コマンドを追加する */
+	if (!add_u32(&cmd_bytes, (uint32_t)line) ||
+	    !add_u32(&cmd_bytes, (uint32_t)text) ||
+	    !add_u32(&cmd_bytes, param) ||
+	    !add_u32(&cmd_bytes, (uint32_t)count))
+		return false;
+	cmd_count++;
+
+	return true;
+}
+
+/* ダブルクォーテーションでエスケープ可能なトークナイズを実行する */
+char *strtok_escape(char *buf)
+{
+	static char *top = NULL;
+	char *result;
+
+	/* 初回呼び出しの場合バッファを保存する */
+	if (buf != NULL)
+		top = buf;
+
+	/* すでにバッファの終端に達している場合NULLを返す */
+	if (*top == '\0')
+		return NULL;
+
+	/* 先頭のスペースをスキップする */
+	for (; *top != '\0' && *top == ' '; top++)
+		;
+	if (*top == '\0')
+		return NULL;
+
+	/* エスケープされている場合 */
+	if (*top == '\"') {
+		result = ++top;
+		for (; *top != '\0' && *top != '\"'; top++)
+			;
+		if (*top == '\"')
+			*top++ = '\0';
+		return result;
+	}
+
+	/* エスケーブされていない場合 */
+	result = top;
+	for (; *top != '\0' && *top != ' '; top++)
+		;
+	if (*top == ' ')
+		*top++ = '\0';
+	return result;
+}
+
+/* バイト列を追加する */
+bool add_bytes(struct bytes *b, const void *data, size_t len)
+{
+	uint8_t *p;
+	size_t size;
+
+	if (b->len + len > b->alloc) {
+		size = b->alloc == 0 ? 65536 : b->alloc;
+		while (b->len + len > size)
+			size *= 2;
+		p = realloc(b->p, size);
+		if (p == NULL) {
+			printf("Out of memory.\n");
+			return false;
+		}
+		b->p = p;
+		b->alloc = size;
+	}
+	memcpy(b->p + b->len, data, len);
+	b->len += len;
+	return true;
+}
+
+/* リトルエンディアンの32ビット値を追加する */
+bool add_u32(struct bytes *b, uint32_t val)
+{
+	uint8_t le[4];
+
+	le[0] = (uint8_t)val;
+	le[1] = (uint8_t)(val >> 8);
+	le[2] = (uint8_t)(val >> 16);
+	le[3] = (uint8_t)(val >> 24);
+	return add_bytes(b, le, 4);
+}
+
+/* 文字列アリーナに文字列を追加し、オフセットを返す(失敗した場合は-1) */
+int add_string(const char *str)
+{
+	size_t ofs;
+
+	ofs = arena_bytes.len;
+	if (!add_bytes(&arena_bytes, str, strlen(str) + 1))
+		return -1;
+	return (int)ofs;
+}
+
 /*
  * 各ファイルのサイズを求める
  */
@@ -147,6 +519,12 @@ bool get_file_sizes(void)
 	/* 各ファイルのサイズを求め、オフセットを計算する */
 	offset = FILE_COUNT_BYTES + ENTRY_BYTES * file_count;
 	for (i = 0; i < file_count; i++) {
+		/* メモリ上で生成したファイルはサイズが決まっている */
+		if (entry[i].data != NULL) {
+			entry[i].offset = offset;
+			offset += entry[i].size;
+			continue;
+		}
 #ifdef _WIN32
 		char *path = strdup(entry[i].name);
 		*strchr(path, '/') = '\\';
@@ -220,6 +598,13 @@ bool write_file_bodies(FILE *fp)
 	size_t len;
 
 	for (i = 0; i < file_count; i++) {
+		/* メモリ上で生成したファイルはそのまま書き出す */
+		if (entry[i].data != NULL) {
+			if (fwrite(entry[i].data, (size_t)entry[i].size, 1,
+				   fp) < 1)
+				return false;
+			continue;
+		}
 #ifdef _WIN32
 		char *path = strdup(entry[i].name);
 		*strchr(path, '/') = '\\';
@@ -257,6 +642,11 @@ int main(int argc, char *argv[])
 		if (!get_file_names(dir_names[i]))
 			return 1;
 
+	/* スクリプトをコンパイルする */
+	printf("Compiling scripts...\n");
+	if (!compile_scripts())
+		return 1;
+
 	/* ファイルのサイズを取得し、アーカイブ内でのオフセットを決定する */
 	printf("Checking file sizes...\n");
 	if (!get_file_sizes())